@@ -0,0 +1,485 @@
+"""
+Protocol efficiency benchmark: same relay workload over each control protocol
+Run: python bench_protocols.py --emu [--count 1000]                  (MicroPython on host_emu.py)
+     python bench_protocols.py --c 192.168.1.100 [--tunnel] [--udp]   (C firmware board)
+     python bench_protocols.py --c 192.168.1.100 --udp --md bench_protocols.md
+
+Workload: --count relay toggles (relays 1..8 in turn), each followed by a
+state read that checks the toggle landed. Per protocol it reports toggle
+and read round trip (p50/p99), commands/s (toggle + read), bytes and
+packets on the wire per command, device CPU per command and errors.
+
+Protocols in this tree:
+  http        C: POST /api/relay/N + GET /api/relays; Py: GET /r?n=&s= + GET /api
+  http-mask   C: POST /api/relays/mask {"toggle": bit}, read as above
+  tunnel      C with TUNNEL_ENABLE 1: the http requests framed over the
+              board's outbound hub connection (this script is the hub:
+              TUNNEL_HOST = this PC, --tunnel-port, --token)
+  udp-peer    C: peer link datagrams (peer.c). Add this PC to PEER_TABLE
+              ({{pc ip}, 0x00, 0x00}) with the same PEER_KEY; a STATE
+              message sets the relay and its ACK carries the applied state,
+              so there is no separate read. The board's challenge is
+              learned from its datagrams and echoed as peer.c requires
+WebSocket, Modbus TCP and MQTT are not implemented by either firmware;
+they are listed in the table as such. The emulator runs the MicroPython
+server, which only speaks http.
+
+Wire bytes and packets are the host's IP/TCP/UDP counters (/proc/net,
+Linux), headers included, sampled around each run: keep other traffic
+off the host; refused connects retried against the single-socket
+MicroPython server count too. Device CPU: C firmware - busy
+cpu_seconds_total from /metrics (core 0, idle excluded) less the idle
+background rate measured first; emulator - server thread CPU time, which
+includes its polling loop. The C per-IP limit (CLIENTS_RATE_RPS) answers
+429 to a fast client; raise it to measure raw throughput.
+--md appends the table to a markdown file under a build heading (git
+describe, or --build) so results of successive builds line up.
+"""
+import argparse
+import asyncio
+import json
+import os
+import re
+import struct
+import subprocess
+import sys
+import time
+import types
+import urllib.request
+
+from trace_replay import send_one, percentile
+
+NOT_IMPLEMENTED = ["websocket", "modbus-tcp", "mqtt"]
+
+# ============= WIRE AND CPU COUNTERS =============
+
+def net_counters():
+    """Host totals: {tcp_out, tcp_in, udp_out, udp_in, ip_out_b, ip_in_b}, None off Linux"""
+    try:
+        snmp = open("/proc/net/snmp").read().splitlines()
+        netstat = open("/proc/net/netstat").read().splitlines()
+    except OSError:
+        return None
+    out = {}
+
+    def table(lines, prefix):
+        rows = [l.split()[1:] for l in lines if l.startswith(prefix + ":")]
+        return dict(zip(rows[0], map(int, rows[1]))) if len(rows) >= 2 else {}
+
+    tcp, udp, ipext = table(snmp, "Tcp"), table(snmp, "Udp"), table(netstat, "IpExt")
+    out["tcp_out"], out["tcp_in"] = tcp.get("OutSegs", 0), tcp.get("InSegs", 0)
+    out["udp_out"], out["udp_in"] = udp.get("OutDatagrams", 0), udp.get("InDatagrams", 0)
+    out["ip_out_b"], out["ip_in_b"] = ipext.get("OutOctets", 0), ipext.get("InOctets", 0)
+    return out
+
+def wire_delta(before, after, loopback):
+    """(bytes, packets) between two samples; on loopback every packet is counted once"""
+    if not before or not after:
+        return None, None
+    d = {k: after[k] - before[k] for k in before}
+    if loopback:
+        return d["ip_out_b"], d["tcp_out"] + d["udp_out"]
+    return d["ip_out_b"] + d["ip_in_b"], d["tcp_out"] + d["tcp_in"] + d["udp_out"] + d["udp_in"]
+
+class DeviceCpu:
+    """Busy CPU seconds of the device under test"""
+
+    def __init__(self, host=None, port=80, board=None):
+        self.host = host
+        self.port = port
+        self.board = board
+        self.idle_rate = 0.0
+
+    def read(self):
+        if self.board:
+            return self.board.cpu_seconds()
+        if not self.host:
+            return None             # MicroPython board: no CPU counters
+        try:
+            text = urllib.request.urlopen(f"http://{self.host}:{self.port}/metrics", timeout=5).read().decode()
+        except OSError:
+            return None
+        busy = 0.0
+        found = False
+        for m in re.finditer(r'^cpu_seconds_total\{core="0",subsystem="(\w+)"\} ([\d.]+)$', text, re.M):
+            found = True
+            if m.group(1) != "idle":
+                busy += float(m.group(2))
+        return busy if found else None
+
+    def calibrate(self, seconds):
+        """Background busy rate with no commands; the emulated server spins while idle, so not there"""
+        if self.board:
+            return
+        a = self.read()
+        time.sleep(seconds)
+        b = self.read()
+        if a is not None and b is not None:
+            self.idle_rate = max(0.0, (b - a) / seconds)
+
+    def used(self, before, after, elapsed):
+        if before is None or after is None:
+            return None
+        return max(0.0, after - before - self.idle_rate * elapsed)
+
+# ============= PROTOCOLS =============
+
+def http_get(path):
+    return f"GET {path} HTTP/1.1\r\nHost: board\r\nConnection: close\r\n\r\n".encode()
+
+def http_post(path, body):
+    return (f"POST {path} HTTP/1.1\r\nHost: board\r\nContent-Type: application/json\r\n"
+            f"Content-Length: {len(body)}\r\nConnection: close\r\n\r\n{body}").encode()
+
+def c_state(body):
+    """Relay mask from the C firmware's GET /api/relays"""
+    try:
+        d = json.loads(body)
+        return sum(1 << (int(k.split("_")[1]) - 1) for k, v in d.items() if v.get("state"))
+    except (ValueError, AttributeError, IndexError):
+        return None
+
+def py_state(body):
+    """Relay mask from the MicroPython server's GET /api"""
+    try:
+        return sum(1 << i for i, v in enumerate(json.loads(body)["r"]) if v)
+    except (ValueError, KeyError, TypeError):
+        return None
+
+class Http:
+    """Request/response over a fresh TCP connection per request"""
+
+    def __init__(self, name, kind, host, port, args, mask=False):
+        self.name = name
+        self.kind = kind
+        self.host = host
+        self.port = port
+        self.args = args
+        self.mask = mask
+
+    async def setup(self):
+        return None
+
+    async def exchange(self, raw):
+        status, body, _, error = await send_one(self.host, self.port, raw, 5, 400)
+        return (status, body) if not error else (0, b"")
+
+    def toggle_request(self, relay, value):
+        if self.kind == "py":
+            return http_get(f"/r?n={relay}&s={value}")
+        if self.mask:
+            return http_post("/api/relays/mask", json.dumps({"toggle": 1 << (relay - 1)}))
+        return http_post(f"/api/relay/{relay}", json.dumps({"state": value}))
+
+    async def toggle(self, relay, value):
+        status, _ = await self.exchange(self.toggle_request(relay, value))
+        return 200 <= status < 400
+
+    async def read(self):
+        if self.kind == "py":
+            status, body = await self.exchange(http_get("/api"))
+            return py_state(body) if status == 200 else None
+        status, body = await self.exchange(http_get("/api/relays"))
+        return c_state(body) if status == 200 else None
+
+    def close(self):
+        pass
+
+class Tunnel(Http):
+    """The http requests over the board's outbound tunnel, this script as hub"""
+
+    def __init__(self, name, args):
+        super().__init__(name, "c", None, None, args)
+        self.hub = None
+
+    async def setup(self):
+        import tunnel_hub
+        self.hub = tunnel_hub.Hub(types.SimpleNamespace(token=self.args.token))
+        await asyncio.start_server(self.hub.on_board, "0.0.0.0", self.args.tunnel_port)
+        print(f"  waiting up to {self.args.tunnel_wait:g} s for the board on :{self.args.tunnel_port}...")
+        try:
+            await asyncio.wait_for(self.hub.connected.wait(), self.args.tunnel_wait)
+        except asyncio.TimeoutError:
+            return "board did not connect (TUNNEL_ENABLE, TUNNEL_HOST, token?)"
+        await asyncio.sleep(0.5)
+        return None
+
+    async def exchange(self, raw):
+        if not self.hub.board:
+            return 0, b""
+        try:
+            resp = await self.hub.board.request(raw)
+        except (asyncio.TimeoutError, ConnectionError):
+            return 0, b""
+        m = re.match(rb"HTTP/1\.[01] (\d{3})", resp)
+        return (int(m.group(1)) if m else 0), resp.partition(b"\r\n\r\n")[2]
+
+PEER_PORT = 5006
+PEER_MAGIC, PEER_MSG_STATE, PEER_MSG_HB, PEER_MSG_ACK = 0xA5, 1, 2, 3
+PEER_MSG = struct.Struct("<BBBBIIIIII")  # magic, type, mask, value, boot, seq, t_us, chal, echo, apply_us (+ tag)
+
+def siphash24(key, data):
+    """SipHash-2-4, as peer.c computes it"""
+    M = 0xFFFFFFFFFFFFFFFF
+    k0, k1 = struct.unpack("<QQ", key)
+    v = [0x736F6D6570736575 ^ k0, 0x646F72616E646F6D ^ k1, 0x6C7967656E657261 ^ k0, 0x7465646279746573 ^ k1]
+
+    def rotl(x, b):
+        return ((x << b) | (x >> (64 - b))) & M
+
+    def rnd():
+        v[0] = (v[0] + v[1]) & M; v[1] = rotl(v[1], 13) ^ v[0]; v[0] = rotl(v[0], 32)
+        v[2] = (v[2] + v[3]) & M; v[3] = rotl(v[3], 16) ^ v[2]
+        v[0] = (v[0] + v[3]) & M; v[3] = rotl(v[3], 21) ^ v[0]
+        v[2] = (v[2] + v[1]) & M; v[1] = rotl(v[1], 17) ^ v[2]; v[2] = rotl(v[2], 32)
+
+    n = len(data) // 8 * 8
+    for i in range(0, n, 8):
+        m = struct.unpack_from("<Q", data, i)[0]
+        v[3] ^= m
+        rnd(); rnd()
+        v[0] ^= m
+    b = (len(data) & 0xFF) << 56
+    for j, byte in enumerate(data[n:]):
+        b |= byte << (8 * j)
+    v[3] ^= b
+    rnd(); rnd()
+    v[0] ^= b
+    v[2] ^= 0xFF
+    rnd(); rnd(); rnd(); rnd()
+    return v[0] ^ v[1] ^ v[2] ^ v[3]
+
+class UdpPeer:
+    """Peer link STATE/ACK datagrams; this PC is a peer of the board"""
+
+    def __init__(self, name, host, args):
+        self.name = name
+        self.host = host
+        self.args = args
+        self.key = bytes.fromhex(args.peer_key)
+        self.boot = struct.unpack("<I", os.urandom(4))[0]
+        self.chal = struct.unpack("<I", os.urandom(4))[0]
+        self.peer_chal = 0      # Board's challenge, echoed so it accepts our state
+        self.seq = 0
+        self.sock = None
+        self.waiting = None
+        self.retries = 0
+
+    def pack(self, mtype, mask, value, seq, t_us):
+        """Packed each send, so a retry echoes the board's latest challenge"""
+        body = PEER_MSG.pack(PEER_MAGIC, mtype, mask, value, self.boot, seq, t_us,
+                             self.chal, self.peer_chal, 0)
+        return body + struct.pack("<Q", siphash24(self.key, body))
+
+    async def setup(self):
+        loop = asyncio.get_running_loop()
+        peer = self
+
+        class Proto(asyncio.DatagramProtocol):
+            def datagram_received(self, data, addr):
+                if len(data) != PEER_MSG.size + 8:
+                    return
+                magic, mtype, mask, value, boot, seq, _, chal, _, _ = PEER_MSG.unpack_from(data)
+                if struct.unpack_from("<Q", data, PEER_MSG.size)[0] != siphash24(peer.key, data[:PEER_MSG.size]):
+                    return
+                peer.peer_chal = chal
+                w = peer.waiting
+                if mtype == PEER_MSG_ACK and boot == peer.boot and w and seq == w[0] and not w[1].done():
+                    w[1].set_result(value)
+
+        self.sock, _ = await loop.create_datagram_endpoint(Proto, local_addr=("0.0.0.0", PEER_PORT))
+        # One acked no-op state message shows the board has this PC in PEER_TABLE;
+        # the first tries are dropped until its heartbeat brings the challenge
+        if await self.send_state(0, 0, self.args.udp_retries + 50) is None:
+            return "no ACK from the board (this PC in PEER_TABLE, PEER_KEY, UDP 5006?)"
+        return None
+
+    async def send_state(self, mask, value, retries=None):
+        """STATE message resent every --udp-retry-ms until acked: applied value or None"""
+        self.seq += 1
+        seq, t_us = self.seq, int(time.monotonic() * 1e6) & 0xFFFFFFFF
+        fut = asyncio.get_running_loop().create_future()
+        self.waiting = (seq, fut)
+        for attempt in range((self.args.udp_retries if retries is None else retries) + 1):
+            if attempt and retries is None:
+                self.retries += 1
+            self.sock.sendto(self.pack(PEER_MSG_STATE, mask, value, seq, t_us), (self.host, PEER_PORT))
+            try:
+                return await asyncio.wait_for(asyncio.shield(fut), self.args.udp_retry_ms / 1000)
+            except asyncio.TimeoutError:
+                continue
+        return None
+
+    async def toggle(self, relay, value):
+        bit = 1 << (relay - 1)
+        applied = await self.send_state(bit, bit if value else 0)
+        return applied is not None and bool(applied & bit) == bool(value)
+
+    async def read(self):
+        return "ack"        # The ACK already carried the applied state
+
+    def close(self):
+        if self.sock:
+            self.sock.close()
+
+# ============= WORKLOAD =============
+
+async def run_protocol(proto, args, wire_loopback, cpu):
+    error = await proto.setup()
+    if error:
+        return {"skipped": error}
+
+    toggles, reads = [], []
+    errors = mismatches = 0
+    state = await proto.read()
+    if state == "ack" or state is None:
+        state = 0
+
+    net0, cpu0, t0 = net_counters(), cpu.read(), time.monotonic()
+    for i in range(args.count):
+        relay = i % 8 + 1
+        value = 0 if state >> (relay - 1) & 1 else 1
+        t = time.monotonic()
+        ok = await proto.toggle(relay, value)
+        toggles.append(time.monotonic() - t)
+        if not ok:
+            errors += 1
+            continue
+        state ^= 1 << (relay - 1)
+        t = time.monotonic()
+        got = await proto.read()
+        if got == "ack":
+            continue
+        reads.append(time.monotonic() - t)
+        if got is None:
+            errors += 1
+        elif got & 0xFF != state:
+            mismatches += 1
+            state = got
+    elapsed = time.monotonic() - t0
+    net1, cpu1 = net_counters(), cpu.read()
+    proto.close()
+
+    wire_b, wire_p = wire_delta(net0, net1, wire_loopback)
+    used = cpu.used(cpu0, cpu1, elapsed)
+    n = args.count
+    ms = lambda xs, p: round(percentile([x * 1000 for x in xs], p), 2) if xs else None
+    return {
+        "toggle_p50_ms": ms(toggles, 50),
+        "toggle_p99_ms": ms(toggles, 99),
+        "read_p50_ms": ms(reads, 50),
+        "read_p99_ms": ms(reads, 99),
+        "cmd_s": round(n / elapsed, 1),
+        "bytes_cmd": round(wire_b / n) if wire_b is not None else None,
+        "pkts_cmd": round(wire_p / n, 1) if wire_p is not None else None,
+        "cpu_us_cmd": round(used * 1e6 / n) if used is not None else None,
+        "errors": errors,
+        "mismatches": mismatches,
+        "retries": getattr(proto, "retries", 0),
+    }
+
+def fmt(v, unit=""):
+    return "-" if v is None else f"{v}{unit}"
+
+def table(results, target, build):
+    lines = [
+        f"### {build} - {target} - {time.strftime('%Y-%m-%d %H:%M')}",
+        "",
+        "| protocol | toggle p50/p99 ms | read p50/p99 ms | cmd/s | bytes/cmd | pkts/cmd | CPU us/cmd | errors |",
+        "|---|---|---|---|---|---|---|---|",
+    ]
+    for name, r in results.items():
+        if "skipped" in r:
+            lines.append(f"| {name} | {r['skipped']} | | | | | | |")
+            continue
+        read = (f"{fmt(r['read_p50_ms'])}/{fmt(r['read_p99_ms'])}" if r["read_p50_ms"] is not None
+                else "in ack")
+        err = f"{r['errors']}" + (f" (+{r['mismatches']} mismatched)" if r["mismatches"] else "")
+        if r["retries"]:
+            err += f", {r['retries']} resent"
+        lines.append(f"| {name} | {fmt(r['toggle_p50_ms'])}/{fmt(r['toggle_p99_ms'])} | {read} | "
+                     f"{r['cmd_s']} | {fmt(r['bytes_cmd'])} | {fmt(r['pkts_cmd'])} | "
+                     f"{fmt(r['cpu_us_cmd'])} | {err} |")
+    return "\n".join(lines) + "\n"
+
+def git_build():
+    try:
+        return subprocess.check_output(["git", "describe", "--always", "--dirty"],
+                                       cwd=os.path.dirname(os.path.abspath(__file__)),
+                                       stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown build"
+
+def main():
+    ap = argparse.ArgumentParser(description="Relay control protocol benchmark")
+    dst = ap.add_mutually_exclusive_group(required=True)
+    dst.add_argument("--c", help="C firmware board (host)")
+    dst.add_argument("--py", help="MicroPython board (host)")
+    dst.add_argument("--emu", action="store_true", help="MicroPython server on host_emu.py")
+    ap.add_argument("--count", type=int, default=1000, help="relay toggles per protocol")
+    ap.add_argument("--tunnel", action="store_true", help="C: also run over the hub tunnel")
+    ap.add_argument("--tunnel-port", type=int, default=7000)
+    ap.add_argument("--tunnel-wait", type=float, default=30, help="seconds to wait for the board")
+    ap.add_argument("--token", default="change-me")
+    ap.add_argument("--udp", action="store_true", help="C: also run over the UDP peer link")
+    ap.add_argument("--peer-key", default="5761766573686172652d706565723031",
+                    help="PEER_KEY as hex (default: config.h)")
+    ap.add_argument("--udp-retry-ms", type=float, default=20)
+    ap.add_argument("--udp-retries", type=int, default=5)
+    ap.add_argument("--emu-port", type=int, default=18280)
+    ap.add_argument("--calibrate", type=float, default=2, help="seconds of idle CPU measurement")
+    ap.add_argument("--build", help="label for the table (default: git describe)")
+    ap.add_argument("--md", help="append the table to this markdown file")
+    args = ap.parse_args()
+
+    board = None
+    if args.emu:
+        from host_emu import Board
+        board = Board(args.emu_port).start()
+        if not board.wait_ready():
+            print("Emulator did not start")
+            return 1
+        host, port, kind, target = "127.0.0.1", args.emu_port, "py", "MicroPython emulator"
+    else:
+        host, kind = (args.c, "c") if args.c else (args.py, "py")
+        port = 80
+        target = f"{'C firmware' if kind == 'c' else 'MicroPython'} {host}"
+    loopback = host.startswith("127.")
+    cpu = DeviceCpu(host if kind == "c" else None, port, board)
+
+    protocols = {"http": Http("http", kind, host, port, args)}
+    if kind == "c":
+        protocols["http-mask"] = Http("http-mask", kind, host, port, args, mask=True)
+        protocols["tunnel"] = Tunnel("tunnel", args) if args.tunnel else None
+        protocols["udp-peer"] = UdpPeer("udp-peer", host, args) if args.udp else None
+
+    print(f"{target}: {args.count} toggles + reads per protocol")
+    cpu.calibrate(args.calibrate)
+    results = {}
+    for name, proto in protocols.items():
+        if proto is None:
+            flag = "--tunnel" if name == "tunnel" else "--udp"
+            results[name] = {"skipped": f"not run (add {flag})"}
+            continue
+        print(f"  {name}...")
+        results[name] = asyncio.run(run_protocol(proto, args, loopback, cpu))
+    if kind == "py":
+        for name in ("http-mask", "tunnel", "udp-peer"):
+            results[name] = {"skipped": "C firmware only"}
+    for name in NOT_IMPLEMENTED:
+        results[name] = {"skipped": "not implemented by either firmware"}
+    if board:
+        board.stop()
+
+    text = table(results, target, args.build or git_build())
+    print("\n" + text)
+    if net_counters() is None:
+        print("Wire bytes/packets need /proc/net (Linux)")
+    if args.md:
+        with open(args.md, "a") as f:
+            f.write(text + "\n")
+        print(f"Appended to {args.md}")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
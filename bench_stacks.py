@@ -0,0 +1,298 @@
+"""
+Benchmark: C firmware vs MicroPython server, same scenarios, one report
+Run: python bench_stacks.py --c 192.168.1.100 --py 192.168.1.101
+     python bench_stacks.py --c 192.168.1.100 --py-emu      (MicroPython on host_emu.py)
+     python bench_stacks.py --py-emu --count 100 --clients 1,2,4 -o bench.json
+
+Scenarios (each stack gets its own equivalent request):
+  page     main page                    C: GET /              Py: GET /
+  poll     JSON state poll              C: GET /api/relays    Py: GET /api
+  relay    relay 1 on/off, alternating  C: POST /api/relay/1  Py: GET /r?n=1&s=
+  sensor   power reading                C: GET /api/history?metric=power_dw&format=bin&max=1
+                                        Py: GET /api (DHT22 + PZEM)
+  burst    --burst polls sent at the same moment
+  concN    N clients polling back to back for --seconds (--clients levels)
+
+Sequential scenarios send --count requests one after another. Every
+request uses a fresh connection (both servers close after responding);
+refused connects and resets before any data are retried for a while, as
+a browser would, and counted.
+
+Reported per stack and scenario: requests/s, latency p50/p95/p99/max
+(connect to last byte) and failures by kind (refused after retries,
+reset, timeout, closed without response, HTTP 4xx/5xx). Memory headroom:
+C firmware - connection coroutine slots and spawn failures from /metrics
+(buffers are static; RAM use is fixed at link time); MicroPython on the
+emulator - lowest gc.mem_free() seen (heap minus the server's retained
+data); MicroPython on a board - free heap at boot from /log when still
+there.
+
+The C firmware needs the Pico SDK, so it is measured on a board only.
+Its per-IP limit (CLIENTS_RATE_RPS, CLIENTS_BURST in config.h) answers a
+fast single client with 429; that shows up as a failure mode, raise the
+limit to measure raw throughput.
+"""
+import argparse
+import asyncio
+import json
+import re
+import sys
+import threading
+import time
+import urllib.request
+
+from trace_replay import send_one, percentile
+
+def get(path):
+    return f"GET {path} HTTP/1.1\r\nHost: board\r\nConnection: close\r\n\r\n".encode()
+
+def post(path, body):
+    return (f"POST {path} HTTP/1.1\r\nHost: board\r\nContent-Type: application/json\r\n"
+            f"Content-Length: {len(body)}\r\nConnection: close\r\n\r\n{body}").encode()
+
+# Scenario -> list of requests sent in turn
+REQUESTS = {
+    "c": {
+        "page": [get("/")],
+        "poll": [get("/api/relays")],
+        "relay": [post("/api/relay/1", '{"state":1}'), post("/api/relay/1", '{"state":0}')],
+        "sensor": [get("/api/history?metric=power_dw&format=bin&max=1")],
+    },
+    "py": {
+        "page": [get("/")],
+        "poll": [get("/api")],
+        "relay": [get("/r?n=1&s=1"), get("/r?n=1&s=0")],
+        "sensor": [get("/api")],
+    },
+}
+
+class Result:
+    def __init__(self):
+        self.latency = []
+        self.failures = {}
+        self.retries = 0
+        self.elapsed = 0.0
+
+    def add(self, status, refused, error, seconds):
+        self.retries += refused
+        if error:
+            kind = error.split("(")[0]
+        elif status >= 400:
+            kind = f"http {status}"
+        else:
+            self.latency.append(seconds * 1000)
+            return
+        self.failures[kind] = self.failures.get(kind, 0) + 1
+
+    def summary(self):
+        n = len(self.latency) + sum(self.failures.values())
+        lat = self.latency or [0]
+        return {
+            "requests": n,
+            "ok": len(self.latency),
+            "rps": round(len(self.latency) / self.elapsed, 2) if self.elapsed else 0,
+            "p50_ms": round(percentile(lat, 50), 2),
+            "p95_ms": round(percentile(lat, 95), 2),
+            "p99_ms": round(percentile(lat, 99), 2),
+            "max_ms": round(max(lat), 2),
+            "retries": self.retries,
+            "failures": self.failures,
+        }
+
+class Target:
+    """One server under test"""
+
+    def __init__(self, name, kind, host, port=80, board=None):
+        self.name = name
+        self.kind = kind
+        self.host = host
+        self.port = port
+        self.board = board
+        self.mem_min = None
+        self._sampling = False
+
+    async def send(self, raw, result, args):
+        t = time.monotonic()
+        status, _, refused, error = await send_one(self.host, self.port, raw, args.timeout, args.retries)
+        result.add(status, refused, error, time.monotonic() - t)
+
+    def metrics(self):
+        """C firmware counters that describe headroom"""
+        try:
+            text = urllib.request.urlopen(f"http://{self.host}:{self.port}/metrics", timeout=5).read().decode()
+        except OSError:
+            return {}
+        keys = ("coro_slots", "coro_active", "coro_bytes_per_task", "coro_spawn_failed_total",
+                "http_rate_limited_total", "uptime_seconds")
+        return {m.group(1): float(m.group(2)) for m in re.finditer(r"^(\w+) ([\d.]+)$", text, re.M)
+                if m.group(1) in keys}
+
+    def start_sampling(self):
+        """Emulator: track the lowest gc.mem_free() while the benchmark runs"""
+        if not self.board:
+            return
+        self._sampling = True
+
+        def run():
+            from host_emu import HEAP
+            while self._sampling:
+                free = HEAP - self.board.retained_bytes()
+                self.mem_min = free if self.mem_min is None else min(self.mem_min, free)
+                time.sleep(0.05)
+
+        threading.Thread(target=run, daemon=True).start()
+
+    def stop_sampling(self):
+        self._sampling = False
+
+    def boot_heap(self):
+        try:
+            text = urllib.request.urlopen(f"http://{self.host}:{self.port}/log", timeout=5).read().decode()
+        except OSError:
+            return None
+        m = re.search(r"free heap: (\d+) B", text)
+        return int(m.group(1)) if m else None
+
+async def sequential(target, requests, count, args):
+    r = Result()
+    t = time.monotonic()
+    for i in range(count):
+        await target.send(requests[i % len(requests)], r, args)
+    r.elapsed = time.monotonic() - t
+    return r
+
+async def burst(target, raw, n, args):
+    r = Result()
+    t = time.monotonic()
+    await asyncio.gather(*(target.send(raw, r, args) for _ in range(n)))
+    r.elapsed = time.monotonic() - t
+    return r
+
+async def concurrent(target, raw, clients, seconds, args):
+    r = Result()
+    end = time.monotonic() + seconds
+
+    async def client():
+        while time.monotonic() < end:
+            await target.send(raw, r, args)
+
+    t = time.monotonic()
+    await asyncio.gather(*(client() for _ in range(clients)))
+    r.elapsed = time.monotonic() - t
+    return r
+
+async def run_target(target, args):
+    reqs = REQUESTS[target.kind]
+    out = {}
+    for name in ("page", "poll", "relay", "sensor"):
+        print(f"  {target.name}: {name}")
+        out[name] = (await sequential(target, reqs[name], args.count, args)).summary()
+        await asyncio.sleep(args.pause)
+    print(f"  {target.name}: burst")
+    out["burst"] = (await burst(target, reqs["poll"][0], args.burst, args)).summary()
+    for n in args.clients:
+        await asyncio.sleep(args.pause)
+        print(f"  {target.name}: conc{n}")
+        out[f"conc{n}"] = (await concurrent(target, reqs["poll"][0], n, args.seconds, args)).summary()
+    return out
+
+def memory_line(target, before, after):
+    if target.kind == "c":
+        if not after:
+            return "n/a (/metrics unavailable)"
+        slots = int(after.get("coro_slots", 0))
+        fails = int(after.get("coro_spawn_failed_total", 0) - before.get("coro_spawn_failed_total", 0))
+        limited = int(after.get("http_rate_limited_total", 0) - before.get("http_rate_limited_total", 0))
+        return (f"{slots} connection slots x {int(after.get('coro_bytes_per_task', 0))} B static, "
+                f"{fails} spawn failures, {limited} rate limited")
+    if target.board:
+        return f"lowest gc.mem_free() {target.mem_min} B (emulated heap)"
+    heap = target.boot_heap()
+    return f"free heap at boot {heap} B" if heap else "n/a (boot line no longer in /log)"
+
+def print_report(targets, results, memory):
+    rows = list(next(iter(results.values())).keys())
+    width = 44
+    print("\n" + " " * 9 + "".join(f"| {t.name[:width - 2]:{width - 2}s}" for t in targets))
+    print(f"{'scenario':9s}" + "".join(f"| {'req/s':>7s} {'p50':>7s} {'p95':>7s} {'p99':>7s} {'fail':>9s} "
+                                      for _ in targets))
+    for row in rows:
+        line = f"{row:9s}"
+        for t in targets:
+            s = results[t.name][row]
+            fails = sum(s["failures"].values())
+            line += (f"| {s['rps']:7.1f} {s['p50_ms']:7.1f} {s['p95_ms']:7.1f} {s['p99_ms']:7.1f} "
+                     f"{fails:4d}/{s['requests']:<4d} ")
+        print(line)
+    if len(targets) == 2:
+        a, b = targets
+        print(f"\n{a.name} vs {b.name}:")
+        for row in rows:
+            sa, sb = results[a.name][row], results[b.name][row]
+            rps = f"{sa['rps'] / sb['rps']:.1f}x req/s" if sb["rps"] else "req/s n/a"
+            p50 = f"{sb['p50_ms'] / sa['p50_ms']:.1f}x lower p50" if sa["p50_ms"] else "p50 n/a"
+            print(f"  {row:9s} {rps:>16s}  {p50:>18s}")
+    print("\nFailure modes (retries: refused or reset connects retried):")
+    for t in targets:
+        for row in rows:
+            s = results[t.name][row]
+            if s["failures"] or s["retries"]:
+                kinds = ", ".join(f"{k} x{v}" for k, v in sorted(s["failures"].items())) or "none"
+                print(f"  {t.name} {row}: {kinds}; retries {s['retries']}")
+    print("\nMemory headroom:")
+    for t in targets:
+        print(f"  {t.name}: {memory[t.name]}")
+
+def main():
+    ap = argparse.ArgumentParser(description="C firmware vs MicroPython server benchmark")
+    ap.add_argument("--c", help="C firmware board (host[:port])")
+    ap.add_argument("--py", help="MicroPython board (host[:port])")
+    ap.add_argument("--py-emu", action="store_true", help="MicroPython server on host_emu.py")
+    ap.add_argument("--emu-port", type=int, default=18180)
+    ap.add_argument("--count", type=int, default=50, help="requests per sequential scenario")
+    ap.add_argument("--burst", type=int, default=20, help="requests sent at once")
+    ap.add_argument("--clients", default="1,2,4", help="concurrency levels")
+    ap.add_argument("--seconds", type=float, default=5, help="duration of each concurrency level")
+    ap.add_argument("--pause", type=float, default=1, help="idle seconds between scenarios")
+    ap.add_argument("--timeout", type=float, default=5)
+    ap.add_argument("--retries", type=int, default=400, help="refused/reset connects retried (5 ms apart)")
+    ap.add_argument("-o", "--output", help="save results as JSON")
+    args = ap.parse_args()
+    args.clients = [int(x) for x in args.clients.split(",") if x]
+
+    targets = []
+    if args.c:
+        host, _, port = args.c.partition(":")
+        targets.append(Target(f"C {args.c}", "c", host, int(port or 80)))
+    if args.py:
+        host, _, port = args.py.partition(":")
+        targets.append(Target(f"MicroPython {args.py}", "py", host, int(port or 80)))
+    if args.py_emu:
+        from host_emu import Board
+        board = Board(args.emu_port).start()
+        if not board.wait_ready():
+            print("Emulator did not start")
+            return 1
+        targets.append(Target("MicroPython emulator", "py", "127.0.0.1", args.emu_port, board))
+    if not targets:
+        ap.error("give --c, --py and/or --py-emu")
+
+    results, memory = {}, {}
+    for t in targets:
+        before = t.metrics() if t.kind == "c" else {}
+        t.start_sampling()
+        results[t.name] = asyncio.run(run_target(t, args))
+        t.stop_sampling()
+        memory[t.name] = memory_line(t, before, t.metrics() if t.kind == "c" else {})
+        if t.board:
+            t.board.stop()
+
+    print_report(targets, results, memory)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"args": vars(args), "results": results, "memory": memory}, f, indent=1)
+        print(f"\nSaved {args.output}")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,556 @@
+/**
+ * On-device Microbenchmarks (/debug/bench)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Measures the primitives the server is built on (W5500 SPI bursts,
+ * GPIO, response rendering, number formatting, coroutine switches, flash,
+ * timer alarms) on the board itself.
+ * A suite runs in slices of BENCH_SLICE_US from the main loop, so the
+ * rest of the firmware keeps running while it is measured.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+
+#include "ethchip_conf.h"
+
+#include "config.h"
+#include "bench.h"
+#include "fmt.h"
+#include "coro.h"
+#include "relay_test.h"
+#include "zc.h"
+
+// W5500 TX buffer of the spare socket (block select in bits 3-7)
+#define BENCH_TXBUF_ADDR    ((uint32_t)WIZCHIP_TXBUF_BLOCK(BENCH_SOCKET) << 3)
+
+typedef enum {
+    BENCH_THROUGHPUT,   // op returns bytes moved
+    BENCH_LATENCY,      // op returns one latency sample in us
+    BENCH_STACK         // op returns peak stack use in bytes
+} bench_kind_t;
+
+typedef struct {
+    const char *name;
+    bench_kind_t kind;
+    void (*setup)(void);
+    uint32_t (*op)(uint32_t arg);
+    uint32_t arg;
+    uint16_t batch;     // op calls per timestamp pair
+    uint16_t max_ops;   // 0 = limited by BENCH_STEP_US only
+} bench_step_t;
+
+typedef struct {
+    const char *name;
+    const bench_step_t *steps;
+    uint8_t count;
+} bench_suite_t;
+
+static uint8_t g_bench_data[2048];
+static uint32_t g_flash_page;
+static volatile uint32_t g_sink;
+static volatile uint64_t g_alarm_fired_us;
+static uint32_t g_fmt_value;
+static char g_fmt_buf[64];
+static const char *g_op_error;     // Set by an op that cannot run; ends the step
+
+// Bottom of the core 0 stack (SDK linker script)
+extern char __StackLimit;
+
+/* ---- SPI (W5500 buffer access) ---- */
+
+static uint32_t bench_spi_write(uint32_t len) {
+    WIZCHIP_WRITE_BUF(BENCH_TXBUF_ADDR, g_bench_data, len);
+    return len;
+}
+
+static uint32_t bench_spi_read(uint32_t len) {
+    WIZCHIP_READ_BUF(BENCH_TXBUF_ADDR, g_bench_data, len);
+    return len;
+}
+
+/* ---- GPIO ---- */
+
+/**
+ * Relays an alarm may drive while ops run (self-test pulses, pending
+ * zero-cross switches); a rewrite racing it would undo its change
+ */
+static uint8_t bench_relays_in_use(void) {
+    uint8_t mask = relay_test_active_mask();
+#if ZC_ENABLE
+    mask |= zc_pending_mask();
+#endif
+    return mask;
+}
+
+static uint32_t bench_gpio_put(uint32_t arg) {
+    if (bench_relays_in_use()) {
+        g_op_error = "relays in use";
+        return 0;
+    }
+    // Rewrite the current relay outputs so nothing actually switches
+    gpio_put_masked(RELAY_GPIO_MASK, sio_hw->gpio_out);
+    return 0;
+}
+
+static uint32_t bench_gpio_get(uint32_t arg) {
+    g_sink = gpio_get_all();
+    return 0;
+}
+
+/* ---- Response rendering ---- */
+
+static uint32_t bench_relays_json(uint32_t arg) {
+    static char buf[512];
+    get_relays_json(buf, sizeof(buf));
+    return 0;
+}
+
+static uint32_t bench_metrics_text(uint32_t arg) {
+    static char buf[JSON_BUF_SIZE];
+    get_metrics_text(buf, sizeof(buf));
+    return 0;
+}
+
+/* ---- Number formatting: snprintf vs fmt ---- */
+
+// Walk the full 32-bit range so every digit count is exercised
+static uint32_t bench_fmt_next(void) {
+    g_fmt_value += 0x9E3779B9u;
+    return g_fmt_value;
+}
+
+static uint32_t bench_snprintf_u32(uint32_t arg) {
+    snprintf(g_fmt_buf, sizeof(g_fmt_buf), "%lu", (unsigned long)bench_fmt_next());
+    return 0;
+}
+
+static uint32_t bench_fmt_u32(uint32_t arg) {
+    fmt_t f;
+    fmt_init(&f, g_fmt_buf, sizeof(g_fmt_buf));
+    fmt_u32(&f, bench_fmt_next());
+    return 0;
+}
+
+static uint32_t bench_snprintf_i32(uint32_t arg) {
+    snprintf(g_fmt_buf, sizeof(g_fmt_buf), "%ld", (long)(int32_t)bench_fmt_next());
+    return 0;
+}
+
+static uint32_t bench_fmt_i32(uint32_t arg) {
+    fmt_t f;
+    fmt_init(&f, g_fmt_buf, sizeof(g_fmt_buf));
+    fmt_i32(&f, (int32_t)bench_fmt_next());
+    return 0;
+}
+
+static uint32_t bench_snprintf_ratio(uint32_t arg) {
+    uint32_t v = bench_fmt_next();
+    snprintf(g_fmt_buf, sizeof(g_fmt_buf), "%.3f", (double)(v >> 16) / ((v & 0xFFFF) | 1));
+    return 0;
+}
+
+static uint32_t bench_fmt_ratio(uint32_t arg) {
+    uint32_t v = bench_fmt_next();
+    fmt_t f;
+    fmt_init(&f, g_fmt_buf, sizeof(g_fmt_buf));
+    fmt_ratio(&f, v >> 16, (v & 0xFFFF) | 1, 3);
+    return 0;
+}
+
+static uint32_t bench_snprintf_hex(uint32_t arg) {
+    snprintf(g_fmt_buf, sizeof(g_fmt_buf), "%08lx", (unsigned long)bench_fmt_next());
+    return 0;
+}
+
+static uint32_t bench_fmt_hex(uint32_t arg) {
+    fmt_t f;
+    fmt_init(&f, g_fmt_buf, sizeof(g_fmt_buf));
+    fmt_hex(&f, bench_fmt_next(), 8);
+    return 0;
+}
+
+// snprintf does no escaping, so it does strictly less work here
+static uint32_t bench_snprintf_str(uint32_t arg) {
+    snprintf(g_fmt_buf, sizeof(g_fmt_buf), "\"%s\"", "relay1_bounce_us");
+    return 0;
+}
+
+static uint32_t bench_fmt_str(uint32_t arg) {
+    fmt_t f;
+    fmt_init(&f, g_fmt_buf, sizeof(g_fmt_buf));
+    fmt_json_str(&f, "relay1_bounce_us");
+    return 0;
+}
+
+// One line mixing every conversion the renderers use
+static void bench_line_snprintf(void) {
+    uint32_t v = bench_fmt_next();
+    snprintf(g_fmt_buf, sizeof(g_fmt_buf), "%lu %ld %.3f %08lx \"%s\"", (unsigned long)v,
+             (long)(int32_t)v, (double)(v >> 16) / ((v & 0xFFFF) | 1), (unsigned long)v, "relays");
+}
+
+static void bench_line_fmt(void) {
+    uint32_t v = bench_fmt_next();
+    fmt_t f;
+    fmt_init(&f, g_fmt_buf, sizeof(g_fmt_buf));
+    fmt_u32(&f, v);
+    fmt_char(&f, ' ');
+    fmt_i32(&f, (int32_t)v);
+    fmt_char(&f, ' ');
+    fmt_ratio(&f, v >> 16, (v & 0xFFFF) | 1, 3);
+    fmt_char(&f, ' ');
+    fmt_hex(&f, v, 8);
+    fmt_char(&f, ' ');
+    fmt_json_str(&f, "relays");
+}
+
+/**
+ * Peak stack use of fn: paint the free stack below this frame, run fn,
+ * find the deepest overwritten byte. Interrupts are off so no handler
+ * frame lands in the painted area.
+ */
+static uint32_t __attribute__((noinline)) bench_stack_probe(void (*fn)(void)) {
+    uint8_t *top = (uint8_t *)__builtin_frame_address(0) - 64;     // Slack for this frame
+    uint8_t *low = top - BENCH_STACK_PAINT;
+    uint8_t *p;
+
+    if (low < (uint8_t *)&__StackLimit) low = (uint8_t *)&__StackLimit;
+
+    uint32_t irq = save_and_disable_interrupts();
+    for (p = low; p < top; p++) *(volatile uint8_t *)p = 0xA5;
+    fn();
+    for (p = low; p < top && *(volatile uint8_t *)p == 0xA5; p++);
+    restore_interrupts(irq);
+
+    return (uint32_t)(top - p);
+}
+
+static uint32_t bench_stack_snprintf(uint32_t arg) {
+    return bench_stack_probe(bench_line_snprintf);
+}
+
+static uint32_t bench_stack_fmt(uint32_t arg) {
+    return bench_stack_probe(bench_line_fmt);
+}
+
+static uint32_t bench_line_snprintf_op(uint32_t arg) {
+    bench_line_snprintf();
+    return 0;
+}
+
+static uint32_t bench_line_fmt_op(uint32_t arg) {
+    bench_line_fmt();
+    return 0;
+}
+
+/* ---- Coroutines ---- */
+
+static uint32_t bench_coro_switch(uint32_t arg) {
+    return coro_bench_switch();
+}
+
+static uint32_t bench_coro_wake(uint32_t arg) {
+    return coro_bench_wake();
+}
+
+/* ---- Flash ---- */
+
+static void bench_flash_erase_cb(void *param) {
+    flash_range_erase(FLASH_BENCH_OFFSET, FLASH_SECTOR_SIZE);
+}
+
+static void bench_flash_program_cb(void *param) {
+    flash_range_program(FLASH_BENCH_OFFSET + g_flash_page * FLASH_PAGE_SIZE,
+                        g_bench_data, FLASH_PAGE_SIZE);
+}
+
+static uint32_t bench_flash_erase(uint32_t arg) {
+    flash_safe_execute(bench_flash_erase_cb, NULL, UINT32_MAX);
+    return 0;
+}
+
+static void bench_flash_program_setup(void) {
+    bench_flash_erase(0);
+    g_flash_page = 0;
+}
+
+static uint32_t bench_flash_program(uint32_t arg) {
+    flash_safe_execute(bench_flash_program_cb, NULL, UINT32_MAX);
+    g_flash_page++;
+    return FLASH_PAGE_SIZE;
+}
+
+/* ---- Timer ---- */
+
+static int64_t bench_alarm_cb(alarm_id_t id, void *user_data) {
+    g_alarm_fired_us = time_us_64();
+    return 0;
+}
+
+static uint32_t bench_alarm_latency(uint32_t delay_us) {
+    uint64_t target = time_us_64() + delay_us;
+
+    g_alarm_fired_us = 0;
+    if (add_alarm_at(from_us_since_boot(target), bench_alarm_cb, NULL, true) < 0) {
+        g_op_error = "no alarm slot";
+        return 0;
+    }
+    while (!g_alarm_fired_us) tight_loop_contents();
+
+    return (uint32_t)(g_alarm_fired_us - target);
+}
+
+/* ---- Suites ---- */
+
+static const bench_step_t spi_steps[] = {
+    {"w5500_write_16",   BENCH_THROUGHPUT, NULL, bench_spi_write, 16,   1, 0},
+    {"w5500_write_64",   BENCH_THROUGHPUT, NULL, bench_spi_write, 64,   1, 0},
+    {"w5500_write_256",  BENCH_THROUGHPUT, NULL, bench_spi_write, 256,  1, 0},
+    {"w5500_write_1024", BENCH_THROUGHPUT, NULL, bench_spi_write, 1024, 1, 0},
+    {"w5500_write_2048", BENCH_THROUGHPUT, NULL, bench_spi_write, 2048, 1, 0},
+    {"w5500_read_16",    BENCH_THROUGHPUT, NULL, bench_spi_read,  16,   1, 0},
+    {"w5500_read_64",    BENCH_THROUGHPUT, NULL, bench_spi_read,  64,   1, 0},
+    {"w5500_read_256",   BENCH_THROUGHPUT, NULL, bench_spi_read,  256,  1, 0},
+    {"w5500_read_1024",  BENCH_THROUGHPUT, NULL, bench_spi_read,  1024, 1, 0},
+    {"w5500_read_2048",  BENCH_THROUGHPUT, NULL, bench_spi_read,  2048, 1, 0},
+};
+
+static const bench_step_t gpio_steps[] = {
+    {"gpio_put_masked", BENCH_THROUGHPUT, NULL,             bench_gpio_put, 0, 1000, 0},
+    {"gpio_get_all",    BENCH_THROUGHPUT, NULL,             bench_gpio_get, 0, 1000, 0},
+};
+
+static const bench_step_t json_steps[] = {
+    {"relays_json",  BENCH_THROUGHPUT, NULL, bench_relays_json,  0, 10, 0},
+    {"metrics_text", BENCH_THROUGHPUT, NULL, bench_metrics_text, 0, 10, 0},
+};
+
+static const bench_step_t fmt_steps[] = {
+    {"snprintf_u32",   BENCH_THROUGHPUT, NULL, bench_snprintf_u32,     0, 100, 0},
+    {"fmt_u32",        BENCH_THROUGHPUT, NULL, bench_fmt_u32,          0, 100, 0},
+    {"snprintf_i32",   BENCH_THROUGHPUT, NULL, bench_snprintf_i32,     0, 100, 0},
+    {"fmt_i32",        BENCH_THROUGHPUT, NULL, bench_fmt_i32,          0, 100, 0},
+    {"snprintf_ratio", BENCH_THROUGHPUT, NULL, bench_snprintf_ratio,   0, 100, 0},
+    {"fmt_ratio",      BENCH_THROUGHPUT, NULL, bench_fmt_ratio,        0, 100, 0},
+    {"snprintf_hex",   BENCH_THROUGHPUT, NULL, bench_snprintf_hex,     0, 100, 0},
+    {"fmt_hex",        BENCH_THROUGHPUT, NULL, bench_fmt_hex,          0, 100, 0},
+    {"snprintf_str",   BENCH_THROUGHPUT, NULL, bench_snprintf_str,     0, 100, 0},
+    {"fmt_json_str",   BENCH_THROUGHPUT, NULL, bench_fmt_str,          0, 100, 0},
+    {"snprintf_line",  BENCH_THROUGHPUT, NULL, bench_line_snprintf_op, 0, 100, 0},
+    {"fmt_line",       BENCH_THROUGHPUT, NULL, bench_line_fmt_op,      0, 100, 0},
+    {"stack_snprintf", BENCH_STACK,      NULL, bench_stack_snprintf,   0, 1,   16},
+    {"stack_fmt",      BENCH_STACK,      NULL, bench_stack_fmt,        0, 1,   16},
+};
+
+static const bench_step_t coro_steps[] = {
+    {"coro_switch", BENCH_THROUGHPUT, NULL, bench_coro_switch, 0, 1000, 0},
+    {"coro_wake",   BENCH_THROUGHPUT, NULL, bench_coro_wake,   0, 10,   0},
+};
+
+static const bench_step_t flash_steps[] = {
+    {"flash_erase_4k",    BENCH_THROUGHPUT, NULL, bench_flash_erase, 0, 1, 4},
+    {"flash_program_256", BENCH_THROUGHPUT, bench_flash_program_setup, bench_flash_program, 0, 1,
+     FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE},
+};
+
+static const bench_step_t timer_steps[] = {
+    {"alarm_latency", BENCH_LATENCY, NULL, bench_alarm_latency, 100, 1, 200},
+};
+
+#define SUITE(name, steps) {name, steps, sizeof(steps) / sizeof(steps[0])}
+
+static const bench_suite_t suites[] = {
+    SUITE("spi",   spi_steps),
+    SUITE("gpio",  gpio_steps),
+    SUITE("json",  json_steps),
+    SUITE("fmt",   fmt_steps),
+    SUITE("coro",  coro_steps),
+    SUITE("flash", flash_steps),
+    SUITE("timer", timer_steps),
+};
+
+#define SUITE_COUNT (sizeof(suites) / sizeof(suites[0]))
+
+/* ---- Runner ---- */
+
+static struct {
+    const bench_suite_t *suite;
+    uint8_t busy;
+    uint8_t step;
+    uint32_t started_ms;
+    uint32_t step_us;   // Time spent inside ops of the current step
+    uint32_t ops;
+    uint64_t bytes;
+    uint64_t sample_sum;
+    uint32_t sample_min;
+    uint32_t sample_max;
+    fmt_t out;
+} g_bench;
+
+static char g_bench_buf[1536];
+
+static void bench_begin_step(void) {
+    const bench_step_t *s = &g_bench.suite->steps[g_bench.step];
+
+    g_bench.step_us = 0;
+    g_bench.ops = 0;
+    g_bench.bytes = 0;
+    g_bench.sample_sum = 0;
+    g_bench.sample_min = UINT32_MAX;
+    g_bench.sample_max = 0;
+    g_op_error = NULL;
+    if (s->setup) s->setup();
+}
+
+static void bench_end_step(void) {
+    const bench_step_t *s = &g_bench.suite->steps[g_bench.step];
+    fmt_t *f = &g_bench.out;
+    uint32_t ops = g_bench.ops ? g_bench.ops : 1;
+
+    fmt_sep(f);
+    fmt_str(f, "{\"name\":");
+    fmt_json_str(f, s->name);
+    fmt_key(f, "ops");
+    fmt_u32(f, g_bench.ops);
+    if (g_op_error) {
+        fmt_key(f, "error");
+        fmt_json_str(f, g_op_error);
+        fmt_char(f, '}');
+        return;
+    }
+
+    if (s->kind == BENCH_LATENCY) {
+        fmt_key(f, "min_us");
+        fmt_u32(f, g_bench.ops ? g_bench.sample_min : 0);
+        fmt_key(f, "avg_us");
+        fmt_u32(f, (uint32_t)(g_bench.sample_sum / ops));
+        fmt_key(f, "max_us");
+        fmt_u32(f, g_bench.sample_max);
+    } else if (s->kind == BENCH_STACK) {
+        fmt_key(f, "stack_bytes");
+        fmt_u32(f, g_bench.sample_max);
+    } else {
+        fmt_key(f, "ns_per_op");
+        fmt_u64(f, (uint64_t)g_bench.step_us * 1000 / ops);
+        if (g_bench.bytes) {
+            // Bytes per microsecond == MB/s
+            fmt_key(f, "mb_s");
+            fmt_ratio(f, g_bench.bytes, g_bench.step_us, 2);
+        }
+    }
+    fmt_char(f, '}');
+}
+
+static void bench_finish(int timed_out) {
+    fmt_t *f = &g_bench.out;
+
+    fmt_str(f, "],\"elapsed_ms\":");
+    fmt_u32(f, to_ms_since_boot(get_absolute_time()) - g_bench.started_ms);
+    if (timed_out) fmt_str(f, ",\"timeout\":true");
+    fmt_char(f, '}');
+    g_bench.busy = 0;
+    coro_post(CORO_EV_BENCH);
+    printf("Benchmark '%s' finished\n", g_bench.suite->name);
+}
+
+/**
+ * Look up suite by name, -1 if unknown
+ */
+int bench_suite_by_name(const char *name) {
+    for (int i = 0; i < (int)SUITE_COUNT; i++) {
+        if (strcmp(name, suites[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Start suite in the background; 0 if another run is active
+ */
+int bench_start(int suite) {
+    if (g_bench.busy || suite < 0 || suite >= (int)SUITE_COUNT) return 0;
+
+    g_bench.suite = &suites[suite];
+    g_bench.busy = 1;
+    g_bench.step = 0;
+    g_bench.started_ms = to_ms_since_boot(get_absolute_time());
+    fmt_init(&g_bench.out, g_bench_buf, sizeof(g_bench_buf));
+    fmt_str(&g_bench.out, "{\"suite\":");
+    fmt_json_str(&g_bench.out, g_bench.suite->name);
+    fmt_str(&g_bench.out, ",\"results\":[");
+
+    printf("Benchmark '%s' started\n", g_bench.suite->name);
+    bench_begin_step();
+    return 1;
+}
+
+/**
+ * Run benchmark ops for at most one slice, then yield to the main loop
+ */
+void bench_service(void) {
+    if (!g_bench.busy) return;
+
+    uint32_t slice_start = time_us_32();
+
+    while (time_us_32() - slice_start < BENCH_SLICE_US) {
+        const bench_step_t *s = &g_bench.suite->steps[g_bench.step];
+        uint32_t r = 0;
+        uint32_t bytes = 0;
+        uint32_t t0 = time_us_32();
+        uint16_t i;
+
+        for (i = 0; i < s->batch && !g_op_error; i++) {
+            r = s->op(s->arg);
+            bytes += r;
+        }
+        g_bench.step_us += time_us_32() - t0;
+        g_bench.ops += g_op_error ? i - 1 : i;
+
+        if (g_op_error) {
+            bench_end_step();
+            if (++g_bench.step >= g_bench.suite->count) {
+                bench_finish(0);
+                return;
+            }
+            bench_begin_step();
+            continue;
+        }
+
+        if (s->kind != BENCH_THROUGHPUT) {
+            g_bench.sample_sum += r;
+            if (r < g_bench.sample_min) g_bench.sample_min = r;
+            if (r > g_bench.sample_max) g_bench.sample_max = r;
+        } else {
+            g_bench.bytes += bytes;
+        }
+
+        int timed_out = to_ms_since_boot(get_absolute_time()) - g_bench.started_ms >= BENCH_MAX_MS;
+        if (g_bench.step_us >= BENCH_STEP_US || (s->max_ops && g_bench.ops >= s->max_ops) || timed_out) {
+            bench_end_step();
+            if (timed_out || ++g_bench.step >= g_bench.suite->count) {
+                bench_finish(timed_out);
+                return;
+            }
+            bench_begin_step();
+        }
+    }
+}
+
+/**
+ * Check if a suite is running
+ */
+int bench_busy(void) {
+    return g_bench.busy;
+}
+
+/**
+ * Result JSON of the last finished run
+ */
+const char *bench_result(void) {
+    return g_bench_buf;
+}
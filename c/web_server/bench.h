@@ -0,0 +1,17 @@
+/**
+ * On-device Microbenchmarks (/debug/bench)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+int bench_suite_by_name(const char *name);
+int bench_start(int suite);
+void bench_service(void);
+int bench_busy(void);
+const char *bench_result(void);
+
+#endif /* _BENCH_H_ */
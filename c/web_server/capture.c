@@ -0,0 +1,246 @@
+/**
+ * Traffic Capture (/debug/pcap)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Mirrors application-level socket payloads into a fixed RAM ring and
+ * streams them as a pcap file (LINKTYPE_RAW, synthesized IPv4/TCP
+ * headers) that Wireshark opens directly. MACRAW is not used: on the
+ * W5500 it is only available on socket 0, which serves HTTP.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "socket.h"
+
+#include "config.h"
+#include "capture.h"
+#include "fmt.h"
+
+#if CAPTURE_ENABLE
+
+#define LINKTYPE_RAW    101
+#define IP_TCP_HDR_LEN  40
+
+typedef struct {
+    uint64_t t_us;
+    uint8_t remote_ip[4];
+    uint16_t remote_port;
+    uint16_t local_port;
+    uint32_t seq;           // Sequence number of the first payload byte
+    uint32_t ack;
+    uint16_t orig_len;
+    uint16_t cap_len;
+    uint8_t dir;
+    uint8_t payload[CAPTURE_SNAPLEN_MAX];
+} capture_record_t;
+
+// Per-socket stream state for synthesized sequence numbers
+typedef struct {
+    uint8_t remote_ip[4];
+    uint16_t remote_port;
+    uint32_t seq_tx;
+    uint32_t seq_rx;
+} capture_stream_t;
+
+volatile uint8_t g_capture_enabled = 0;
+
+static capture_record_t g_records[CAPTURE_SLOTS];
+static capture_stream_t g_streams[_WIZCHIP_SOCK_NUM_];
+static capture_filter_t g_filter;
+static uint16_t g_head;         // Next slot to write
+static uint16_t g_count;        // Valid records
+static uint32_t g_captured;     // Records since start; record k is in slot k % CAPTURE_SLOTS
+static uint32_t g_starts;       // Restarts, so a running download notices a cleared ring
+static uint32_t g_filtered;
+static uint32_t g_overwritten;
+
+/**
+ * Clear ring and start capturing
+ */
+void capture_start(const capture_filter_t *filter) {
+    g_capture_enabled = 0;
+    g_filter = *filter;
+    if (g_filter.snaplen == 0 || g_filter.snaplen > CAPTURE_SNAPLEN_MAX) {
+        g_filter.snaplen = CAPTURE_SNAPLEN_MAX;
+    }
+    if (g_filter.dir_mask == 0) g_filter.dir_mask = (1u << CAPTURE_RX) | (1u << CAPTURE_TX);
+
+    memset(g_streams, 0, sizeof(g_streams));
+    g_head = g_count = 0;
+    g_captured = g_filtered = g_overwritten = 0;
+    g_starts++;
+    g_capture_enabled = 1;
+    printf("Capture started (snaplen %d)\n", g_filter.snaplen);
+}
+
+/**
+ * Stop capturing, keep recorded frames
+ */
+void capture_stop(void) {
+    g_capture_enabled = 0;
+    printf("Capture stopped (%lu records)\n", (unsigned long)g_captured);
+}
+
+/**
+ * Record payload sent or received on a TCP socket
+ */
+void capture_record_tcp(uint8_t sock, uint8_t dir, const uint8_t *data, uint16_t len) {
+    uint8_t ip[4];
+    uint16_t remote_port = getSn_DPORT(sock);
+    uint16_t local_port = getSn_PORT(sock);
+    static const uint8_t any[4] = {0, 0, 0, 0};
+
+    getSn_DIPR(sock, ip);
+
+    if (!(g_filter.dir_mask & (1u << dir)) ||
+        (memcmp(g_filter.host, any, 4) != 0 && memcmp(g_filter.host, ip, 4) != 0) ||
+        (g_filter.port && g_filter.port != local_port && g_filter.port != remote_port)) {
+        g_filtered++;
+        return;
+    }
+
+    // New peer on this socket: restart both sequence spaces
+    capture_stream_t *st = &g_streams[sock];
+    if (st->remote_port != remote_port || memcmp(st->remote_ip, ip, 4) != 0) {
+        memcpy(st->remote_ip, ip, 4);
+        st->remote_port = remote_port;
+        st->seq_tx = st->seq_rx = 1;
+    }
+
+    capture_record_t *r = &g_records[g_head];
+    r->t_us = time_us_64();
+    memcpy(r->remote_ip, ip, 4);
+    r->remote_port = remote_port;
+    r->local_port = local_port;
+    r->dir = dir;
+    r->seq = (dir == CAPTURE_TX) ? st->seq_tx : st->seq_rx;
+    r->ack = (dir == CAPTURE_TX) ? st->seq_rx : st->seq_tx;
+    r->orig_len = len;
+    r->cap_len = len < g_filter.snaplen ? len : g_filter.snaplen;
+    memcpy(r->payload, data, r->cap_len);
+
+    if (dir == CAPTURE_TX) st->seq_tx += len; else st->seq_rx += len;
+
+    g_head = (g_head + 1) % CAPTURE_SLOTS;
+    if (g_count < CAPTURE_SLOTS) g_count++; else g_overwritten++;
+    g_captured++;
+}
+
+static void put_be16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v & 0xFFFF);
+}
+
+/**
+ * Build IPv4 + TCP headers for a record
+ */
+static void capture_build_headers(const capture_record_t *r, const uint8_t *local_ip, uint8_t *h) {
+    const uint8_t *src = (r->dir == CAPTURE_TX) ? local_ip : r->remote_ip;
+    const uint8_t *dst = (r->dir == CAPTURE_TX) ? r->remote_ip : local_ip;
+    uint32_t sum = 0;
+
+    memset(h, 0, IP_TCP_HDR_LEN);
+
+    // IPv4
+    h[0] = 0x45;
+    put_be16(h + 2, IP_TCP_HDR_LEN + r->orig_len);
+    h[8] = 64;                      // TTL
+    h[9] = 6;                       // TCP
+    memcpy(h + 12, src, 4);
+    memcpy(h + 16, dst, 4);
+    for (int i = 0; i < 20; i += 2) sum += (h[i] << 8) | h[i + 1];
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    put_be16(h + 10, ~sum & 0xFFFF);
+
+    // TCP (checksum left zero; Wireshark does not verify it by default)
+    uint8_t *t = h + 20;
+    put_be16(t, (r->dir == CAPTURE_TX) ? r->local_port : r->remote_port);
+    put_be16(t + 2, (r->dir == CAPTURE_TX) ? r->remote_port : r->local_port);
+    put_be32(t + 4, r->seq);
+    put_be32(t + 8, r->ack);
+    t[12] = 5 << 4;                 // Data offset
+    t[13] = 0x18;                   // PSH, ACK
+    put_be16(t + 14, 2048);         // Window
+}
+
+/**
+ * Next records of a pcap download (body generator); capture keeps
+ * running, records overwritten before their turn are skipped
+ */
+static int capture_fill(uint8_t sock, http_body_t *b) {
+    uint8_t buf[16 + IP_TCP_HDR_LEN];
+    uint8_t local_ip[4];
+
+    if (b->arg != g_starts) return 0;
+    if (b->pos < g_captured - g_count) b->pos = g_captured - g_count;
+    getSIPR(local_ip);
+
+    for (int i = 0; i < 4 && b->pos < b->end; i++, b->pos++) {
+        const capture_record_t *r = &g_records[b->pos % CAPTURE_SLOTS];
+        uint32_t rec[4] = {
+            (uint32_t)(r->t_us / 1000000), (uint32_t)(r->t_us % 1000000),
+            IP_TCP_HDR_LEN + r->cap_len, IP_TCP_HDR_LEN + r->orig_len
+        };
+
+        memcpy(buf, rec, sizeof(rec));
+        capture_build_headers(r, local_ip, buf + 16);
+        http_write(sock, buf, sizeof(buf));
+        if (r->cap_len) http_write(sock, r->payload, r->cap_len);
+    }
+    return b->pos < b->end;
+}
+
+/**
+ * Stream the ring as a pcap file: the records present now, written as
+ * the client takes them
+ */
+void capture_stream(uint8_t sock) {
+    static const char header[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/vnd.tcpdump.pcap\r\n"
+        "Content-Disposition: attachment; filename=\"board.pcap\"\r\n"
+        "Connection: close\r\n\r\n";
+    http_body_t body = {capture_fill, g_captured - g_count, g_captured, g_starts};
+
+    http_write(sock, header, sizeof(header) - 1);
+
+    // Global header, little-endian magic, microsecond timestamps
+    uint32_t ghdr[6] = {0xA1B2C3D4, 0x00040002, 0, 0, CAPTURE_SNAPLEN_MAX + IP_TCP_HDR_LEN, LINKTYPE_RAW};
+    http_write(sock, ghdr, sizeof(ghdr));
+
+    if (g_count) http_send_body(sock, &body);
+}
+
+/**
+ * Render capture state as JSON
+ */
+void capture_status_json(char *buffer, size_t bufsize) {
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_char(&f, '{');
+    fmt_key(&f, "enabled");
+    fmt_bool(&f, g_capture_enabled);
+    fmt_key(&f, "records");
+    fmt_u32(&f, g_count);
+    fmt_key(&f, "slots");
+    fmt_u32(&f, CAPTURE_SLOTS);
+    fmt_key(&f, "snaplen");
+    fmt_u32(&f, g_filter.snaplen);
+    fmt_key(&f, "captured");
+    fmt_u32(&f, g_captured);
+    fmt_key(&f, "filtered");
+    fmt_u32(&f, g_filtered);
+    fmt_key(&f, "overwritten");
+    fmt_u32(&f, g_overwritten);
+    fmt_char(&f, '}');
+}
+
+#endif /* CAPTURE_ENABLE */
@@ -0,0 +1,41 @@
+/**
+ * Traffic Capture (/debug/pcap)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+#define CAPTURE_RX  0
+#define CAPTURE_TX  1
+
+// Capture filter; zero fields match everything
+typedef struct {
+    uint8_t host[4];        // Remote IP
+    uint16_t port;          // Local or remote port
+    uint8_t dir_mask;       // Bit per CAPTURE_RX / CAPTURE_TX
+    uint16_t snaplen;       // Payload bytes kept per record
+} capture_filter_t;
+
+#if CAPTURE_ENABLE
+extern volatile uint8_t g_capture_enabled;
+
+// Mirror socket payload; a single flag test when capture is off
+#define CAPTURE_TCP(sock, dir, data, len) \
+    do { if (g_capture_enabled) capture_record_tcp((sock), (dir), (data), (len)); } while (0)
+#else
+#define CAPTURE_TCP(sock, dir, data, len) do { } while (0)
+#endif
+
+void capture_start(const capture_filter_t *filter);
+void capture_stop(void);
+void capture_record_tcp(uint8_t sock, uint8_t dir, const uint8_t *data, uint16_t len);
+void capture_stream(uint8_t sock);
+void capture_status_json(char *buffer, size_t bufsize);
+
+#endif /* _CAPTURE_H_ */
@@ -0,0 +1,236 @@
+/**
+ * Per-Client Accounting and Admission
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Requests, bytes, errors and 304s per remote IP (Sn_DIPR of the HTTP
+ * socket) in a table of CLIENTS_MAX entries. When the table is full the
+ * entry with the fewest requests is replaced ("space-saving"): the new
+ * client inherits that count plus one, and the inherited part is kept
+ * as overcount. Any client with more than 1/CLIENTS_MAX of all requests
+ * is therefore always in the table, and its count is exact up to
+ * overcount.
+ *
+ * Each entry also holds a token bucket for the per-IP admission limit:
+ * CLIENTS_RATE_RPS requests per second with bursts of CLIENTS_BURST.
+ * A request without a token is answered 429 by the caller.
+ *
+ * Requests from the hub tunnel have no remote IP and are not tracked.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "socket.h"
+
+#include "config.h"
+#include "clients.h"
+#include "fmt.h"
+
+#define TOKEN_SCALE     1000            // Bucket holds milli-tokens
+
+typedef struct {
+    uint8_t ip[4];
+    uint8_t used;
+    uint32_t requests;          // Including overcount
+    uint32_t overcount;         // Inherited on replacement
+    uint32_t bytes_rx;
+    uint32_t bytes_tx;
+    uint32_t errors;            // 4xx/5xx responses
+    uint32_t not_modified;      // 304 responses
+    uint32_t limited;           // Refused with 429
+    uint32_t first_ms;
+    uint32_t last_ms;
+    uint32_t tokens;
+} client_t;
+
+static client_t g_clients[CLIENTS_MAX];
+static uint8_t g_sock_client[_WIZCHIP_SOCK_NUM_];     // Entry + 1 serving each socket, 0 = none
+static uint32_t g_evictions;
+static uint32_t g_limited;
+
+static inline uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * Entry for ip, replacing the least loaded one if it is not tracked
+ */
+static uint8_t clients_lookup(const uint8_t *ip, uint32_t now) {
+    uint8_t min = 0;
+
+    for (uint8_t i = 0; i < CLIENTS_MAX; i++) {
+        client_t *c = &g_clients[i];
+        if (!c->used) {
+            min = i;
+            break;
+        }
+        if (memcmp(c->ip, ip, 4) == 0) return i;
+        if (c->requests < g_clients[min].requests) min = i;
+    }
+
+    client_t *c = &g_clients[min];
+    uint32_t inherited = c->used ? c->requests : 0;
+
+    if (c->used) {
+        g_evictions++;
+        // Late bytes of the old client's connections are not charged to the new one
+        for (uint8_t s = 0; s < _WIZCHIP_SOCK_NUM_; s++) {
+            if (g_sock_client[s] == min + 1) g_sock_client[s] = 0;
+        }
+    }
+    memset(c, 0, sizeof(*c));
+    memcpy(c->ip, ip, 4);
+    c->used = 1;
+    c->requests = inherited;
+    c->overcount = inherited;
+    c->first_ms = now;
+    c->last_ms = now;
+    c->tokens = CLIENTS_BURST * TOKEN_SCALE;
+    return min;
+}
+
+/**
+ * Account a request on an HTTP socket; 0 if its client is over the
+ * per-IP rate limit and must get 429
+ */
+int clients_admit(uint8_t sock, uint16_t rx_bytes) {
+    uint8_t ip[4];
+    uint32_t now = now_ms();
+
+    if (sock >= _WIZCHIP_SOCK_NUM_) return 1;
+    getSn_DIPR(sock, ip);
+
+    uint8_t i = clients_lookup(ip, now);
+    client_t *c = &g_clients[i];
+
+    g_sock_client[sock] = i + 1;
+    c->requests++;
+    c->bytes_rx += rx_bytes;
+
+#if CLIENTS_RATE_RPS
+    uint32_t cap = CLIENTS_BURST * TOKEN_SCALE;
+    uint64_t refill = (uint64_t)(now - c->last_ms) * CLIENTS_RATE_RPS;  // ms * rps = milli-tokens
+
+    c->tokens = refill >= cap - c->tokens ? cap : c->tokens + (uint32_t)refill;
+    c->last_ms = now;
+    if (c->tokens < TOKEN_SCALE) {
+        c->limited++;
+        g_limited++;
+        return 0;
+    }
+    c->tokens -= TOKEN_SCALE;
+#else
+    c->last_ms = now;
+#endif
+    return 1;
+}
+
+static client_t *clients_of(uint8_t sock) {
+    if (sock >= _WIZCHIP_SOCK_NUM_ || !g_sock_client[sock]) return NULL;
+    return &g_clients[g_sock_client[sock] - 1];
+}
+
+/**
+ * Account the status of the response being sent on sock
+ */
+void clients_response(uint8_t sock, uint16_t status) {
+    client_t *c = clients_of(sock);
+
+    if (!c) return;
+    if (status == 304) c->not_modified++;
+    else if (status >= 400) c->errors++;
+}
+
+/**
+ * Account response bytes sent on sock
+ */
+void clients_tx(uint8_t sock, uint32_t bytes) {
+    client_t *c = clients_of(sock);
+
+    if (c) c->bytes_tx += bytes;
+}
+
+static uint32_t clients_key(const client_t *c, char by) {
+    switch (by) {
+    case 'b': return c->bytes_rx + c->bytes_tx;
+    case 'e': return c->errors;
+    default:  return c->requests;
+    }
+}
+
+/**
+ * Render tracked clients as JSON, heaviest first. by = "requests"
+ * (default), "bytes" or "errors"
+ */
+void clients_json(char *buffer, size_t bufsize, const char *by) {
+    uint8_t order[CLIENTS_MAX];
+    uint8_t n = 0;
+    char key = by && by[0] ? by[0] : 'r';
+    uint32_t now = now_ms();
+    fmt_t f;
+
+    // Insertion sort, descending
+    for (uint8_t i = 0; i < CLIENTS_MAX; i++) {
+        if (!g_clients[i].used) continue;
+        uint32_t k = clients_key(&g_clients[i], key);
+        uint8_t j = n++;
+        while (j > 0 && clients_key(&g_clients[order[j - 1]], key) < k) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_str(&f, "{\"slots\":");
+    fmt_u32(&f, CLIENTS_MAX);
+    fmt_key(&f, "evictions");
+    fmt_u32(&f, g_evictions);
+    fmt_key(&f, "rate_rps");
+    fmt_u32(&f, CLIENTS_RATE_RPS);
+    fmt_key(&f, "burst");
+    fmt_u32(&f, CLIENTS_BURST);
+    fmt_key(&f, "clients");
+    fmt_char(&f, '[');
+    for (uint8_t k = 0; k < n; k++) {
+        const client_t *c = &g_clients[order[k]];
+        uint32_t age = now - c->first_ms;
+
+        fmt_sep(&f);
+        fmt_str(&f, "{\"ip\":\"");
+        fmt_ip(&f, c->ip);
+        fmt_str(&f, "\",\"requests\":");
+        fmt_u32(&f, c->requests);
+        fmt_key(&f, "overcount");
+        fmt_u32(&f, c->overcount);
+        fmt_key(&f, "rpm");
+        fmt_ratio(&f, (uint64_t)(c->requests - c->overcount) * 60000, age < 1000 ? 1000 : age, 1);
+        fmt_key(&f, "bytes_rx");
+        fmt_u32(&f, c->bytes_rx);
+        fmt_key(&f, "bytes_tx");
+        fmt_u32(&f, c->bytes_tx);
+        fmt_key(&f, "errors");
+        fmt_u32(&f, c->errors);
+        fmt_key(&f, "not_modified");
+        fmt_u32(&f, c->not_modified);
+        fmt_key(&f, "limited");
+        fmt_u32(&f, c->limited);
+        fmt_key(&f, "last_seen_ms");
+        fmt_u32(&f, now - c->last_ms);
+        fmt_char(&f, '}');
+    }
+    fmt_str(&f, "]}");
+}
+
+/**
+ * Render table occupancy and admission counters in Prometheus text format
+ */
+void clients_metrics(fmt_t *f) {
+    uint32_t used = 0;
+
+    for (uint8_t i = 0; i < CLIENTS_MAX; i++) used += g_clients[i].used;
+    fmt_metric(f, "clients_tracked", used);
+    fmt_metric(f, "clients_evictions_total", g_evictions);
+    fmt_metric(f, "http_rate_limited_total", g_limited);
+}
@@ -0,0 +1,20 @@
+/**
+ * Per-Client Accounting and Admission
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _CLIENTS_H_
+#define _CLIENTS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fmt.h"
+
+int clients_admit(uint8_t sock, uint16_t rx_bytes);
+void clients_response(uint8_t sock, uint16_t status);
+void clients_tx(uint8_t sock, uint32_t bytes);
+void clients_json(char *buffer, size_t bufsize, const char *by);
+void clients_metrics(fmt_t *f);
+
+#endif /* _CLIENTS_H_ */
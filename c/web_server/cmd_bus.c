@@ -0,0 +1,223 @@
+/**
+ * Relay Command Bus
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Every relay change goes through here. Producers (HTTP handlers, IRQs,
+ * the other core) post set/clear masks into a lock-free MPSC queue per
+ * priority class. The main loop drains all queues in one service pass:
+ * higher classes win on conflicting bits, later commands win within a
+ * class. The result is applied with one masked GPIO write (or handed to
+ * zero-cross switching) and published as one state-change event.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+
+#include "config.h"
+#include "cmd_bus.h"
+#include "relay_test.h"
+#include "zc.h"
+#include "fmt.h"
+
+typedef struct {
+    uint8_t set;
+    uint8_t clear;
+    uint8_t source;
+    uint32_t t_us;          // Post time, for latency accounting
+} cmd_t;
+
+typedef struct {
+    atomic_uint seq;        // Slot turn (bounded MPMC ring, single consumer)
+    cmd_t cmd;
+} cmd_slot_t;
+
+typedef struct {
+    cmd_slot_t slots[CMD_BUS_DEPTH];
+    atomic_uint head;       // Next position to reserve (producers)
+    uint32_t tail;          // Next position to read (consumer)
+} cmd_queue_t;
+
+static const char *const source_names[CMD_SRC_COUNT] = {
+    "http",
+    "peer"
+};
+
+static cmd_queue_t g_queues[CMD_PRIO_COUNT];
+static cmd_event_handler_t g_handlers[CMD_BUS_MAX_HANDLERS];
+static uint8_t g_handler_count;
+static uint32_t g_version;
+static uint8_t g_blocked[CMD_SRC_COUNT];   // Bits dropped for the self-test, per source
+
+// Instrumentation
+static uint32_t g_posted[CMD_SRC_COUNT];
+static atomic_uint g_dropped;
+static uint32_t g_batches;
+static uint32_t g_changes;
+static uint32_t g_latency_max_us;
+
+/**
+ * Reset queues
+ */
+void cmd_bus_init(void) {
+    for (int p = 0; p < CMD_PRIO_COUNT; p++) {
+        cmd_queue_t *q = &g_queues[p];
+        for (uint32_t i = 0; i < CMD_BUS_DEPTH; i++) {
+            atomic_init(&q->slots[i].seq, i);
+        }
+        atomic_init(&q->head, 0);
+        q->tail = 0;
+    }
+}
+
+/**
+ * Queue relay command; safe from any context. 0 if the queue is full
+ */
+int cmd_bus_post(cmd_source_t source, cmd_prio_t prio, uint8_t set, uint8_t clear) {
+    if (prio >= CMD_PRIO_COUNT || source >= CMD_SRC_COUNT) return 0;
+
+    cmd_queue_t *q = &g_queues[prio];
+    unsigned pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    cmd_slot_t *slot;
+
+    for (;;) {
+        slot = &q->slots[pos % CMD_BUS_DEPTH];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+
+    slot->cmd.set = set;
+    slot->cmd.clear = clear;
+    slot->cmd.source = source;
+    slot->cmd.t_us = time_us_32();
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * Take next command from a queue (consumer side)
+ */
+static int cmd_queue_pop(cmd_queue_t *q, cmd_t *cmd) {
+    cmd_slot_t *slot = &q->slots[q->tail % CMD_BUS_DEPTH];
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if ((int32_t)(seq - (q->tail + 1)) < 0) return 0;
+
+    *cmd = slot->cmd;
+    atomic_store_explicit(&slot->seq, q->tail + CMD_BUS_DEPTH, memory_order_release);
+    q->tail++;
+    return 1;
+}
+
+/**
+ * Drain all queues and apply the merged result (main loop only)
+ */
+void cmd_bus_service(void) {
+    uint8_t old_mask = get_relay_mask();
+    uint8_t mask = old_mask;
+    uint8_t decided = 0;                        // Bits owned by a higher class
+    uint8_t blocked = relay_test_active_mask(); // Driven directly by the self-test
+    uint16_t sources = 0;
+    uint32_t count = 0;
+    uint32_t now = time_us_32();
+
+    for (int p = 0; p < CMD_PRIO_COUNT; p++) {
+        uint8_t touched = 0;
+        cmd_t cmd;
+
+        while (cmd_queue_pop(&g_queues[p], &cmd)) {
+            uint8_t allowed = ~(decided | blocked);
+            mask = (mask | (cmd.set & allowed)) & ~(cmd.clear & allowed);
+            touched |= (cmd.set | cmd.clear) & allowed;
+            g_blocked[cmd.source] |= (cmd.set | cmd.clear) & blocked;
+            sources |= 1u << cmd.source;
+            g_posted[cmd.source]++;
+            if (now - cmd.t_us > g_latency_max_us) g_latency_max_us = now - cmd.t_us;
+            count++;
+        }
+        decided |= touched;
+    }
+
+    if (count == 0) return;
+    g_batches++;
+    if (mask == old_mask) return;
+
+    // One write for the whole batch, only the bits that change
+    uint8_t changed = mask ^ old_mask;
+#if ZC_ENABLE
+    zc_switch(changed, mask);
+#else
+    gpio_put_masked((uint32_t)changed << RELAY_CH1, (uint32_t)mask << RELAY_CH1);
+#endif
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        g_relay_states[i] = (mask >> i) & 1;
+    }
+
+    cmd_event_t ev = {
+        .old_mask = old_mask,
+        .new_mask = mask,
+        .sources = sources,
+        .version = ++g_version,
+    };
+    g_changes++;
+
+    printf("Relays: %02X -> %02X (%lu cmds)\n", old_mask, mask, (unsigned long)count);
+    for (int i = 0; i < g_handler_count; i++) {
+        g_handlers[i](&ev);
+    }
+}
+
+/**
+ * Register state-change handler, 0 if the table is full
+ */
+int cmd_bus_subscribe(cmd_event_handler_t handler) {
+    if (g_handler_count >= CMD_BUS_MAX_HANDLERS) return 0;
+    g_handlers[g_handler_count++] = handler;
+    return 1;
+}
+
+/**
+ * Relay state version (incremented per applied change)
+ */
+uint32_t cmd_bus_version(void) {
+    return g_version;
+}
+
+/**
+ * Bits of the source's commands dropped because the self-test held the
+ * relay, since the last call
+ */
+uint8_t cmd_bus_take_blocked(cmd_source_t source) {
+    uint8_t bits = g_blocked[source];
+    g_blocked[source] = 0;
+    return bits;
+}
+
+/**
+ * Render bus statistics in Prometheus text format
+ */
+void cmd_bus_metrics(fmt_t *f) {
+    for (int i = 0; i < CMD_SRC_COUNT; i++) {
+        fmt_metric_label(f, "cmd_bus_commands_total", "source", source_names[i], g_posted[i]);
+    }
+    fmt_metric(f, "cmd_bus_dropped_total", atomic_load(&g_dropped));
+    fmt_metric(f, "cmd_bus_batches_total", g_batches);
+    fmt_metric(f, "cmd_bus_changes_total", g_changes);
+    fmt_metric(f, "cmd_bus_latency_max_us", g_latency_max_us);
+    fmt_metric(f, "relay_state_version", g_version);
+}
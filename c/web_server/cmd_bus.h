@@ -0,0 +1,47 @@
+/**
+ * Relay Command Bus
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _CMD_BUS_H_
+#define _CMD_BUS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fmt.h"
+
+// Priority classes, highest first
+typedef enum {
+    CMD_PRIO_SAFETY = 0,
+    CMD_PRIO_LOCAL,         // Local rules and timers
+    CMD_PRIO_NETWORK,       // Network protocols
+    CMD_PRIO_COUNT
+} cmd_prio_t;
+
+// Command sources (attribution)
+typedef enum {
+    CMD_SRC_HTTP = 0,
+    CMD_SRC_PEER,           // Peer link mirroring
+    CMD_SRC_COUNT
+} cmd_source_t;
+
+// State change published once per applied batch
+typedef struct {
+    uint8_t old_mask;
+    uint8_t new_mask;
+    uint16_t sources;       // Bit per cmd_source_t that contributed
+    uint32_t version;       // Incremented on every change
+} cmd_event_t;
+
+typedef void (*cmd_event_handler_t)(const cmd_event_t *ev);
+
+void cmd_bus_init(void);
+int cmd_bus_post(cmd_source_t source, cmd_prio_t prio, uint8_t set, uint8_t clear);
+void cmd_bus_service(void);
+int cmd_bus_subscribe(cmd_event_handler_t handler);
+uint32_t cmd_bus_version(void);
+uint8_t cmd_bus_take_blocked(cmd_source_t source);
+void cmd_bus_metrics(fmt_t *f);
+
+#endif /* _CMD_BUS_H_ */
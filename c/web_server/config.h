@@ -6,6 +6,7 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Network Configuration
@@ -17,8 +18,33 @@
 
 // HTTP Server Configuration
 #define HTTP_SOCKET     0
+#define HTTP_SOCKETS    3       // Parallel connections on sockets HTTP_SOCKET.. (one coroutine each)
 #define HTTP_PORT       80
 #define MAX_HTTP_BUF    2048
+#define JSON_BUF_SIZE   8192    // Shared buffer for large JSON pages
+#define HTTP_REQUEST_TIMEOUT_MS     5000    // Connected client must send its request within this
+#define HTTP_SSE_KEEPALIVE_MS       15000   // Comment line on an idle /api/events stream
+#define HTTP_SSE_MAX_EVENT          384     // Largest event written to a stream
+#define HTTP_TX_BUF     (JSON_BUF_SIZE + 512)   // Per-connection response queue (JSON page + headers)
+#define HTTP_SEND_TIMEOUT_MS        10000   // Client must take each TX chunk within this
+
+// Background Task Scheduler
+#define SCHED_MAX_TASKS             16
+#define SCHED_TICK_US               1000    // Period of the I/O services (W5500 SIR poll rate)
+#define SCHED_IDLE_MIN_US           50      // Do not sleep for less than this
+#define SCHED_ONESHOT_DEADLINE_US   10000   // One-shot task deadline after its release
+
+// CPU Accounting (/debug/cpu)
+#define CPU_WINDOW_S                60      // Longest rolling window, one slot per second
+
+// Per-Client Accounting (/debug/clients) and Admission
+#define CLIENTS_MAX                 16      // Remote IPs tracked, least loaded replaced
+#define CLIENTS_RATE_RPS            20      // Requests per second per IP, 0 = no limit
+#define CLIENTS_BURST               40      // Requests an idle IP may send at once
+
+// Connection Coroutines
+#define CORO_MAX        6       // Coroutine slots (HTTP connections + spare)
+#define CORO_FRAME_SIZE 32      // Bytes of locals per coroutine
 
 // Relay GPIO Pins (17-24)
 #define RELAY_CH1       17
@@ -31,8 +57,163 @@
 #define RELAY_CH8       24
 
 #define RELAY_COUNT     8
+#define RELAY_GPIO_MASK (((1u << RELAY_COUNT) - 1) << RELAY_CH1)
+
+// Digital Input GPIO Pins (9-16)
+#define DI_CH1          9
+#define DI_COUNT        8
+
+// Relay Command Bus
+#define CMD_BUS_DEPTH           16      // Commands per priority class (power of 2)
+#define CMD_BUS_MAX_HANDLERS    4
+
+// DI Edge Sampler (PIO)
+#define DI_SAMPLER_PIO          pio0
+#define DI_SAMPLER_SM           0
+#define DI_SAMPLER_RING         256     // Buffered edge events
+#define DI_SAMPLER_MAX_HANDLERS 6
+
+// Relay Self-test (relay contact wired to a DI channel)
+#define RELAYTEST_ON_MS         100     // Energized time per cycle
+#define RELAYTEST_OFF_MS        100     // Released time per cycle
+#define RELAYTEST_MAX_CYCLES    1000
+
+// Zero-Cross Switching (AC loads), 0 compiles it out
+#define ZC_ENABLE               0
+#define ZC_DI                   8       // DI channel with the zero-cross detector (1-8)
+#define ZC_EDGES_PER_CYCLE      2       // Detector rising edges per mains cycle
+#define ZC_DETECTOR_US          0       // Detector edge -> true zero crossing, us
+#define ZC_PHASE_DEG            0       // Contact switching phase after the zero crossing
+#define ZC_RELAYS               0xFF    // Relays switched at the zero crossing
+#define ZC_LEAD_US              300     // Minimum time between command and alarm
+#define ZC_LOCK_EDGES           8       // Consecutive good edges before switching is synchronized
+#define ZC_TIMEOUT_MS           100     // No detector edge this long: switch immediately
+#define ZC_DEFAULT_ACT_US       8000    // Until the relay self-test has measured the relay
+#define ZC_DEFAULT_REL_US       4000
+#define ZC_LOOPBACK_DI          {0, 0, 0, 0, 0, 0, 0, 0}    // Per relay: DI wired to its contact, 0 = none
+
+// History Configuration
+#define HISTORY_DEPTH           1024    // Samples kept per continuous metric
+#define HISTORY_BIN_METRICS     4       // Metrics in one binary history reply
+#define HISTORY_TEST_DEPTH      64      // Samples kept per self-test trend metric
+#define HISTORY_SAMPLE_MS       10000   // Periodic sample interval
+#define HISTORY_MAX_POINTS      60      // Max buckets per query result
+#define HISTORY_CACHE_ENTRIES   4       // Rendered query results kept (LRU)
+#define HISTORY_CACHE_BUF       2048    // Max size of one rendered result
+
+// Benchmark Configuration (/debug/bench)
+#define BENCH_SOCKET        7       // Spare socket whose TX buffer is used for SPI tests
+#define BENCH_SLICE_US      2000    // Max time per service pass before yielding
+#define BENCH_STEP_US       50000   // Measurement time per benchmark step
+#define BENCH_MAX_MS        5000    // Hard limit for a whole suite
+#define BENCH_STACK_PAINT   1024    // Bytes painted below the caller for stack probes
+
+// Traffic Capture (/debug/pcap), 0 compiles it out
+#define CAPTURE_ENABLE      1
+#define CAPTURE_SLOTS       48      // Records kept in RAM (oldest overwritten)
+#define CAPTURE_SNAPLEN_MAX 256     // Max payload bytes per record
+
+// Modbus RTU Capture (PZEM meter UART)
+#define MODBUS_UART                 uart1
+#define MODBUS_TX_PIN               40
+#define MODBUS_RX_PIN               43
+#define MODBUS_BAUD                 9600
+#define MODBUS_BYTE_RING            512     // Timestamped bytes awaiting framing
+#define MODBUS_CAPTURE_FRAMES       32      // Recent frames kept
+#define MODBUS_FRAME_STORE          64      // Bytes kept per captured frame
+#define MODBUS_MAX_SLAVES           8
+#define MODBUS_RESPONSE_TIMEOUT_MS  1000
+#define PZEM_ADDR                   0x01
+#define PZEM_POLL_MS                0       // Board polls PZEM-004T itself (active bus master), 0 = passive only
+
+// Peer Links (board-to-board relay mirroring over UDP)
+#define PEER_SOCKET         6
+#define PEER_ARP_SOCKET     4       // Resolves peer MACs, so a dead peer never holds PEER_SOCKET
+#define PEER_PORT           5006
+#define PEER_MAX            4
+#define PEER_RETRY_MS       10      // Resend unacked state change
+#define PEER_MAX_RETRIES    5
+#define PEER_HEARTBEAT_MS   100     // Heartbeat to a live peer
+#define PEER_PROBE_MS       1000    // Heartbeat to a peer whose link is down
+#define PEER_LINK_TIMEOUT_MS 500    // Silence before failsafe
+#define PEER_ARP_REFRESH_MS 60000  // Re-resolve a cached peer MAC
+#define PEER_FAILSAFE_STATE 0x00    // Forced on relays driven by a lost peer
+// SipHash key shared by all boards of one installation - change it!
+#define PEER_KEY    {0x57, 0x61, 0x76, 0x65, 0x73, 0x68, 0x61, 0x72, \
+                     0x65, 0x2D, 0x70, 0x65, 0x65, 0x72, 0x30, 0x31}
+// Peers: {ip, local DIs mirrored, local relays mirrored}; bit n drives remote relay n.
+// Both boards list each other. Example: DI1 here switches relay 1 on 192.168.1.101
+//   {{192, 168, 1, 101}, 0x01, 0x00},
+#define PEER_TABLE { \
+    {{0, 0, 0, 0}, 0x00, 0x00}, \
+}
+
+// Hub Tunnel (outbound control channel for boards behind NAT), 0 compiles it out
+#define TUNNEL_ENABLE           0
+#define TUNNEL_SOCKET           5
+#define TUNNEL_HUB_IP           {192, 168, 1, 10}
+#define TUNNEL_HUB_PORT         7000
+#define TUNNEL_HUB_NAME         "hub.local"     // TLS server name
+#define TUNNEL_TOKEN            "change-me"     // Sent in HELLO, checked by the hub
+#define TUNNEL_TLS              0               // 1 = TLS via mbedtls (pico_mbedtls)
+#define TUNNEL_CA_PEM           ""              // Hub CA certificate, required with TUNNEL_TLS
+#define TUNNEL_KEEPALIVE_MS     10000           // Ping when idle this long
+#define TUNNEL_TIMEOUT_MS       30000           // Connect/silence limit
+#define TUNNEL_BACKOFF_MIN_MS   1000
+#define TUNNEL_BACKOFF_MAX_MS   60000
+#define TUNNEL_CHUNK            1024            // Max payload per RESP frame
+#define TUNNEL_TX_QUEUE         10240           // Frames waiting for TX space (largest response)
+
+// Telemetry Store-and-Forward (tunnel uplink; queued in flash while it is down)
+#define TELEMETRY_FLASH_SECTORS 16              // 16 x 128 records of 32 bytes
+#define TELEMETRY_DRAIN_PER_S   50              // Backlog replay rate, records/s
+#define TELEMETRY_DRAIN_BURST   10
+#define TELEMETRY_DRAIN_WINDOW  32              // Unacknowledged records in flight
+#define TELEMETRY_ACK_TIMEOUT_MS 5000           // Resend from oldest after this
+#define TELEMETRY_FLUSH_MS      5000            // Partial flash page written after this
+
+// Telemetry reporting policies, applied to every point before it reaches an
+// exporter. Metrics not listed report every point.
+//   {metric, deadband, deadband_pct10, min_ms, max_ms, change_only}
+//   deadband: report when |value - last reported| > deadband (metric units)
+//   deadband_pct10: ... or > this many 0.1 % of the last reported value
+//   min_ms: report at most this often; the latest held-back value goes out when it expires
+//   max_ms: report at least this often while the source keeps sampling, 0 = no limit
+//   change_only: digital values, report only when different
+#define TELEMETRY_POLICIES { \
+    {"relays",      0,   0,     0, 300000, 1}, \
+    {"inputs",      0,   0,     0, 300000, 1}, \
+    {"voltage_dv",  20,  0,  2000,  60000, 0}, \
+    {"current_ma",  50,  20, 2000,  60000, 0}, \
+    {"power_dw",    50,  20, 2000,  60000, 0}, \
+    {"energy_wh",   10,  0, 10000, 300000, 0}, \
+    {"freq_dhz",    1,   0,  2000, 300000, 0}, \
+    {"pf_pct",      2,   0,  2000, 300000, 0}, \
+    {"temp_dc",     5,   0, 10000, 300000, 0}, \
+}
+
+// Flash Layout (reserved sectors at the end of flash)
+#define FLASH_BENCH_OFFSET  (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define TELEMETRY_FLASH_OFFSET (FLASH_BENCH_OFFSET - TELEMETRY_FLASH_SECTORS * FLASH_SECTOR_SIZE)
 
 // Global relay state array
 extern uint8_t g_relay_states[RELAY_COUNT];
 
+// Response body written piece by piece as the client takes it (main.c):
+// fill queues the next piece with http_write(), returns 0 after the last
+typedef struct http_body http_body_t;
+struct http_body {
+    int (*fill)(uint8_t sock, http_body_t *body);
+    uint32_t pos;
+    uint32_t end;
+    uint32_t arg;
+};
+
+// Shared helpers (main.c)
+uint8_t get_relay_mask(void);
+void http_write(uint8_t sock, const void *data, uint16_t len);
+void http_send_body(uint8_t sock, const http_body_t *body);
+void get_relays_json(char *buffer, size_t bufsize);
+void get_metrics_text(char *buffer, size_t bufsize);
+
 #endif /* _CONFIG_H_ */
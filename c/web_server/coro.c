@@ -0,0 +1,385 @@
+/**
+ * Stackless Coroutines for Connection Handlers
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Lets per-socket logic be written as straight-line code that awaits
+ * "readable", "writable", "connected", a timer or an event-bus bit,
+ * instead of a hand-written switch on getSn_SR(). A coroutine keeps its
+ * resume point in coro_t and its locals in a fixed-size frame from a
+ * static pool, so there is no per-task stack and no heap.
+ *
+ * The run queue is driven by the W5500 interrupt registers: one read of
+ * SIR per pass tells which watched sockets had CON / DISCON / RECV, and
+ * only their waiters are resumed. INTn is not routed to a GPIO on this
+ * board, so SIR is polled from the main loop. SENDOK and TIMEOUT are
+ * left to socket.c, which relies on them in send().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "socket.h"
+
+#include "config.h"
+#include "coro.h"
+#include "fmt.h"
+
+// Slot states
+#define CORO_FREE       0
+#define CORO_READY      1   // In the run queue
+#define CORO_PARKED     2   // Waiting for its wake-up source
+
+#define CORO_NONE       0xFF
+
+// Socket interrupts that wake waiters (cleared here)
+#define CORO_SOCK_IR    (Sn_IR_CON | Sn_IR_DISCON | Sn_IR_RECV)
+
+// Bench-only event bit
+#define CORO_EV_PING    (1u << 31)
+
+// Coroutine slots with their run queue
+typedef struct {
+    coro_t *coros;
+    uint8_t count;
+    uint8_t run_head;
+    uint8_t run_tail;
+    uint32_t posted;                // Events posted since the last pass
+} coro_sched_t;
+
+static coro_t g_coros[CORO_MAX];
+static uint8_t g_frames[CORO_MAX][CORO_FRAME_SIZE] __attribute__((aligned(8)));
+static coro_sched_t g_sched = {g_coros, CORO_MAX, CORO_NONE, CORO_NONE, 0};
+static uint8_t g_watched;           // SIMR bits
+static uint8_t g_sir_pending;       // SIR bits read outside coro_run (benchmark)
+
+// Statistics
+static uint32_t g_active;
+static uint32_t g_resumes;
+static uint32_t g_wake_sock;
+static uint32_t g_wake_event;
+static uint32_t g_wake_timer;
+static uint32_t g_wake_poll;
+static uint32_t g_sir_reads;
+static uint32_t g_resume_max_us;
+static uint32_t g_spawn_failed;
+
+static inline uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * Reset coroutine pool and run queue
+ */
+void coro_init(void) {
+    memset(g_coros, 0, sizeof(g_coros));
+    g_sched.run_head = g_sched.run_tail = CORO_NONE;
+    g_sched.posted = 0;
+    g_watched = 0;
+    g_sir_pending = 0;
+}
+
+static void coro_enqueue(coro_sched_t *s, uint8_t i) {
+    s->coros[i].state = CORO_READY;
+    s->coros[i].next = CORO_NONE;
+    if (s->run_tail == CORO_NONE) s->run_head = i;
+    else s->coros[s->run_tail].next = i;
+    s->run_tail = i;
+}
+
+static void coro_start(coro_sched_t *s, uint8_t i, coro_fn_t fn, void *frame) {
+    coro_t *co = &s->coros[i];
+
+    memset(co, 0, sizeof(*co));
+    co->fn = fn;
+    co->frame = frame;
+    co->wait_sock = CORO_NONE;
+    coro_enqueue(s, i);
+}
+
+/**
+ * Start coroutine with a zeroed frame of frame_size bytes (at most
+ * CORO_FRAME_SIZE); NULL if the pool is exhausted
+ */
+coro_t *coro_spawn(coro_fn_t fn, size_t frame_size) {
+    if (frame_size > CORO_FRAME_SIZE) {
+        printf("Coro: frame of %u bytes exceeds CORO_FRAME_SIZE\n", (unsigned)frame_size);
+        g_spawn_failed++;
+        return NULL;
+    }
+    for (uint8_t i = 0; i < CORO_MAX; i++) {
+        if (g_coros[i].state != CORO_FREE) continue;
+
+        memset(g_frames[i], 0, CORO_FRAME_SIZE);
+        coro_start(&g_sched, i, fn, g_frames[i]);
+        g_active++;
+        return &g_coros[i];
+    }
+    g_spawn_failed++;
+    return NULL;
+}
+
+/**
+ * Enable W5500 socket interrupts that wake waiters on sock
+ */
+void coro_watch(uint8_t sock) {
+    g_watched |= 1u << sock;
+    setSn_IMR(sock, CORO_SOCK_IR);
+    setSIMR(g_watched);
+}
+
+/**
+ * Post event bits; waiters run on the next pass (main loop context)
+ */
+void coro_post(uint32_t events) {
+    g_sched.posted |= events;
+}
+
+/**
+ * Socket interrupts pending on watched sockets; clears the ones we own
+ */
+static uint8_t coro_poll_w5500(void) {
+    uint8_t sir;
+
+    if (!g_watched) return 0;
+    sir = getSIR() & g_watched;
+    g_sir_reads++;
+
+    for (uint8_t sock = 0; sock < 8; sock++) {
+        if (!(sir & (1u << sock))) continue;
+        uint8_t ir = getSn_IR(sock) & CORO_SOCK_IR;
+        if (ir) setSn_IR(sock, ir);
+    }
+    return sir;
+}
+
+static void coro_resume(coro_sched_t *s, uint8_t i) {
+    coro_t *co = &s->coros[i];
+    uint32_t t0 = time_us_32();
+
+    // The await being resumed registers its wake-up sources again
+    co->wait_sock = CORO_NONE;
+    co->wait_events = 0;
+    co->poll = 0;
+    g_resumes++;
+
+    int done = co->fn(co) == CORO_DONE;
+
+    uint32_t dt = time_us_32() - t0;
+    if (dt > g_resume_max_us) g_resume_max_us = dt;
+
+    if (done) {
+        co->state = CORO_FREE;
+        g_active--;
+    } else {
+        co->state = CORO_PARKED;
+    }
+}
+
+/**
+ * Wake waiters of s whose source fired, then run its queue once
+ */
+static int coro_pass(coro_sched_t *s, uint8_t sir) {
+    uint32_t posted = s->posted;
+    uint32_t now = now_ms();
+    int resumed = 0;
+
+    s->posted = 0;
+
+    for (uint8_t i = 0; i < s->count; i++) {
+        coro_t *co = &s->coros[i];
+        if (co->state == CORO_FREE) continue;
+        co->events |= posted;
+        if (co->state != CORO_PARKED) continue;
+
+        if (co->wait_sock != CORO_NONE && (sir & (1u << co->wait_sock))) {
+            g_wake_sock++;
+        } else if (co->events & co->wait_events) {
+            g_wake_event++;
+        } else if (co->timer && (int32_t)(now - co->deadline_ms) >= 0) {
+            g_wake_timer++;
+        } else if (co->poll) {
+            g_wake_poll++;
+        } else {
+            continue;
+        }
+        coro_enqueue(s, i);
+    }
+
+    // Only what is queued now; anything woken meanwhile runs next pass
+    uint8_t tail = s->run_tail;
+    while (s->run_head != CORO_NONE) {
+        uint8_t i = s->run_head;
+        s->run_head = s->coros[i].next;
+        if (s->run_head == CORO_NONE) s->run_tail = CORO_NONE;
+        coro_resume(s, i);
+        resumed++;
+        if (i == tail) break;
+    }
+    return resumed;
+}
+
+/**
+ * One scheduler pass: wake waiters whose source fired, then run the
+ * queue once. Returns the number of coroutines resumed
+ */
+int coro_run(void) {
+    uint8_t sir = coro_poll_w5500() | g_sir_pending;
+
+    g_sir_pending = 0;
+    return coro_pass(&g_sched, sir);
+}
+
+/**
+ * Arm the deadline on the first check of an await; 1 once it has passed
+ */
+static int coro_deadline(coro_t *co, uint32_t timeout_ms) {
+    uint32_t now = now_ms();
+
+    if (!co->armed) {
+        co->armed = 1;
+        co->timed_out = 0;
+        co->timer = timeout_ms != 0;
+        co->deadline_ms = now + timeout_ms;
+    }
+    if (co->timer && (int32_t)(now - co->deadline_ms) >= 0) {
+        co->timed_out = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Data to read, or the connection is no longer established
+ */
+int coro_readable(coro_t *co, uint8_t sock, uint32_t timeout_ms) {
+    int expired = coro_deadline(co, timeout_ms);
+
+    if (getSn_RX_RSR(sock) > 0 || getSn_SR(sock) != SOCK_ESTABLISHED) {
+        co->timed_out = 0;
+        return 1;
+    }
+    if (expired) return 1;
+    co->wait_sock = sock;
+    return 0;
+}
+
+/**
+ * Room for len bytes in the TX buffer, or the connection is gone.
+ * The W5500 has no interrupt for TX space, so this is polled
+ */
+int coro_writable(coro_t *co, uint8_t sock, uint16_t len, uint32_t timeout_ms) {
+    int expired = coro_deadline(co, timeout_ms);
+
+    if (getSn_TX_FSR(sock) >= len || getSn_SR(sock) != SOCK_ESTABLISHED) {
+        co->timed_out = 0;
+        return 1;
+    }
+    if (expired) return 1;
+    co->poll = 1;
+    return 0;
+}
+
+/**
+ * Listening socket got a connection (or left LISTEN for any reason)
+ */
+int coro_connected(coro_t *co, uint8_t sock, uint32_t timeout_ms) {
+    int expired = coro_deadline(co, timeout_ms);
+
+    if (getSn_SR(sock) != SOCK_LISTEN) {
+        co->timed_out = 0;
+        return 1;
+    }
+    if (expired) return 1;
+    co->wait_sock = sock;
+    return 0;
+}
+
+/**
+ * Event bit in mask was posted; consumes it. With sock != 0xFF also
+ * returns when the connection is no longer established
+ */
+int coro_event(coro_t *co, uint32_t mask, uint8_t sock, uint32_t timeout_ms) {
+    int expired = coro_deadline(co, timeout_ms);
+
+    if (co->events & mask) {
+        co->events &= ~mask;
+        co->timed_out = 0;
+        return 1;
+    }
+    if (sock != CORO_NONE) {
+        if (getSn_SR(sock) != SOCK_ESTABLISHED) {
+            co->timed_out = 0;
+            return 1;
+        }
+        co->wait_sock = sock;
+    }
+    if (expired) return 1;
+    co->wait_events = mask;
+    return 0;
+}
+
+/**
+ * Plain delay
+ */
+int coro_timer(coro_t *co, uint32_t timeout_ms) {
+    return coro_deadline(co, timeout_ms);
+}
+
+/* ---- Benchmarks (/debug/bench?suite=coro) ---- */
+
+static int coro_bench_yield_fn(coro_t *co) {
+    CORO_BEGIN(co);
+    for (;;) CORO_YIELD(co);
+    CORO_END(co);
+}
+
+static int coro_bench_ping_fn(coro_t *co) {
+    CORO_BEGIN(co);
+    for (;;) CORO_AWAIT_EVENT(co, CORO_EV_PING, CORO_NONE, 0);
+    CORO_END(co);
+}
+
+/**
+ * One suspend/resume round trip, outside the scheduler
+ */
+uint32_t coro_bench_switch(void) {
+    static coro_t co = {.fn = coro_bench_yield_fn, .wait_sock = CORO_NONE};
+
+    co.fn(&co);
+    return 0;
+}
+
+/**
+ * Post an event and run a full scheduler pass (SIR read included) that
+ * wakes one waiter. The waiter lives on a private one-slot queue, so it
+ * takes no CORO_MAX slot and connection coroutines are not resumed from
+ * inside the benchmark; SIR bits it reads are handed to the next coro_run()
+ */
+uint32_t coro_bench_wake(void) {
+    static coro_t co;
+    static coro_sched_t sched = {&co, 1, CORO_NONE, CORO_NONE, 0};
+
+    if (co.state == CORO_FREE) coro_start(&sched, 0, coro_bench_ping_fn, NULL);
+    sched.posted |= CORO_EV_PING;
+    g_sir_pending |= coro_poll_w5500();
+    coro_pass(&sched, 0);
+    return 0;
+}
+
+/**
+ * Render scheduler statistics in Prometheus text format
+ */
+void coro_metrics(fmt_t *f) {
+    fmt_metric(f, "coro_slots", CORO_MAX);
+    fmt_metric(f, "coro_active", g_active);
+    fmt_metric(f, "coro_bytes_per_task", sizeof(coro_t) + CORO_FRAME_SIZE);
+    fmt_metric(f, "coro_resumes_total", g_resumes);
+    fmt_metric_label(f, "coro_wakeups_total", "source", "socket", g_wake_sock);
+    fmt_metric_label(f, "coro_wakeups_total", "source", "event", g_wake_event);
+    fmt_metric_label(f, "coro_wakeups_total", "source", "timer", g_wake_timer);
+    fmt_metric_label(f, "coro_wakeups_total", "source", "poll", g_wake_poll);
+    fmt_metric(f, "coro_w5500_sir_reads_total", g_sir_reads);
+    fmt_metric(f, "coro_resume_max_us", g_resume_max_us);
+    fmt_metric(f, "coro_spawn_failed_total", g_spawn_failed);
+}
@@ -0,0 +1,89 @@
+/**
+ * Stackless Coroutines for Connection Handlers
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _CORO_H_
+#define _CORO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "fmt.h"
+
+// Return values of a coroutine function
+#define CORO_WAITING    0
+#define CORO_DONE       1
+
+// Event bus bits (coro_post)
+#define CORO_EV_RELAYS  (1u << 0)   // Relay state changed
+#define CORO_EV_BENCH   (1u << 1)   // Benchmark suite finished
+
+typedef struct coro coro_t;
+typedef int (*coro_fn_t)(coro_t *co);
+
+struct coro {
+    coro_fn_t fn;
+    void *frame;            // Locals that survive a suspension (static pool)
+    uint16_t lc;            // Resume point (source line)
+    uint8_t state;
+    uint8_t armed;          // Current await has set its deadline
+    uint8_t timer;          // Current await has a deadline at all
+    uint8_t timed_out;      // Last await ended by its deadline
+    uint8_t wait_sock;      // Socket whose interrupt wakes us, 0xFF = none
+    uint8_t poll;           // Re-check every pass (no interrupt source)
+    uint8_t next;           // Run queue link
+    uint32_t wait_events;   // Event bits that wake us
+    uint32_t events;        // Posted event bits not yet consumed (latched)
+    uint32_t deadline_ms;
+};
+
+/*
+ * Locals do not survive a suspension: keep them in co->frame.
+ * Await macros may not be used inside a switch of the coroutine body,
+ * and at most one may appear per source line (resume points are __LINE__).
+ * Events are latched until awaited, so re-check the real condition
+ * after CORO_AWAIT_EVENT.
+ */
+#define CORO_BEGIN(co)      switch ((co)->lc) { case 0:
+#define CORO_END(co)        } (co)->lc = 0; return CORO_DONE
+
+#define CORO_AWAIT(co, ready)                                   \
+    do {                                                        \
+        (co)->armed = 0;                                        \
+        (co)->lc = __LINE__; case __LINE__:                     \
+        if (!(ready)) return CORO_WAITING;                      \
+    } while (0)
+
+#define CORO_YIELD(co)                                          \
+    do {                                                        \
+        (co)->poll = 1;                                         \
+        (co)->timer = 0;                                        \
+        (co)->lc = __LINE__; return CORO_WAITING; case __LINE__:;   \
+    } while (0)
+
+// Awaitables; timeout_ms 0 waits forever, co->timed_out tells which ended it
+#define CORO_AWAIT_READABLE(co, sock, ms)   CORO_AWAIT(co, coro_readable(co, sock, ms))
+#define CORO_AWAIT_WRITABLE(co, sock, n, ms) CORO_AWAIT(co, coro_writable(co, sock, n, ms))
+#define CORO_AWAIT_CONNECT(co, sock, ms)    CORO_AWAIT(co, coro_connected(co, sock, ms))
+#define CORO_AWAIT_EVENT(co, mask, sock, ms) CORO_AWAIT(co, coro_event(co, mask, sock, ms))
+#define CORO_SLEEP(co, ms)                  CORO_AWAIT(co, coro_timer(co, ms))
+
+void coro_init(void);
+coro_t *coro_spawn(coro_fn_t fn, size_t frame_size);
+void coro_watch(uint8_t sock);
+void coro_post(uint32_t events);
+int coro_run(void);
+
+int coro_readable(coro_t *co, uint8_t sock, uint32_t timeout_ms);
+int coro_writable(coro_t *co, uint8_t sock, uint16_t len, uint32_t timeout_ms);
+int coro_connected(coro_t *co, uint8_t sock, uint32_t timeout_ms);
+int coro_event(coro_t *co, uint32_t mask, uint8_t sock, uint32_t timeout_ms);
+int coro_timer(coro_t *co, uint32_t timeout_ms);
+
+uint32_t coro_bench_switch(void);
+uint32_t coro_bench_wake(void);
+void coro_metrics(fmt_t *f);
+
+#endif /* _CORO_H_ */
@@ -0,0 +1,233 @@
+/**
+ * Per-subsystem CPU Accounting
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Each core's DWT cycle counter is read whenever the code switches
+ * subsystem (scheduler task, HTTP handler, W5500 chip select, flash
+ * operation, interrupt handler). The cycles since the previous switch
+ * are charged to the subsystem that was running. A switch costs one
+ * counter read and a 64-bit add with interrupts briefly masked, so it
+ * stays on in production.
+ *
+ * Once a second the totals are turned into a per-second slot of a
+ * CPU_WINDOW_S ring. Utilization over 1 s, 10 s and CPU_WINDOW_S comes
+ * from summing the newest slots.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/m33.h"
+
+#include "ethchip_conf.h"
+
+#include "config.h"
+#include "cpu.h"
+#include "fmt.h"
+
+#define CPU_CORES   2
+
+typedef struct {
+    uint64_t cycles[CPU_SUBSYS_COUNT];          // Since boot
+    uint64_t snap[CPU_SUBSYS_COUNT];            // Totals at the last tick
+    uint32_t window[CPU_WINDOW_S][CPU_SUBSYS_COUNT];
+    uint32_t last;                              // Counter at the last switch
+    uint8_t current;
+    uint8_t active;                             // Core has called cpu_init()
+} cpu_core_t;
+
+static cpu_core_t g_cores[CPU_CORES];
+static uint16_t g_head;             // Next window slot
+static uint16_t g_filled;           // Slots holding a full second
+
+static const char *const g_names[CPU_SUBSYS_COUNT] = {
+    "other", "idle", "net", "http", "spi", "sensor", "flash", "irq"
+};
+
+static const uint16_t g_windows[] = {1, 10, CPU_WINDOW_S};
+#define CPU_WINDOWS (sizeof(g_windows) / sizeof(g_windows[0]))
+
+// Original W5500 chip select callbacks
+static void (*g_cs_select)(void);
+static void (*g_cs_deselect)(void);
+static uint8_t g_spi_prev;
+
+/**
+ * Switch the calling core to subsys; returns the subsystem to restore
+ */
+uint8_t cpu_enter(uint8_t subsys) {
+    uint32_t irq = save_and_disable_interrupts();
+    cpu_core_t *c = &g_cores[get_core_num()];
+    uint32_t now = m33_hw->dwt_cyccnt;
+    uint8_t prev = c->current;
+
+    c->cycles[prev] += now - c->last;
+    c->last = now;
+    c->current = subsys;
+    restore_interrupts(irq);
+    return prev;
+}
+
+/**
+ * Return to the subsystem cpu_enter() replaced
+ */
+void cpu_leave(uint8_t prev) {
+    cpu_enter(prev);
+}
+
+static void cpu_cs_select(void) {
+    g_spi_prev = cpu_enter(CPU_SPI);
+    g_cs_select();
+}
+
+static void cpu_cs_deselect(void) {
+    g_cs_deselect();
+    cpu_leave(g_spi_prev);
+}
+
+/**
+ * Start the cycle counter on the calling core. On core 0 also hooks the
+ * W5500 chip select, so it must run after the Ethernet init
+ */
+void cpu_init(void) {
+    cpu_core_t *c = &g_cores[get_core_num()];
+
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+
+    c->last = m33_hw->dwt_cyccnt;
+    c->current = CPU_OTHER;
+    c->active = 1;
+
+    if (get_core_num() == 0 && WIZCHIP.CS._select != cpu_cs_select) {
+        g_cs_select = WIZCHIP.CS._select;
+        g_cs_deselect = WIZCHIP.CS._deselect;
+        reg_wizchip_cs_cbfunc(cpu_cs_select, cpu_cs_deselect);
+    }
+}
+
+/**
+ * Close the current one-second slot (scheduler task, core 0)
+ */
+void cpu_tick(void) {
+    // Charge the running subsystem up to now
+    cpu_leave(cpu_enter(CPU_OTHER));
+
+    for (int core = 0; core < CPU_CORES; core++) {
+        cpu_core_t *c = &g_cores[core];
+        if (!c->active) continue;
+        for (int s = 0; s < CPU_SUBSYS_COUNT; s++) {
+            uint64_t total = c->cycles[s];
+            c->window[g_head][s] = (uint32_t)(total - c->snap[s]);
+            c->snap[s] = total;
+        }
+    }
+    g_head = (g_head + 1) % CPU_WINDOW_S;
+    if (g_filled < CPU_WINDOW_S) g_filled++;
+}
+
+/**
+ * Cycles per subsystem over the newest n slots; returns the total
+ */
+static uint64_t cpu_window_sum(const cpu_core_t *c, uint16_t n, uint64_t *sum) {
+    uint64_t total = 0;
+
+    memset(sum, 0, CPU_SUBSYS_COUNT * sizeof(sum[0]));
+    if (n > g_filled) n = g_filled;
+    for (uint16_t k = 1; k <= n; k++) {
+        const uint32_t *slot = c->window[(g_head + CPU_WINDOW_S - k) % CPU_WINDOW_S];
+        for (int s = 0; s < CPU_SUBSYS_COUNT; s++) {
+            sum[s] += slot[s];
+            total += slot[s];
+        }
+    }
+    return total;
+}
+
+/**
+ * Render per-core, per-subsystem utilization over the rolling windows as JSON
+ */
+void cpu_json(char *buffer, size_t bufsize) {
+    uint64_t sums[CPU_WINDOWS][CPU_SUBSYS_COUNT];
+    uint64_t totals[CPU_WINDOWS];
+    uint32_t hz = clock_get_hz(clk_sys);
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_str(&f, "{\"hz\":");
+    fmt_u32(&f, hz);
+    fmt_key(&f, "window_s");
+    fmt_char(&f, '[');
+    for (size_t w = 0; w < CPU_WINDOWS; w++) {
+        fmt_sep(&f);
+        fmt_u32(&f, g_windows[w] < g_filled ? g_windows[w] : g_filled);
+    }
+    fmt_str(&f, "],\"cores\":[");
+
+    for (int core = 0; core < CPU_CORES; core++) {
+        const cpu_core_t *c = &g_cores[core];
+        if (!c->active) continue;
+
+        for (size_t w = 0; w < CPU_WINDOWS; w++) totals[w] = cpu_window_sum(c, g_windows[w], sums[w]);
+
+        fmt_sep(&f);
+        fmt_str(&f, "{\"core\":");
+        fmt_u32(&f, core);
+        fmt_key(&f, "busy_pct");
+        fmt_char(&f, '[');
+        for (size_t w = 0; w < CPU_WINDOWS; w++) {
+            fmt_sep(&f);
+            fmt_ratio(&f, (totals[w] - sums[w][CPU_IDLE]) * 100, totals[w], 1);
+        }
+        fmt_str(&f, "],\"subsystems\":[");
+        for (int s = 0; s < CPU_SUBSYS_COUNT; s++) {
+            fmt_sep(&f);
+            fmt_str(&f, "{\"name\":");
+            fmt_json_str(&f, g_names[s]);
+            fmt_key(&f, "pct");
+            fmt_char(&f, '[');
+            for (size_t w = 0; w < CPU_WINDOWS; w++) {
+                fmt_sep(&f);
+                fmt_ratio(&f, sums[w][s] * 100, totals[w], 1);
+            }
+            fmt_char(&f, ']');
+            fmt_key(&f, "seconds");
+            fmt_ratio(&f, c->cycles[s], hz, 3);
+            fmt_char(&f, '}');
+        }
+        fmt_str(&f, "]}");
+    }
+    fmt_str(&f, "]}");
+}
+
+/**
+ * Render CPU time counters and 10 s utilization in Prometheus text format
+ */
+void cpu_metrics(fmt_t *f) {
+    uint64_t sum[CPU_SUBSYS_COUNT];
+    uint32_t hz = clock_get_hz(clk_sys);
+
+    for (int core = 0; core < CPU_CORES; core++) {
+        const cpu_core_t *c = &g_cores[core];
+        if (!c->active) continue;
+
+        for (int s = 0; s < CPU_SUBSYS_COUNT; s++) {
+            fmt_str(f, "cpu_seconds_total{core=\"");
+            fmt_u32(f, core);
+            fmt_str(f, "\",subsystem=\"");
+            fmt_str(f, g_names[s]);
+            fmt_str(f, "\"} ");
+            fmt_ratio(f, c->cycles[s], hz, 3);
+            fmt_char(f, '\n');
+        }
+
+        uint64_t total = cpu_window_sum(c, 10, sum);
+        fmt_str(f, "cpu_busy_ratio{core=\"");
+        fmt_u32(f, core);
+        fmt_str(f, "\",window=\"10s\"} ");
+        fmt_ratio(f, total - sum[CPU_IDLE], total, 3);
+        fmt_char(f, '\n');
+    }
+}
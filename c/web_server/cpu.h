@@ -0,0 +1,35 @@
+/**
+ * Per-subsystem CPU Accounting
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "fmt.h"
+
+// Subsystems cycles are charged to
+typedef enum {
+    CPU_OTHER,          // Main loop glue, command bus, telemetry logic, bench
+    CPU_IDLE,           // WFE in the scheduler
+    CPU_NET,            // Connection coroutines, peers, tunnel
+    CPU_HTTP,           // Request parsing and response rendering
+    CPU_SPI,            // W5500 transfers (chip select held)
+    CPU_SENSOR,         // DI sampler, Modbus/PZEM, relay self-test
+    CPU_FLASH,          // Flash erase/program
+    CPU_IRQ,            // Our interrupt handlers and alarm callbacks
+    CPU_SUBSYS_COUNT
+} cpu_subsys_t;
+
+void cpu_init(void);
+uint8_t cpu_enter(uint8_t subsys);
+void cpu_leave(uint8_t prev);
+void cpu_tick(void);
+void cpu_json(char *buffer, size_t bufsize);
+void cpu_metrics(fmt_t *f);
+
+#endif /* _CPU_H_ */
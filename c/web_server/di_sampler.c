@@ -0,0 +1,168 @@
+/**
+ * Digital Input Edge Sampler (PIO)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * A PIO state machine watches DI1-DI8 and timestamps every change with
+ * 1 us resolution (see di_sampler.pio). The RX FIFO interrupt moves
+ * events into a RAM ring; di_sampler_service() hands them to the
+ * subscribed handlers from the main loop.
+ *
+ * A channel can be claimed by one handler (zero-cross detector): its
+ * edges go only to that handler and the bit is hidden from everyone
+ * else, so a 100 Hz signal doesn't flood history and telemetry.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+
+#include "config.h"
+#include "di_sampler.h"
+#include "cpu.h"
+#include "di_sampler.pio.h"
+
+#define DI_PINS_TAG     0x80000000u     // Set in pin words, clear in timestamp words
+
+typedef struct {
+    uint32_t t_us;
+    uint8_t pins;
+} di_edge_t;
+
+static di_edge_t g_ring[DI_SAMPLER_RING];
+static volatile uint16_t g_ring_head;   // Written by IRQ
+static volatile uint16_t g_ring_tail;   // Read by main loop
+static volatile uint32_t g_overflows;
+static int16_t g_pending_pins = -1;     // Pin word waiting for its timestamp (IRQ only)
+
+static di_edge_handler_t g_handlers[DI_SAMPLER_MAX_HANDLERS];
+static uint8_t g_handler_count;
+static uint8_t g_claimed;               // Channels delivered only to g_claim_handler
+static di_edge_handler_t g_claim_handler;
+
+static uint32_t g_t0_us;                // time_us_32() when the counter started
+static uint8_t g_state;                 // Last delivered pin state
+
+/**
+ * Move edge events from the PIO FIFO into the ring
+ *
+ * Words come in (pins, timestamp) pairs, but the PIO drops words while
+ * the FIFO is full (RXSTALL). Each stall counts as an overflow and the
+ * tags re-pair the stream: a timestamp without a pin word before it, or
+ * a pin word followed by another pin word, is discarded.
+ */
+static void di_sampler_irq(void) {
+    PIO pio = DI_SAMPLER_PIO;
+    uint32_t stall = 1u << (PIO_FDEBUG_RXSTALL_LSB + DI_SAMPLER_SM);
+    uint8_t prev = cpu_enter(CPU_IRQ);
+
+    if (pio->fdebug & stall) {
+        pio->fdebug = stall;            // Write 1 to clear
+        g_overflows++;
+    }
+
+    while (!pio_sm_is_rx_fifo_empty(pio, DI_SAMPLER_SM)) {
+        uint32_t word = pio_sm_get(pio, DI_SAMPLER_SM);
+
+        if (word & DI_PINS_TAG) {
+            g_pending_pins = word & 0xFF;       // Replaces one whose timestamp was lost
+            continue;
+        }
+        if (g_pending_pins < 0) continue;       // Its pin word was lost
+
+        uint8_t pins = (uint8_t)g_pending_pins;
+        uint16_t next = (g_ring_head + 1) % DI_SAMPLER_RING;
+
+        g_pending_pins = -1;
+        if (next == g_ring_tail) {
+            g_overflows++;
+            continue;
+        }
+        // Counter runs down from 0xFFFFFFFF, one tick per microsecond; only
+        // its low 31 bits arrive, so take the time closest to now
+        uint32_t now = time_us_32();
+        uint32_t t = g_t0_us + (~word & ~DI_PINS_TAG);
+        int32_t age = (int32_t)((now - t) << 1) >> 1;
+
+        g_ring[g_ring_head].t_us = now - age;
+        g_ring[g_ring_head].pins = pins;
+        g_ring_head = next;
+    }
+    cpu_leave(prev);
+}
+
+/**
+ * Load PIO program and start sampling DI1-DI8
+ */
+void di_sampler_init(void) {
+    PIO pio = DI_SAMPLER_PIO;
+    uint offset = pio_add_program(pio, &di_sampler_program);
+    float clkdiv = (float)clock_get_hz(clk_sys) / 8000000.0f;
+
+    di_sampler_program_init(pio, DI_SAMPLER_SM, offset, DI_CH1, clkdiv);
+
+    irq_set_exclusive_handler(pio_get_irq_num(pio, 0), di_sampler_irq);
+    pio_set_irqn_source_enabled(pio, 0, pio_get_rx_fifo_not_empty_interrupt_source(DI_SAMPLER_SM), true);
+    irq_set_enabled(pio_get_irq_num(pio, 0), true);
+
+    g_state = (gpio_get_all() >> DI_CH1) & 0xFF;
+    g_t0_us = time_us_32();
+    pio->fdebug = 1u << (PIO_FDEBUG_RXSTALL_LSB + DI_SAMPLER_SM);
+    pio_sm_set_enabled(pio, DI_SAMPLER_SM, true);
+
+    printf("DI sampler started (PIO, 1 us resolution)\n");
+}
+
+/**
+ * Register edge handler, 0 if the table is full
+ */
+int di_sampler_subscribe(di_edge_handler_t handler) {
+    if (g_handler_count >= DI_SAMPLER_MAX_HANDLERS) return 0;
+    g_handlers[g_handler_count++] = handler;
+    return 1;
+}
+
+/**
+ * Route channels in mask exclusively to handler
+ */
+void di_sampler_claim(uint8_t mask, di_edge_handler_t handler) {
+    g_claim_handler = handler;
+    g_claimed = mask;
+}
+
+/**
+ * Deliver buffered edges to subscribers
+ */
+void di_sampler_service(void) {
+    while (g_ring_tail != g_ring_head) {
+        di_edge_t e = g_ring[g_ring_tail];
+        g_ring_tail = (g_ring_tail + 1) % DI_SAMPLER_RING;
+
+        uint8_t changed = e.pins ^ g_state;
+        if (!changed) continue;
+        g_state = e.pins;
+
+        if (changed & g_claimed) g_claim_handler(e.t_us, e.pins & g_claimed, changed & g_claimed);
+        changed &= ~g_claimed;
+        if (!changed) continue;
+
+        for (int i = 0; i < g_handler_count; i++) {
+            g_handlers[i](e.t_us, e.pins & ~g_claimed, changed);
+        }
+    }
+}
+
+/**
+ * Last delivered DI state (bit 0 = DI1), claimed channels read 0
+ */
+uint8_t di_sampler_state(void) {
+    return g_state & ~g_claimed;
+}
+
+/**
+ * Edge events lost because the ring or the PIO FIFO was full
+ */
+uint32_t di_sampler_overflows(void) {
+    return g_overflows;
+}
@@ -0,0 +1,21 @@
+/**
+ * Digital Input Edge Sampler (PIO)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _DI_SAMPLER_H_
+#define _DI_SAMPLER_H_
+
+#include <stdint.h>
+
+// Edge handler: timestamp (time_us_32 base), new pin state, changed bits
+typedef void (*di_edge_handler_t)(uint32_t t_us, uint8_t pins, uint8_t changed);
+
+void di_sampler_init(void);
+int di_sampler_subscribe(di_edge_handler_t handler);
+void di_sampler_claim(uint8_t mask, di_edge_handler_t handler);
+void di_sampler_service(void);
+uint8_t di_sampler_state(void);
+uint32_t di_sampler_overflows(void);
+
+#endif /* _DI_SAMPLER_H_ */
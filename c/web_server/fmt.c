@@ -0,0 +1,285 @@
+/**
+ * Allocation-free Formatting (bounded output cursor)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Replaces snprintf in the response renderers. Integers are converted
+ * two digits at a time from a 200-byte table, fixed-point values are
+ * printed from scaled integers (no float formatter), and every write is
+ * clipped to the buffer: once something does not fit, the cursor is
+ * marked truncated and later writes are dropped, so a renderer never
+ * emits a half-written field followed by a complete one.
+ */
+
+#include <string.h>
+
+#include "fmt.h"
+
+static const char g_digits2[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char g_hex[16] = "0123456789abcdef";
+
+static const uint32_t g_pow10[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/**
+ * Start writing at the beginning of buf
+ */
+void fmt_init(fmt_t *f, char *buf, size_t size) {
+    f->buf = buf;
+    f->size = size;
+    f->len = 0;
+    f->truncated = (size == 0);
+    if (size) buf[0] = '\0';
+}
+
+void fmt_mem(fmt_t *f, const void *data, size_t n) {
+    if (f->truncated) return;
+    if (f->len + n >= f->size) {
+        f->truncated = 1;
+        return;
+    }
+    memcpy(f->buf + f->len, data, n);
+    f->len += n;
+    f->buf[f->len] = '\0';
+}
+
+void fmt_char(fmt_t *f, char c) {
+    if (f->truncated) return;
+    if (f->len + 1 >= f->size) {
+        f->truncated = 1;
+        return;
+    }
+    f->buf[f->len++] = c;
+    f->buf[f->len] = '\0';
+}
+
+void fmt_str(fmt_t *f, const char *s) {
+    fmt_mem(f, s, strlen(s));
+}
+
+/**
+ * Write digits of v right-aligned ending at end, return start
+ */
+static char *fmt_digits(char *end, uint32_t v) {
+    while (v >= 100) {
+        const char *d = &g_digits2[(v % 100) * 2];
+        v /= 100;
+        *--end = d[1];
+        *--end = d[0];
+    }
+    if (v >= 10) {
+        *--end = g_digits2[v * 2 + 1];
+        *--end = g_digits2[v * 2];
+    } else {
+        *--end = '0' + v;
+    }
+    return end;
+}
+
+void fmt_u32(fmt_t *f, uint32_t v) {
+    char tmp[10];
+    char *p = fmt_digits(tmp + sizeof(tmp), v);
+    fmt_mem(f, p, tmp + sizeof(tmp) - p);
+}
+
+void fmt_i32(fmt_t *f, int32_t v) {
+    char tmp[11];
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    char *p = fmt_digits(tmp + sizeof(tmp), u);
+    if (v < 0) *--p = '-';
+    fmt_mem(f, p, tmp + sizeof(tmp) - p);
+}
+
+void fmt_u64(fmt_t *f, uint64_t v) {
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+
+    // 32-bit chunks of 9 digits keep the 64-bit divisions to two
+    while (v > 0xFFFFFFFFu) {
+        uint32_t low = (uint32_t)(v % 1000000000u);
+        char *chunk = fmt_digits(p, low);
+        while (chunk > p - 9) *--chunk = '0';
+        p = chunk;
+        v /= 1000000000u;
+    }
+    p = fmt_digits(p, (uint32_t)v);
+    fmt_mem(f, p, end - p);
+}
+
+/**
+ * Fixed-point: v is in units of 10^-decimals (fmt_fixed(f, 2305, 1) -> "230.5")
+ */
+void fmt_fixed(fmt_t *f, int32_t v, uint8_t decimals) {
+    char tmp[12];
+    char *end = tmp + sizeof(tmp);
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    char *p;
+
+    if (decimals == 0 || decimals > 9) {
+        fmt_i32(f, v);
+        return;
+    }
+
+    uint32_t scale = g_pow10[decimals];
+    p = fmt_digits(end, u % scale);
+    while (p > end - decimals) *--p = '0';
+    *--p = '.';
+    p = fmt_digits(p, u / scale);
+    if (v < 0) *--p = '-';
+    fmt_mem(f, p, end - p);
+}
+
+/**
+ * num / den with a fixed number of decimals, rounded (replaces "%.3f")
+ */
+void fmt_ratio(fmt_t *f, uint64_t num, uint64_t den, uint8_t decimals) {
+    if (decimals > 9) decimals = 9;
+    if (den == 0) {
+        fmt_fixed(f, 0, decimals);
+        return;
+    }
+
+    uint32_t scale = g_pow10[decimals];
+    uint64_t scaled = (num * scale + den / 2) / den;
+
+    fmt_u64(f, scaled / scale);
+    if (decimals) {
+        char tmp[9];
+        char *end = tmp + decimals;
+        char *p = fmt_digits(end, (uint32_t)(scaled % scale));
+        while (p > tmp) *--p = '0';
+        fmt_char(f, '.');
+        fmt_mem(f, tmp, decimals);
+    }
+}
+
+/**
+ * Lowercase hex, zero-padded to digits (1-8)
+ */
+void fmt_hex(fmt_t *f, uint32_t v, uint8_t digits) {
+    char tmp[8];
+
+    if (digits < 1) digits = 1;
+    if (digits > 8) digits = 8;
+    for (int i = digits - 1; i >= 0; i--) {
+        tmp[i] = g_hex[v & 0xF];
+        v >>= 4;
+    }
+    fmt_mem(f, tmp, digits);
+}
+
+void fmt_hex_bytes(fmt_t *f, const uint8_t *data, size_t n) {
+    if (f->truncated) return;
+    if (f->len + 2 * n >= f->size) {
+        f->truncated = 1;
+        return;
+    }
+
+    char *p = f->buf + f->len;
+    for (size_t i = 0; i < n; i++) {
+        *p++ = g_hex[data[i] >> 4];
+        *p++ = g_hex[data[i] & 0xF];
+    }
+    f->len += 2 * n;
+    f->buf[f->len] = '\0';
+}
+
+/**
+ * Quoted JSON string with ", \ and control characters escaped
+ */
+void fmt_json_str(fmt_t *f, const char *s) {
+    const char *run = s;
+
+    fmt_char(f, '"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        fmt_mem(f, run, s - run);
+        run = s + 1;
+        fmt_char(f, '\\');
+        switch (c) {
+            case '"':  fmt_char(f, '"'); break;
+            case '\\': fmt_char(f, '\\'); break;
+            case '\n': fmt_char(f, 'n'); break;
+            case '\r': fmt_char(f, 'r'); break;
+            case '\t': fmt_char(f, 't'); break;
+            default:
+                fmt_str(f, "u00");
+                fmt_hex(f, c, 2);
+                break;
+        }
+    }
+    fmt_mem(f, run, s - run);
+    fmt_char(f, '"');
+}
+
+/**
+ * Dotted IPv4 address
+ */
+void fmt_ip(fmt_t *f, const uint8_t *ip) {
+    for (int i = 0; i < 4; i++) {
+        if (i) fmt_char(f, '.');
+        fmt_u32(f, ip[i]);
+    }
+}
+
+void fmt_bool(fmt_t *f, int v) {
+    if (v) fmt_mem(f, "true", 4);
+    else fmt_mem(f, "false", 5);
+}
+
+/**
+ * Comma between JSON values, none at the start of an object or array
+ */
+void fmt_sep(fmt_t *f) {
+    if (f->len == 0) return;
+    char last = f->buf[f->len - 1];
+    if (last != '{' && last != '[' && last != ',' && last != ':') fmt_char(f, ',');
+}
+
+/**
+ * JSON object key: ,"key":
+ */
+void fmt_key(fmt_t *f, const char *key) {
+    fmt_sep(f);
+    fmt_char(f, '"');
+    fmt_str(f, key);
+    fmt_str(f, "\":");
+}
+
+/**
+ * Prometheus sample line
+ */
+void fmt_metric(fmt_t *f, const char *name, uint64_t v) {
+    fmt_str(f, name);
+    fmt_char(f, ' ');
+    fmt_u64(f, v);
+    fmt_char(f, '\n');
+}
+
+/**
+ * Prometheus sample line with one label
+ */
+void fmt_metric_label(fmt_t *f, const char *name, const char *label, const char *value, uint64_t v) {
+    fmt_str(f, name);
+    fmt_char(f, '{');
+    fmt_str(f, label);
+    fmt_char(f, '=');
+    fmt_json_str(f, value);
+    fmt_str(f, "} ");
+    fmt_u64(f, v);
+    fmt_char(f, '\n');
+}
@@ -0,0 +1,43 @@
+/**
+ * Allocation-free Formatting (bounded output cursor)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _FMT_H_
+#define _FMT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Output cursor: buf is always NUL-terminated, len < size
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    uint8_t truncated;      // Something did not fit
+} fmt_t;
+
+void fmt_init(fmt_t *f, char *buf, size_t size);
+void fmt_char(fmt_t *f, char c);
+void fmt_mem(fmt_t *f, const void *data, size_t n);
+void fmt_str(fmt_t *f, const char *s);
+void fmt_u32(fmt_t *f, uint32_t v);
+void fmt_i32(fmt_t *f, int32_t v);
+void fmt_u64(fmt_t *f, uint64_t v);
+void fmt_fixed(fmt_t *f, int32_t v, uint8_t decimals);
+void fmt_ratio(fmt_t *f, uint64_t num, uint64_t den, uint8_t decimals);
+void fmt_hex(fmt_t *f, uint32_t v, uint8_t digits);
+void fmt_hex_bytes(fmt_t *f, const uint8_t *data, size_t n);
+void fmt_json_str(fmt_t *f, const char *s);
+void fmt_ip(fmt_t *f, const uint8_t *ip);
+void fmt_bool(fmt_t *f, int v);
+
+// JSON structure: comma unless at the start of an object/array, "key":
+void fmt_sep(fmt_t *f);
+void fmt_key(fmt_t *f, const char *key);
+
+// Prometheus text lines: "name value\n", "name{label=\"value\"} v\n"
+void fmt_metric(fmt_t *f, const char *name, uint64_t v);
+void fmt_metric_label(fmt_t *f, const char *name, const char *label, const char *value, uint64_t v);
+
+#endif /* _FMT_H_ */
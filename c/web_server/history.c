@@ -0,0 +1,427 @@
+/**
+ * Sample History and Query Cache
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Keeps a RAM ring of timestamped samples per metric and answers
+ * bucketed range queries. Rendered query results are kept in a small
+ * LRU cache keyed on the normalized query, so dashboards polling the
+ * same view do not re-aggregate the ring on every request. A new sample
+ * updates the last bucket of the cached "up to now" results in place;
+ * they are re-rendered only once their window moves to the next step.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "history.h"
+
+typedef struct {
+    history_sample_t *samples;
+    uint16_t depth;
+    uint16_t head;      // Next write position
+    uint16_t count;
+    uint32_t seq;       // Samples written since boot (sequence of the next one)
+} history_ring_t;
+
+// One result bucket being aggregated
+typedef struct {
+    uint32_t index;     // Buckets from the window start
+    uint32_t n;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    int32_t last;
+    uint16_t off;       // Its text in the rendered body starts here
+} history_bucket_t;
+
+typedef struct {
+    history_query_t key;
+    uint32_t end;       // Window end the body was rendered for
+    uint32_t last_used;
+    uint8_t valid;
+    uint8_t open;       // Body untruncated, new samples go into last (if last.n)
+    uint16_t points;    // Body offset of the first bucket
+    history_bucket_t last;
+    char body[HISTORY_CACHE_BUF];
+} history_cache_entry_t;
+
+// Sample storage shared by all rings
+#define HISTORY_POOL_SIZE   (HIST_RELAY_ACT_US * HISTORY_DEPTH + 3 * RELAY_COUNT * HISTORY_TEST_DEPTH)
+
+static history_sample_t g_pool[HISTORY_POOL_SIZE];
+static history_ring_t g_history[HIST_METRIC_COUNT];
+static char g_metric_names[HIST_METRIC_COUNT][20];
+static history_cache_entry_t g_cache[HISTORY_CACHE_ENTRIES];
+static uint32_t g_cache_clock;
+
+// Cache statistics
+static uint32_t g_cache_hits;
+static uint32_t g_cache_misses;
+static uint32_t g_cache_evictions;
+static uint32_t g_cache_invalidations;
+static uint32_t g_cache_updates;
+
+/**
+ * Reset history and cache
+ */
+void history_init(void) {
+    uint32_t offset = 0;
+
+    memset(g_history, 0, sizeof(g_history));
+    memset(g_cache, 0, sizeof(g_cache));
+    g_cache_clock = 0;
+
+    strcpy(g_metric_names[HIST_RELAYS], "relays");
+    strcpy(g_metric_names[HIST_INPUTS], "inputs");
+    strcpy(g_metric_names[HIST_VOLTAGE_DV], "voltage_dv");
+    strcpy(g_metric_names[HIST_CURRENT_MA], "current_ma");
+    strcpy(g_metric_names[HIST_POWER_DW], "power_dw");
+    strcpy(g_metric_names[HIST_ENERGY_WH], "energy_wh");
+    strcpy(g_metric_names[HIST_FREQ_DHZ], "freq_dhz");
+    strcpy(g_metric_names[HIST_PF_PCT], "pf_pct");
+    strcpy(g_metric_names[HIST_TEMP_DC], "temp_dc");
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        static const char *const suffixes[3] = {"_act_us", "_rel_us", "_bounce_us"};
+        static const int bases[3] = {HIST_RELAY_ACT_US, HIST_RELAY_REL_US, HIST_RELAY_BOUNCE_US};
+        for (int k = 0; k < 3; k++) {
+            fmt_t f;
+            fmt_init(&f, g_metric_names[bases[k] + i], sizeof(g_metric_names[0]));
+            fmt_str(&f, "relay");
+            fmt_u32(&f, i + 1);
+            fmt_str(&f, suffixes[k]);
+        }
+    }
+
+    // Continuous metrics get the deep rings, self-test trends the short ones
+    for (int i = 0; i < HIST_METRIC_COUNT; i++) {
+        g_history[i].depth = (i < HIST_RELAY_ACT_US) ? HISTORY_DEPTH : HISTORY_TEST_DEPTH;
+        g_history[i].samples = &g_pool[offset];
+        offset += g_history[i].depth;
+    }
+}
+
+/**
+ * History time base (seconds since boot)
+ */
+uint32_t history_now(void) {
+    return to_ms_since_boot(get_absolute_time()) / 1000;
+}
+
+static uint32_t history_query_end(const history_query_t *q);
+
+/**
+ * Add a sample to a bucket
+ */
+static void history_bucket_add(history_bucket_t *b, int32_t v) {
+    if (b->n == 0) {
+        b->sum = 0;
+        b->min = b->max = v;
+    }
+    b->sum += v;
+    if (v < b->min) b->min = v;
+    if (v > b->max) b->max = v;
+    b->last = v;
+    b->n++;
+}
+
+/**
+ * Write a bucket as [bucket_start, avg, min, max, last], comma first
+ * unless it is the first point
+ */
+static void history_bucket_fmt(fmt_t *f, const history_bucket_t *b, uint32_t start,
+                               uint32_t step, int first) {
+    fmt_str(f, first ? "[" : ",[");
+    fmt_u32(f, start + b->index * step);
+    fmt_char(f, ',');
+    fmt_i32(f, (int32_t)(b->sum / (int64_t)b->n));
+    fmt_char(f, ',');
+    fmt_i32(f, b->min);
+    fmt_char(f, ',');
+    fmt_i32(f, b->max);
+    fmt_char(f, ',');
+    fmt_i32(f, b->last);
+    fmt_char(f, ']');
+}
+
+/**
+ * Bring cached results up to date with a sample (t, v): results up to now
+ * get it in their last bucket, or a new one after it; the rest are
+ * dropped when the sample falls in their window. A result whose window
+ * still holds the sample the ring overwrote (evicted, if any) is dropped too
+ */
+static void history_cache_update(uint8_t metric, uint32_t t, int32_t v,
+                                 const history_sample_t *evicted) {
+    for (int i = 0; i < HISTORY_CACHE_ENTRIES; i++) {
+        history_cache_entry_t *e = &g_cache[i];
+        if (!e->valid || e->key.metric != metric) continue;
+        if (!e->key.to_now) {
+            if (e->key.to > t) {
+                e->valid = 0;
+                g_cache_invalidations++;
+            }
+            continue;
+        }
+
+        const history_query_t *q = &e->key;
+        uint32_t start = q->range ? (e->end > q->range ? e->end - q->range : 0) : q->from;
+
+        // A moved window is re-rendered on the next lookup anyway
+        if (!e->open || e->end != history_query_end(q) || (evicted && evicted->t >= start)) {
+            e->valid = 0;
+            g_cache_invalidations++;
+            continue;
+        }
+        uint32_t index = (t - start) / q->step;
+        history_bucket_t *b = &e->last;
+
+        if (b->n == 0 || index != b->index) {
+            // Past the last bucket: a new one goes where the closing "]}" is
+            if (b->n) b->off = strlen(e->body) - 2;
+            b->index = index;
+            b->n = 0;
+        }
+        // Keep room for the closing bracket, like history_render()
+        if ((size_t)b->off + 64 >= sizeof(e->body)) {
+            e->valid = 0;
+            g_cache_invalidations++;
+            continue;
+        }
+        history_bucket_add(b, v);
+
+        fmt_t f;
+        fmt_init(&f, e->body + b->off, sizeof(e->body) - b->off);
+        history_bucket_fmt(&f, b, start, q->step, b->off == e->points);
+        fmt_str(&f, "]}");
+        g_cache_updates++;
+    }
+}
+
+/**
+ * Append sample to metric history
+ */
+void history_record(history_metric_t metric, int32_t value) {
+    if (metric >= HIST_METRIC_COUNT) return;
+
+    history_ring_t *ring = &g_history[metric];
+    uint32_t now = history_now();
+    history_sample_t evicted = ring->samples[ring->head];
+    int full = ring->count == ring->depth;
+
+    ring->samples[ring->head].t = now;
+    ring->samples[ring->head].v = value;
+    ring->head = (ring->head + 1) % ring->depth;
+    if (ring->count < ring->depth) ring->count++;
+    ring->seq++;
+
+    history_cache_update(metric, now, value, full ? &evicted : NULL);
+}
+
+/**
+ * Look up metric by name, -1 if unknown
+ */
+int history_metric_by_name(const char *name) {
+    for (int i = 0; i < HIST_METRIC_COUNT; i++) {
+        if (strcmp(name, g_metric_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Metric name for the id, "unknown" if out of range
+ */
+const char *history_metric_name(int metric) {
+    if (metric < 0 || metric >= HIST_METRIC_COUNT) return "unknown";
+    return g_metric_names[metric];
+}
+
+/**
+ * Align query to bucket boundaries so equivalent queries share a cache key
+ */
+void history_query_normalize(history_query_t *q) {
+    uint32_t now = history_now();
+    uint32_t span;
+
+    if (q->step == 0) q->step = 60;
+
+    if (q->to_now) {
+        span = q->range ? q->range : (now > q->from ? now - q->from : 0);
+    } else {
+        span = q->to > q->from ? q->to - q->from : 0;
+    }
+
+    // Widen step so the result never exceeds HISTORY_MAX_POINTS buckets
+    if (span / q->step > HISTORY_MAX_POINTS) {
+        q->step = (span + HISTORY_MAX_POINTS - 1) / HISTORY_MAX_POINTS;
+    }
+
+    q->from -= q->from % q->step;
+    if (q->to_now) {
+        q->to = 0;
+        if (q->range) {
+            q->from = 0;
+            q->range = (q->range + q->step - 1) / q->step * q->step;
+        }
+    } else {
+        q->range = 0;
+        q->to = (q->to + q->step - 1) / q->step * q->step;
+    }
+}
+
+/**
+ * Window end for a normalized query (exclusive)
+ */
+static uint32_t history_query_end(const history_query_t *q) {
+    if (!q->to_now) return q->to;
+    return (history_now() / q->step + 1) * q->step;
+}
+
+/**
+ * Render bucketed query result as JSON into a cache entry
+ * Each point is [bucket_start, avg, min, max, last]
+ */
+static void history_render(history_cache_entry_t *e) {
+    const history_query_t *q = &e->key;
+    const history_ring_t *ring = &g_history[q->metric];
+    uint32_t end = e->end;
+    uint32_t start = q->range ? (end > q->range ? end - q->range : 0) : q->from;
+    history_bucket_t cur = {0};
+    int truncated = 0;
+    fmt_t f;
+
+    fmt_init(&f, e->body, sizeof(e->body));
+    fmt_str(&f, "{\"metric\":");
+    fmt_json_str(&f, g_metric_names[q->metric]);
+    fmt_str(&f, ",\"from\":");
+    fmt_u32(&f, start);
+    fmt_str(&f, ",\"to\":");
+    fmt_u32(&f, end);
+    fmt_str(&f, ",\"step\":");
+    fmt_u32(&f, q->step);
+    fmt_str(&f, ",\"points\":[");
+    e->points = f.len;
+    e->last.n = 0;
+    e->last.off = f.len;
+
+    // Walk oldest to newest; one extra pass flushes the final bucket
+    for (uint16_t i = 0; i <= ring->count; i++) {
+        uint32_t b = UINT32_MAX;
+        int32_t v = 0;
+
+        if (i < ring->count) {
+            const history_sample_t *s =
+                &ring->samples[(ring->head + ring->depth - ring->count + i) % ring->depth];
+            if (s->t < start || s->t >= end) continue;
+            b = (s->t - start) / q->step;
+            v = s->v;
+        }
+
+        if (b != cur.index && cur.n > 0) {
+            // Keep room for the closing bracket and truncation marker
+            if (f.len + 64 >= sizeof(e->body)) {
+                truncated = 1;
+                break;
+            }
+            cur.off = f.len;
+            history_bucket_fmt(&f, &cur, start, q->step, cur.off == e->points);
+            e->last = cur;
+            cur.n = 0;
+        }
+        if (b == UINT32_MAX) break;
+
+        cur.index = b;
+        history_bucket_add(&cur, v);
+    }
+
+    e->open = !truncated;
+    fmt_str(&f, truncated ? "],\"truncated\":true}" : "]}");
+}
+
+/**
+ * Return rendered result for a normalized query, from cache when possible
+ */
+const char *history_query_cached(const history_query_t *q) {
+    uint32_t end = history_query_end(q);
+    history_cache_entry_t *slot = NULL;
+
+    for (int i = 0; i < HISTORY_CACHE_ENTRIES; i++) {
+        history_cache_entry_t *e = &g_cache[i];
+        if (e->key.metric != q->metric || e->key.to_now != q->to_now ||
+            e->key.step != q->step || e->key.from != q->from ||
+            e->key.to != q->to || e->key.range != q->range) {
+            continue;
+        }
+        if (e->valid && e->end == end) {
+            e->last_used = ++g_cache_clock;
+            g_cache_hits++;
+            return e->body;
+        }
+        // Same query, stale window: re-render in place
+        slot = e;
+        break;
+    }
+
+    g_cache_misses++;
+
+    if (!slot) {
+        // Free slot first, otherwise least recently used
+        for (int i = 0; i < HISTORY_CACHE_ENTRIES; i++) {
+            history_cache_entry_t *e = &g_cache[i];
+            if (!e->valid) {
+                slot = e;
+                break;
+            }
+            if (!slot || e->last_used < slot->last_used) slot = e;
+        }
+        if (slot->valid) g_cache_evictions++;
+    }
+
+    slot->key = *q;
+    slot->end = end;
+    slot->last_used = ++g_cache_clock;
+    slot->valid = 1;
+    history_render(slot);
+    return slot->body;
+}
+
+/**
+ * Sequence numbers of the retained samples: [*first_seq, returned value).
+ * Binary clients poll with the returned value to get only newer samples
+ */
+uint32_t history_span(int metric, uint32_t *first_seq) {
+    const history_ring_t *ring = &g_history[metric];
+
+    *first_seq = ring->seq - ring->count;
+    return ring->seq;
+}
+
+/**
+ * Copy up to max raw samples starting at sequence seq (inside the span)
+ */
+uint16_t history_read(int metric, uint32_t seq, history_sample_t *out, uint16_t max) {
+    const history_ring_t *ring = &g_history[metric];
+    uint32_t first = ring->seq - ring->count;
+    uint16_t n = 0;
+
+    if (seq < first) seq = first;
+    while (n < max && seq < ring->seq) {
+        uint16_t age = ring->seq - seq;     // 1 = newest
+        out[n++] = ring->samples[(ring->head + ring->depth - age) % ring->depth];
+        seq++;
+    }
+    return n;
+}
+
+/**
+ * Render cache statistics in Prometheus text format
+ */
+void history_cache_metrics(fmt_t *f) {
+    fmt_metric(f, "history_cache_hits_total", g_cache_hits);
+    fmt_metric(f, "history_cache_misses_total", g_cache_misses);
+    fmt_metric(f, "history_cache_evictions_total", g_cache_evictions);
+    fmt_metric(f, "history_cache_invalidations_total", g_cache_invalidations);
+    fmt_metric(f, "history_cache_updates_total", g_cache_updates);
+    fmt_str(f, "history_cache_hit_ratio ");
+    fmt_ratio(f, g_cache_hits, g_cache_hits + g_cache_misses, 3);
+    fmt_char(f, '\n');
+}
@@ -0,0 +1,61 @@
+/**
+ * Sample History and Query Cache
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "fmt.h"
+
+// Recorded metrics
+typedef enum {
+    HIST_RELAYS = 0,    // Relay output mask
+    HIST_INPUTS,        // Digital input mask
+    // PZEM-004T meter, native units
+    HIST_VOLTAGE_DV,
+    HIST_CURRENT_MA,
+    HIST_POWER_DW,
+    HIST_ENERGY_WH,
+    HIST_FREQ_DHZ,
+    HIST_PF_PCT,
+    HIST_TEMP_DC,       // RP2350 die temperature, 0.1 C
+    // Relay self-test trends, one metric per channel
+    HIST_RELAY_ACT_US,
+    HIST_RELAY_REL_US = HIST_RELAY_ACT_US + RELAY_COUNT,
+    HIST_RELAY_BOUNCE_US = HIST_RELAY_REL_US + RELAY_COUNT,
+    HIST_METRIC_COUNT = HIST_RELAY_BOUNCE_US + RELAY_COUNT
+} history_metric_t;
+
+// Raw sample (binary history format, little-endian on the wire)
+typedef struct {
+    uint32_t t;         // Seconds since boot
+    int32_t v;
+} history_sample_t;
+
+// Normalized history query
+typedef struct {
+    uint8_t metric;
+    uint8_t to_now;     // 1 = range ends at "now"
+    uint32_t step;      // Bucket width, seconds
+    uint32_t from;      // Seconds since boot (absolute ranges)
+    uint32_t to;        // Seconds since boot (absolute ranges)
+    uint32_t range;     // Seconds back from now (to_now ranges)
+} history_query_t;
+
+void history_init(void);
+uint32_t history_now(void);
+void history_record(history_metric_t metric, int32_t value);
+int history_metric_by_name(const char *name);
+const char *history_metric_name(int metric);
+void history_query_normalize(history_query_t *q);
+const char *history_query_cached(const history_query_t *q);
+uint32_t history_span(int metric, uint32_t *first_seq);
+uint16_t history_read(int metric, uint32_t seq, history_sample_t *out, uint16_t max);
+void history_cache_metrics(fmt_t *f);
+
+#endif /* _HISTORY_H_ */
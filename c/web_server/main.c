@@ -7,10 +7,14 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "pico/stdlib.h"
+#include "pico/rand.h"
 #include "hardware/gpio.h"
 #include "hardware/spi.h"
+#include "hardware/adc.h"
 
 // WIZnet W5500 includes (from Waveshare demo)
 #include "port_common.h"
@@ -21,10 +25,84 @@
 // Project includes
 #include "config.h"
 #include "web_pages.h"
+#include "history.h"
+#include "bench.h"
+#include "di_sampler.h"
+#include "relay_test.h"
+#include "cmd_bus.h"
+#include "capture.h"
+#include "modbus.h"
+#include "peer.h"
+#include "tunnel.h"
+#include "telemetry.h"
+#include "zc.h"
+#include "fmt.h"
+#include "coro.h"
+#include "sched.h"
+#include "cpu.h"
+#include "clients.h"
+#include "tmpl.h"
 
 // Relay state array
 uint8_t g_relay_states[RELAY_COUNT] = {0};
 
+// Responses deferred until a background job (benchmark) finishes, bit per socket
+static uint8_t g_http_pending = 0;
+
+// Connections turned into /api/events streams, bit per socket
+static uint8_t g_http_stream = 0;
+
+// Relays of the last HTTP write held by the self-test (not applied)
+static uint8_t g_http_blocked;
+
+// Request buffer shared by all connections (used within one resume only)
+static uint8_t g_http_rx[MAX_HTTP_BUF + 1];
+
+// Per-connection coroutine frame
+typedef struct {
+    uint8_t sock;
+    uint8_t keepalive;      // Next stream write is a keepalive comment
+    uint8_t closing;
+} http_conn_t;
+
+#if HTTP_SOCKET + HTTP_SOCKETS > TUNNEL_SOCKET || HTTP_SOCKET + HTTP_SOCKETS > PEER_SOCKET || \
+    HTTP_SOCKET + HTTP_SOCKETS > PEER_ARP_SOCKET
+#error "HTTP_SOCKETS overlaps the tunnel or peer sockets"
+#endif
+
+// Shared buffer for large JSON pages (one request at a time)
+static char g_json_buf[JSON_BUF_SIZE];
+
+// Main page split at its slots, and the slot contents spliced in when serving it
+static tmpl_t g_page;
+static tmpl_slot_t g_page_slots[PAGE_SLOT_COUNT];
+static char g_page_relays[2048];
+static char g_page_ip[16];
+static int16_t g_page_mask = -1;    // Relay mask g_page_relays shows, -1 = none yet
+
+// Response waiting for TX space, per connection: segments in send order,
+// copied into buf or referenced in place when the data outlives it (flash)
+#define HTTP_TX_SEGS    (2 * TMPL_MAX_SLOTS + 4)
+
+typedef struct {
+    const uint8_t *seg[HTTP_TX_SEGS];
+    uint16_t seg_len[HTTP_TX_SEGS];
+    uint8_t head;           // Segment being sent
+    uint8_t count;
+    uint8_t cut;            // Response did not fit and was cut short
+    uint16_t used;          // Bytes of buf taken
+    http_body_t body;       // Refills the queue once it drains, fill NULL = none
+    uint8_t buf[HTTP_TX_BUF];
+} http_txq_t;
+
+static http_txq_t g_http_txq[HTTP_SOCKETS];
+static uint32_t g_http_tx_cut;
+
+#if TUNNEL_ENABLE
+// Body generator of the open tunnel response (sent from http_deferred_service)
+static http_body_t g_tunnel_body;
+#endif
+
 /**
  * Initialize relay GPIOs
  */
@@ -43,53 +121,900 @@ void relay_init(void) {
 }
 
 /**
- * Set relay state
+ * Initialize digital input GPIOs
+ */
+void input_init(void) {
+    for (int i = 0; i < DI_COUNT; i++) {
+        gpio_init(DI_CH1 + i);
+        gpio_set_dir(DI_CH1 + i, GPIO_IN);
+        gpio_pull_up(DI_CH1 + i);
+    }
+
+    printf("Digital inputs initialized (GPIO %d-%d)\n", DI_CH1, DI_CH1 + DI_COUNT - 1);
+}
+
+/**
+ * Get digital inputs as bitmask (bit 0 = DI1)
+ */
+uint8_t get_inputs_mask(void) {
+    return (gpio_get_all() >> DI_CH1) & ((1u << DI_COUNT) - 1);
+}
+
+/**
+ * Get relay states as bitmask (bit 0 = relay 1)
  */
-void set_relay(uint8_t relay_num, uint8_t state) {
-    if (relay_num >= 1 && relay_num <= RELAY_COUNT) {
-        const uint8_t relay_pins[] = {RELAY_CH1, RELAY_CH2, RELAY_CH3, RELAY_CH4,
-                                       RELAY_CH5, RELAY_CH6, RELAY_CH7, RELAY_CH8};
-        gpio_put(relay_pins[relay_num - 1], state ? 1 : 0);
-        g_relay_states[relay_num - 1] = state ? 1 : 0;
-        printf("Relay %d: %s\n", relay_num, state ? "ON" : "OFF");
+uint8_t get_relay_mask(void) {
+    uint8_t mask = 0;
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        if (g_relay_states[i]) mask |= 1u << i;
     }
+    return mask;
+}
+
+/**
+ * Queue relay change from HTTP and apply it before replying: 1 if applied,
+ * 0 if the bus is full, -2 if the self-test held some of the relays
+ * (g_http_blocked)
+ */
+int http_relay_command(uint8_t set, uint8_t clear) {
+    cmd_bus_take_blocked(CMD_SRC_HTTP);
+    if (!cmd_bus_post(CMD_SRC_HTTP, CMD_PRIO_NETWORK, set, clear)) return 0;
+    cmd_bus_service();
+    g_http_blocked = cmd_bus_take_blocked(CMD_SRC_HTTP);
+    return g_http_blocked ? -2 : 1;
+}
+
+/**
+ * Record relay changes in history (command bus event handler)
+ */
+void on_relay_change(const cmd_event_t *ev) {
+    history_record(HIST_RELAYS, ev->new_mask);
+    telemetry_put(HIST_RELAYS, TELEMETRY_EVENT, ev->new_mask);
+    coro_post(CORO_EV_RELAYS);
 }
 
 /**
  * Get relay states as JSON
  */
 void get_relays_json(char *buffer, size_t bufsize) {
-    snprintf(buffer, bufsize,
-        "{\"relay_1\":{\"state\":%d},\"relay_2\":{\"state\":%d},"
-        "\"relay_3\":{\"state\":%d},\"relay_4\":{\"state\":%d},"
-        "\"relay_5\":{\"state\":%d},\"relay_6\":{\"state\":%d},"
-        "\"relay_7\":{\"state\":%d},\"relay_8\":{\"state\":%d}}",
-        g_relay_states[0], g_relay_states[1], g_relay_states[2], g_relay_states[3],
-        g_relay_states[4], g_relay_states[5], g_relay_states[6], g_relay_states[7]);
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        fmt_str(&f, i ? ",\"relay_" : "{\"relay_");
+        fmt_u32(&f, i + 1);
+        fmt_str(&f, "\":{\"state\":");
+        fmt_u32(&f, g_relay_states[i]);
+        fmt_char(&f, '}');
+    }
+    fmt_char(&f, '}');
+}
+
+/**
+ * Queue response bytes for a connection; copy = 0 keeps a reference instead
+ */
+static void http_tx_queue(uint8_t sock, const void *data, uint16_t len, int copy) {
+    http_txq_t *q = &g_http_txq[sock - HTTP_SOCKET];
+
+    if (len == 0 || q->cut) return;
+    if (copy) {
+        if (len > sizeof(q->buf) - q->used) goto cut;
+        memcpy(q->buf + q->used, data, len);
+        data = q->buf + q->used;
+        q->used += len;
+        // Follows the previous copy in buf: same segment
+        if (q->count && q->seg[q->count - 1] + q->seg_len[q->count - 1] == data) {
+            q->seg_len[q->count - 1] += len;
+            return;
+        }
+    }
+    if (q->count == HTTP_TX_SEGS) goto cut;
+    q->seg[q->count] = data;
+    q->seg_len[q->count++] = len;
+    return;
+
+cut:
+    q->cut = 1;
+    g_http_tx_cut++;
+    printf("HTTP: response on socket %d over HTTP_TX_BUF, cut short\n", sock);
+}
+
+/**
+ * Response still has bytes to send; a drained queue is refilled from
+ * the body generator first
+ */
+static int http_tx_pending(uint8_t sock) {
+    http_txq_t *q = &g_http_txq[sock - HTTP_SOCKET];
+
+    while (q->head == q->count && q->body.fill && !q->cut) {
+        q->head = q->count = 0;
+        q->used = 0;
+        if (!q->body.fill(sock, &q->body)) q->body.fill = NULL;
+    }
+    return q->head < q->count;
+}
+
+/**
+ * Size of the next send(): rest of the current segment, at most one TX buffer
+ */
+static uint16_t http_tx_chunk(uint8_t sock) {
+    http_txq_t *q = &g_http_txq[sock - HTTP_SOCKET];
+    uint16_t max = getSn_TxMAX(sock);
+
+    if (q->head == q->count) return 0;
+    return q->seg_len[q->head] < max ? q->seg_len[q->head] : max;
+}
+
+static void http_tx_reset(uint8_t sock) {
+    http_txq_t *q = &g_http_txq[sock - HTTP_SOCKET];
+    q->head = q->count = q->cut = 0;
+    q->used = 0;
+    q->body.fill = NULL;
+}
+
+/**
+ * Send as much of the next chunk as the TX buffer takes, never waiting:
+ * bytes sent, SOCK_BUSY if none fit or a send is in flight, <0 (queue
+ * dropped) once the connection is gone
+ */
+static int32_t http_tx_flush(uint8_t sock) {
+    http_txq_t *q = &g_http_txq[sock - HTTP_SOCKET];
+    uint8_t sr = getSn_SR(sock);
+    uint16_t n = http_tx_chunk(sock);
+    uint16_t room = getSn_TX_FSR(sock);
+
+    if (sr != SOCK_ESTABLISHED && sr != SOCK_CLOSE_WAIT) {
+        http_tx_reset(sock);
+        return SOCKERR_SOCKSTATUS;
+    }
+    if (n > room) n = room;
+    if (n == 0) return SOCK_BUSY;
+
+    int32_t ret = send(sock, (uint8_t *)q->seg[q->head], n);
+    if (ret < 0) {
+        http_tx_reset(sock);
+        return ret;
+    }
+    q->seg[q->head] += ret;
+    q->seg_len[q->head] -= ret;
+    if (q->seg_len[q->head] == 0) q->head++;
+    return ret;
+}
+
+/**
+ * Write response bytes to a client: queued for the W5500 socket (the
+ * connection coroutine sends them as TX space frees up) or the hub tunnel
+ */
+void http_write(uint8_t sock, const void *data, uint16_t len) {
+#if TUNNEL_ENABLE
+    if (sock == TUNNEL_SOCKET) {
+        tunnel_write(data, len);
+        return;
+    }
+#endif
+    http_tx_queue(sock, data, len, 1);
+}
+
+/**
+ * Send data on HTTP socket (mirrored to traffic capture)
+ */
+void http_send(uint8_t sock, const void *data, uint16_t len) {
+    CAPTURE_TCP(sock, CAPTURE_TX, (const uint8_t *)data, len);
+    clients_tx(sock, len);
+    http_write(sock, data, len);
+}
+
+/**
+ * http_send() for data that stays valid until the response is out (flash):
+ * queued by reference instead of copied
+ */
+void http_send_static(uint8_t sock, const void *data, uint16_t len) {
+    CAPTURE_TCP(sock, CAPTURE_TX, (const uint8_t *)data, len);
+    clients_tx(sock, len);
+#if TUNNEL_ENABLE
+    if (sock == TUNNEL_SOCKET) {
+        tunnel_write(data, len);
+        return;
+    }
+#endif
+    http_tx_queue(sock, data, len, 0);
+}
+
+/**
+ * Send the rest of a response from a generator: body->fill queues the
+ * next piece with http_write() each time the previous one has gone out
+ */
+void http_send_body(uint8_t sock, const http_body_t *body) {
+#if TUNNEL_ENABLE
+    if (sock == TUNNEL_SOCKET) {
+        g_tunnel_body = *body;
+        g_http_pending |= 1u << sock;
+        return;
+    }
+#endif
+    g_http_txq[sock - HTTP_SOCKET].body = *body;
+}
+
+/**
+ * Send response status line and headers for a body of body_len bytes;
+ * extra is NULL or more header lines, each ending in \r\n
+ */
+void send_http_header(uint8_t sock, const char *status, const char *content_type,
+                      const char *extra, size_t body_len) {
+    char header[256];
+    fmt_t f;
+
+    fmt_init(&f, header, sizeof(header));
+    fmt_str(&f, "HTTP/1.1 ");
+    fmt_str(&f, status);
+    fmt_str(&f, "\r\nContent-Type: ");
+    fmt_str(&f, content_type);
+    fmt_str(&f, "\r\nContent-Length: ");
+    fmt_u32(&f, body_len);
+    fmt_str(&f, "\r\n");
+    if (extra) fmt_str(&f, extra);
+    fmt_str(&f, "Connection: close\r\n\r\n");
+
+    clients_response(sock, strtoul(status, NULL, 10));
+    http_send(sock, header, f.len);
 }
 
 /**
  * Simple HTTP response helper
  */
 void send_http_response(uint8_t sock, const char *status, const char *content_type, const char *body) {
-    char header[256];
-    snprintf(header, sizeof(header),
-             "HTTP/1.1 %s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %d\r\n"
-             "Connection: close\r\n\r\n",
-             status, content_type, strlen(body));
+    size_t body_len = strlen(body);
+
+    send_http_header(sock, status, content_type, NULL, body_len);
+    http_send(sock, body, body_len);
+}
+
+/**
+ * Check URI path, ignoring query string
+ */
+int uri_path_is(const char *uri, const char *path) {
+    size_t len = strlen(path);
+    return strncmp(uri, path, len) == 0 && (uri[len] == '\0' || uri[len] == '?');
+}
+
+/**
+ * Get query string parameter from URI
+ */
+int get_query_param(const char *uri, const char *name, char *value, size_t size) {
+    const char *p = strchr(uri, '?');
+    size_t name_len = strlen(name);
+
+    while (p) {
+        p++;
+        if (strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            p += name_len + 1;
+            size_t n = strcspn(p, "&");
+            if (n >= size) n = size - 1;
+            memcpy(value, p, n);
+            value[n] = '\0';
+            return 1;
+        }
+        p = strchr(p, '&');
+    }
+    return 0;
+}
+
+/**
+ * Get request header value (name is case-insensitive), 0 if absent
+ */
+int get_header(const char *request, const char *name, char *value, size_t size) {
+    size_t name_len = strlen(name);
+    const char *p = strstr(request, "\r\n");
+
+    while (p && p[2] != '\r' && p[2] != '\0') {
+        p += 2;
+        if (strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            p += name_len + 1;
+            while (*p == ' ') p++;
+            size_t n = strcspn(p, "\r\n");
+            if (n >= size) n = size - 1;
+            memcpy(value, p, n);
+            value[n] = '\0';
+            return 1;
+        }
+        p = strstr(p, "\r\n");
+    }
+    return 0;
+}
+
+/**
+ * Get unsigned number member of a flat JSON object, 0 if absent
+ */
+int json_get_uint(const char *json, const char *key, uint32_t *value) {
+    char quoted[24];
+    const char *p;
+    fmt_t f;
+
+    fmt_init(&f, quoted, sizeof(quoted));
+    fmt_json_str(&f, key);
+    if (f.truncated || !(p = strstr(json, quoted))) return 0;
+    p += f.len;
+    while (*p == ' ') p++;
+    if (*p++ != ':') return 0;
+    while (*p == ' ') p++;
+    if (*p < '0' || *p > '9') return 0;
+    *value = strtoul(p, NULL, 0);
+    return 1;
+}
+
+/**
+ * Random per-boot nonce: the version counter restarts at every boot,
+ * so a tag from before a reboot must not match the same number again
+ */
+static uint32_t relay_boot_id(void) {
+    static uint32_t boot;
+
+    while (boot == 0) boot = get_rand_32();
+    return boot;
+}
 
-    send(sock, (uint8_t*)header, strlen(header));
-    send(sock, (uint8_t*)body, strlen(body));
+/**
+ * Relay state entity tag (unquoted): "<boot>-<version>", boot in hex
+ */
+static void fmt_relay_tag(fmt_t *f) {
+    fmt_hex(f, relay_boot_id(), 8);
+    fmt_char(f, '-');
+    fmt_u32(f, cmd_bus_version());
+}
+
+/**
+ * Relay state version as an entity tag header line
+ */
+static void relay_etag(char *buffer, size_t bufsize) {
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_str(&f, "ETag: \"");
+    fmt_relay_tag(&f);
+    fmt_str(&f, "\"\r\n");
+}
+
+/**
+ * Compare a conditional header (If-Match / If-None-Match) with the relay
+ * state tag: 1 if it lists the current boot and version or is "*"
+ */
+static int relay_version_matches(const char *value) {
+    const char *p = value;
+
+    if (strcmp(value, "*") == 0) return 1;
+    // Comma-separated list of "<boot>-<version>" tags
+    while (*p) {
+        while (*p == ' ' || *p == ',' || *p == '"') p++;
+        if (*p == '\0') return 0;
+        char *end;
+        uint32_t boot = strtoul(p, &end, 16);
+        if (end == p || *end != '-' || end[1] < '0' || end[1] > '9') return 0;
+        uint32_t v = strtoul(end + 1, &end, 10);
+        if (boot == relay_boot_id() && v == cmd_bus_version()) return 1;
+        p = end;
+    }
+    return 0;
+}
+
+/**
+ * Relay state: GET /api/relays with its version as ETag.
+ * If-None-Match with the current version gets 304 and no body
+ */
+void handle_relays_get(uint8_t sock, const char *request) {
+    char etag[32];
+    char value[48];
+    char body[512];
+
+    relay_etag(etag, sizeof(etag));
+    if (get_header(request, "If-None-Match", value, sizeof(value)) && relay_version_matches(value)) {
+        send_http_header(sock, "304 Not Modified", "application/json", etag, 0);
+        return;
+    }
+    get_relays_json(body, sizeof(body));
+    send_http_header(sock, "200 OK", "application/json", etag, strlen(body));
+    http_send(sock, body, strlen(body));
+}
+
+/**
+ * Conditional relay write: apply set/clear/toggle masks only if If-Match
+ * (when sent) names the current state version. Queued commands are applied
+ * first, so the version checked is the one the write lands on, and the
+ * toggle is resolved against that same state.
+ * Returns 1 applied, 0 command bus full, -1 version mismatch, -2 some
+ * relays held by the self-test
+ */
+int http_relay_update(const char *request, uint8_t set, uint8_t clear, uint8_t toggle) {
+    char value[48];
+    uint8_t mask;
+
+    cmd_bus_service();
+    if (get_header(request, "If-Match", value, sizeof(value)) && !relay_version_matches(value)) {
+        return -1;
+    }
+    mask = get_relay_mask();
+    set |= toggle & ~mask;
+    clear |= toggle & mask;
+    return http_relay_command(set, clear);
+}
+
+/**
+ * Reply to a relay write with the resulting state and version (ETag);
+ * 412 Precondition Failed carries the current ones for the retry, a full
+ * command bus is 503 with Retry-After, relays held by the self-test are
+ * 409 Conflict with their bits in "blocked"
+ */
+void send_relay_result(uint8_t sock, int result) {
+    char headers[64];
+    char body[128];
+    fmt_t f;
+
+    relay_etag(headers, sizeof(headers));
+    if (result == 0) strcat(headers, "Retry-After: 1\r\n");
+    fmt_init(&f, body, sizeof(body));
+    fmt_str(&f, "{\"success\":");
+    fmt_bool(&f, result > 0);
+    fmt_key(&f, "version");
+    fmt_u32(&f, cmd_bus_version());
+    fmt_str(&f, ",\"etag\":\"");
+    fmt_relay_tag(&f);
+    fmt_char(&f, '"');
+    fmt_key(&f, "mask");
+    fmt_u32(&f, get_relay_mask());
+    if (result == -2) {
+        fmt_key(&f, "blocked");
+        fmt_u32(&f, g_http_blocked);
+    }
+    fmt_char(&f, '}');
+
+    send_http_header(sock, result == -2 ? "409 Conflict" :
+                           result < 0 ? "412 Precondition Failed" :
+                           result == 0 ? "503 Service Unavailable" : "200 OK",
+                     "application/json", headers, f.len);
+    http_send(sock, body, f.len);
+}
+
+/**
+ * Atomic mask update: POST /api/relays/mask {"set":1,"clear":6,"toggle":128}
+ * Members are optional; clear wins over set, toggle flips the bits left
+ */
+void handle_relay_mask(uint8_t sock, char *request) {
+    const uint8_t all = (1u << RELAY_COUNT) - 1;
+    uint32_t set = 0, clear = 0, toggle = 0;
+    char *body = strstr(request, "\r\n\r\n");
+
+    if (!body) {
+        send_http_response(sock, "400 Bad Request", "text/plain", "Missing body");
+        return;
+    }
+    body += 4;
+    json_get_uint(body, "set", &set);
+    json_get_uint(body, "clear", &clear);
+    json_get_uint(body, "toggle", &toggle);
+    if ((set | clear | toggle) & ~all) {
+        send_http_response(sock, "400 Bad Request", "text/plain", "Mask out of range");
+        return;
+    }
+    send_relay_result(sock, http_relay_update(request, set, clear, toggle & ~(set | clear)));
+}
+
+// Sections of a binary history reply in progress, per socket
+typedef struct {
+    uint8_t count;
+    uint8_t cur;
+    uint8_t metric[HISTORY_BIN_METRICS];
+    uint32_t hdr[HISTORY_BIN_METRICS][4];
+} history_bin_t;
+
+static history_bin_t g_history_bin[_WIZCHIP_SOCK_NUM_];
+
+/**
+ * Next samples of a binary history reply, then the next section's header
+ * (body generator)
+ */
+static int history_binary_fill(uint8_t sock, http_body_t *b) {
+    history_bin_t *h = &g_history_bin[sock];
+    history_sample_t chunk[64];
+
+    for (int i = 0; i < 4; i++) {
+        if (b->pos == b->end) {
+            if (++h->cur == h->count) return 0;
+            http_send(sock, h->hdr[h->cur], sizeof(h->hdr[h->cur]));
+            b->pos = h->hdr[h->cur][2];
+            b->end = b->pos + h->hdr[h->cur][3];
+            continue;
+        }
+        uint32_t left = b->end - b->pos;
+        uint16_t n = history_read(h->metric[h->cur], b->pos, chunk, left < 64 ? left : 64);
+        if (n == 0) return 0;
+        http_send(sock, chunk, n * sizeof(history_sample_t));
+        b->pos += n;
+    }
+    return b->pos < b->end || h->cur + 1 < h->count;
+}
+
+/**
+ * Raw samples as packed binary: /api/history?metric=power_dw,temp_dc&format=bin&since=0,0&max=600
+ * One section per listed metric, in order: little-endian header
+ * {u32 next, u32 now, u32 first, u16 count, u16 reserved} followed by
+ * count x {u32 t, i32 v}. since= lists the sequence numbers from the
+ * previous reply's "next" fields, so a poll returns only samples added
+ * meanwhile; max= keeps the newest ones of each metric
+ */
+void handle_history_binary(uint8_t sock, const char *uri) {
+    history_bin_t *h = &g_history_bin[sock];
+    http_body_t body = {history_binary_fill, 0, 0, 0};
+    char names[HISTORY_BIN_METRICS * 16];
+    char sinces[HISTORY_BIN_METRICS * 12];
+    char value[12];
+    uint32_t max = HISTORY_DEPTH;
+    uint32_t length = 0;
+    char *name = names;
+    const char *since_p = sinces;
+
+    if (!get_query_param(uri, "metric", names, sizeof(names))) names[0] = '\0';
+    if (!get_query_param(uri, "since", sinces, sizeof(sinces))) sinces[0] = '\0';
+    if (get_query_param(uri, "max", value, sizeof(value))) max = strtoul(value, NULL, 10);
+
+    h->count = 0;
+    h->cur = 0;
+    while (*name) {
+        char *comma = strchr(name, ',');
+        if (comma) *comma = '\0';
+        int metric = history_metric_by_name(name);
+        name = comma ? comma + 1 : name + strlen(name);
+        if (metric < 0 || h->count == HISTORY_BIN_METRICS) {
+            send_http_response(sock, "400 Bad Request", "text/plain", "Unknown metric");
+            return;
+        }
+
+        // since= values pair up with the metrics; missing ones are 0
+        char *end;
+        uint32_t since = strtoul(since_p, &end, 10);
+        since_p = *end == ',' ? end + 1 : end;
+
+        uint32_t first;
+        uint32_t next = history_span(metric, &first);
+
+        // A client from before a reboot has a sequence ahead of ours: start over
+        if (since > next || since < first) since = first;
+        if (next - since > max) since = next - max;
+
+        uint32_t *hdr = h->hdr[h->count];
+        hdr[0] = next;
+        hdr[1] = history_now();
+        hdr[2] = since;
+        hdr[3] = (uint16_t)(next - since);
+        h->metric[h->count++] = metric;
+        length += sizeof(h->hdr[0]) + hdr[3] * sizeof(history_sample_t);
+    }
+    if (!h->count) {
+        send_http_response(sock, "400 Bad Request", "text/plain", "Unknown metric");
+        return;
+    }
+
+    send_http_header(sock, "200 OK", "application/octet-stream", NULL, length);
+    http_send(sock, h->hdr[0], sizeof(h->hdr[0]));
+    body.pos = h->hdr[0][2];
+    body.end = body.pos + h->hdr[0][3];
+    if (body.pos < body.end || h->count > 1) http_send_body(sock, &body);
+}
+
+/**
+ * Handle history query: /api/history?metric=relays&range=3600&step=60
+ * Absolute ranges use from=/to= (seconds since boot) instead of range=
+ */
+void handle_history_request(uint8_t sock, const char *uri) {
+    char value[24];
+    history_query_t q;
+    int metric;
+
+    if (get_query_param(uri, "format", value, sizeof(value)) && strcmp(value, "bin") == 0) {
+        handle_history_binary(sock, uri);
+        return;
+    }
+    if (!get_query_param(uri, "metric", value, sizeof(value)) ||
+        (metric = history_metric_by_name(value)) < 0) {
+        send_http_response(sock, "400 Bad Request", "text/plain", "Unknown metric");
+        return;
+    }
+
+    memset(&q, 0, sizeof(q));
+    q.metric = metric;
+    if (get_query_param(uri, "step", value, sizeof(value))) {
+        q.step = strtoul(value, NULL, 10);
+    }
+    if (get_query_param(uri, "from", value, sizeof(value))) {
+        q.from = strtoul(value, NULL, 10);
+        if (get_query_param(uri, "to", value, sizeof(value))) {
+            q.to = strtoul(value, NULL, 10);
+        } else {
+            q.to_now = 1;
+        }
+    } else {
+        q.to_now = 1;
+        q.range = 3600;
+        if (get_query_param(uri, "range", value, sizeof(value))) {
+            q.range = strtoul(value, NULL, 10);
+        }
+    }
+
+    history_query_normalize(&q);
+    send_http_response(sock, "200 OK", "application/json", history_query_cached(&q));
+}
+
+/**
+ * Render metrics in Prometheus text format
+ */
+void get_metrics_text(char *buffer, size_t bufsize) {
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_metric(&f, "uptime_seconds", history_now());
+    fmt_metric(&f, "relay_mask", get_relay_mask());
+    fmt_metric(&f, "input_mask", get_inputs_mask());
+    fmt_metric(&f, "di_sampler_overflows_total", di_sampler_overflows());
+    fmt_metric(&f, "http_tx_cut_total", g_http_tx_cut);
+    history_cache_metrics(&f);
+    cmd_bus_metrics(&f);
+    coro_metrics(&f);
+    sched_metrics(&f);
+    cpu_metrics(&f);
+    clients_metrics(&f);
+    peer_metrics(&f);
+#if TUNNEL_ENABLE
+    tunnel_metrics(&f);
+#endif
+    telemetry_metrics(&f);
+}
+
+/**
+ * Handle benchmark request: /debug/bench?suite=spi|gpio|json|fmt|coro|flash|timer
+ * The response is sent by the connection coroutine once the suite has finished
+ */
+void handle_bench_request(uint8_t sock, const char *uri) {
+    char value[16];
+    int suite;
+
+    if (!get_query_param(uri, "suite", value, sizeof(value)) ||
+        (suite = bench_suite_by_name(value)) < 0) {
+        send_http_response(sock, "400 Bad Request", "text/plain", "Unknown suite");
+        return;
+    }
+    if (!bench_start(suite)) {
+        send_http_response(sock, "503 Service Unavailable", "text/plain", "Benchmark busy");
+        return;
+    }
+    g_http_pending |= 1u << sock;
+}
+
+/**
+ * Send a deferred response once its background job is done
+ * Returns 1 when the response went out
+ */
+int http_deferred_service(uint8_t sock) {
+    if (!(g_http_pending & (1u << sock))) return 0;
+#if TUNNEL_ENABLE
+    // Tunnel body: next piece once the previous one has left the send queue
+    if (sock == TUNNEL_SOCKET && g_tunnel_body.fill) {
+        if (tunnel_connected()) {
+            if (!tunnel_tx_idle()) return 0;
+            if (g_tunnel_body.fill(sock, &g_tunnel_body)) return 0;
+        }
+        g_tunnel_body.fill = NULL;
+        g_http_pending &= ~(1u << sock);
+        return 1;
+    }
+#endif
+    if (bench_busy()) return 0;
+
+    send_http_response(sock, "200 OK", "application/json", bench_result());
+    g_http_pending &= ~(1u << sock);
+    return 1;
+}
+
+/**
+ * Start relay self-test: POST /debug/relaytest?relay=1&di=1&cycles=50
+ * The relay contact must be wired to the given digital input
+ */
+void handle_relay_test_start(uint8_t sock, const char *uri) {
+    char value[12];
+    int relay = 0, di = 0, cycles = 50;
+
+    if (get_query_param(uri, "relay", value, sizeof(value))) relay = atoi(value);
+    if (get_query_param(uri, "di", value, sizeof(value))) di = atoi(value);
+    if (get_query_param(uri, "cycles", value, sizeof(value))) cycles = atoi(value);
+
+    int started = relay_test_start(relay, di, cycles);
+
+    if (started > 0) {
+        send_http_response(sock, "202 Accepted", "application/json", "{\"success\":true}");
+    } else if (started < 0) {
+        send_http_response(sock, "503 Service Unavailable", "application/json",
+                           "{\"success\":false,\"error\":\"no alarm slot\"}");
+    } else {
+        send_http_response(sock, "409 Conflict", "application/json", "{\"success\":false}");
+    }
+}
+
+#if CAPTURE_ENABLE
+/**
+ * Control capture: POST /debug/pcap?action=start&host=192.168.1.5&port=80&dir=rx&snaplen=128
+ */
+void handle_capture_control(uint8_t sock, const char *uri) {
+    char value[20];
+    char status[192];
+
+    if (get_query_param(uri, "action", value, sizeof(value)) && strcmp(value, "start") == 0) {
+        capture_filter_t filter;
+        memset(&filter, 0, sizeof(filter));
+
+        if (get_query_param(uri, "host", value, sizeof(value))) {
+            sscanf(value, "%hhu.%hhu.%hhu.%hhu",
+                   &filter.host[0], &filter.host[1], &filter.host[2], &filter.host[3]);
+        }
+        if (get_query_param(uri, "port", value, sizeof(value))) filter.port = atoi(value);
+        if (get_query_param(uri, "snaplen", value, sizeof(value))) filter.snaplen = atoi(value);
+        if (get_query_param(uri, "dir", value, sizeof(value))) {
+            if (strcmp(value, "rx") == 0) filter.dir_mask = 1u << CAPTURE_RX;
+            if (strcmp(value, "tx") == 0) filter.dir_mask = 1u << CAPTURE_TX;
+        }
+        capture_start(&filter);
+    } else {
+        capture_stop();
+    }
+
+    capture_status_json(status, sizeof(status));
+    send_http_response(sock, "200 OK", "application/json", status);
+}
+#endif
+
+/**
+ * Control Modbus capture: POST /debug/modbus?action=start&baud=9600
+ * Capture only records; the PZEM poller keeps running either way
+ */
+void handle_modbus_control(uint8_t sock, const char *uri) {
+    char value[12];
+    uint32_t baud = 0;
+
+    if (get_query_param(uri, "baud", value, sizeof(value))) baud = strtoul(value, NULL, 10);
+
+    if (get_query_param(uri, "action", value, sizeof(value)) && strcmp(value, "start") == 0) {
+        if (!modbus_capture_start(baud)) {
+            send_http_response(sock, "409 Conflict", "application/json",
+                               "{\"success\":false,\"error\":\"baud fixed by PZEM poller\"}");
+            return;
+        }
+    } else {
+        modbus_capture_stop();
+    }
+    send_http_response(sock, "200 OK", "application/json", "{\"success\":true}");
+}
+
+/**
+ * Record DI changes in history (DI sampler edge handler)
+ */
+void on_input_edge(uint32_t t_us, uint8_t pins, uint8_t changed) {
+    history_record(HIST_INPUTS, pins);
+    telemetry_put(HIST_INPUTS, TELEMETRY_EVENT, pins);
+}
+
+/**
+ * Record meter readings and offer them as telemetry (PZEM poller handler)
+ */
+void on_pzem_reading(const pzem_reading_t *r) {
+    const int32_t values[] = {r->voltage_dv, r->current_ma, r->power_dw,
+                              r->energy_wh, r->freq_dhz, r->pf_pct};
+
+    for (int i = 0; i < (int)(sizeof(values) / sizeof(values[0])); i++) {
+        history_record(HIST_VOLTAGE_DV + i, values[i]);
+        telemetry_put(HIST_VOLTAGE_DV + i, TELEMETRY_SAMPLE, values[i]);
+    }
+#if ZC_ENABLE
+    zc_set_mains_freq(r->freq_dhz);
+#endif
+}
+
+/**
+ * Write one server-sent event: relay state, or a keepalive comment
+ * Returns the send() result (SOCK_BUSY while a previous send is in flight)
+ */
+int32_t http_sse_send(uint8_t sock, int keepalive) {
+    char msg[HTTP_SSE_MAX_EVENT];
+    char json[256];
+    uint8_t prev = cpu_enter(CPU_HTTP);
+    fmt_t f;
+
+    fmt_init(&f, msg, sizeof(msg));
+    if (keepalive) {
+        fmt_str(&f, ": keepalive\n\n");
+    } else {
+        get_relays_json(json, sizeof(json));
+        fmt_str(&f, "event: relays\ndata: ");
+        fmt_str(&f, json);
+        fmt_str(&f, "\n\n");
+    }
+    cpu_leave(prev);
+    CAPTURE_TCP(sock, CAPTURE_TX, (const uint8_t *)msg, f.len);
+    return send(sock, (uint8_t *)msg, f.len);
+}
+
+/**
+ * Split the main page at its slots and fill the ones that never change
+ */
+void page_init(void) {
+    const uint8_t ip[] = NET_IP;
+    fmt_t f;
+
+    // A broken template is a build mistake: stop here rather than serve garbage
+    if (!tmpl_compile(&g_page, HTML_PAGE, PAGE_SLOT_COUNT)) panic("Main page template invalid");
+
+    fmt_init(&f, g_page_ip, sizeof(g_page_ip));
+    fmt_ip(&f, ip);
+    g_page_slots[PAGE_SLOT_IP].data = g_page_ip;
+    g_page_slots[PAGE_SLOT_IP].len = f.len;
+    g_page_slots[PAGE_SLOT_RELAYS].data = g_page_relays;
+}
+
+/**
+ * Render relay cards into the page slot (same markup the page script updates)
+ */
+static void page_render_relays(uint8_t mask) {
+    fmt_t f;
+
+    fmt_init(&f, g_page_relays, sizeof(g_page_relays));
+    for (int i = 1; i <= RELAY_COUNT; i++) {
+        int on = (mask >> (i - 1)) & 1;
+        fmt_str(&f, "<div class=\"relay-card\"><h3>Relay ");
+        fmt_u32(&f, i);
+        fmt_str(&f, on ? "</h3><div class=\"status on\" id=\"status-"
+                       : "</h3><div class=\"status off\" id=\"status-");
+        fmt_u32(&f, i);
+        fmt_str(&f, on ? "\">ON</div>" : "\">OFF</div>");
+        fmt_str(&f, "<div class=\"buttons\"><button onclick=\"setRelay(");
+        fmt_u32(&f, i);
+        fmt_str(&f, ",1)\">Turn ON</button><button onclick=\"setRelay(");
+        fmt_u32(&f, i);
+        fmt_str(&f, ",0)\">Turn OFF</button></div></div>");
+    }
+    g_page_slots[PAGE_SLOT_RELAYS].len = f.len;
+    g_page_mask = mask;
+}
+
+/**
+ * Serve the main page with the current relay state in place, so the first
+ * paint needs no /api/relays round-trip. Cards are re-rendered only after
+ * the relays changed; everything else goes out straight from flash
+ */
+void handle_page(uint8_t sock) {
+    uint8_t mask = get_relay_mask();
+
+    if (mask != g_page_mask) page_render_relays(mask);
+    send_http_header(sock, "200 OK", "text/html", NULL, tmpl_length(&g_page, g_page_slots));
+    tmpl_send(&g_page, g_page_slots, http_send_static, http_send, sock);
+}
+
+/**
+ * Start a server-sent event stream: GET /api/events
+ * The connection coroutine keeps writing relay changes until the client leaves
+ */
+void handle_event_stream(uint8_t sock) {
+    static const char header[] =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\nConnection: close\r\n\r\n";
+
+    // Tunnel responses are single request/response exchanges
+    if (sock >= HTTP_SOCKET + HTTP_SOCKETS) {
+        send_http_response(sock, "501 Not Implemented", "text/plain", "Streams need a direct connection");
+        return;
+    }
+    http_send(sock, header, sizeof(header) - 1);
+    g_http_stream |= 1u << sock;
 }
 
 /**
  * Process HTTP request
  */
 void process_http_request(uint8_t sock, char *request, uint16_t len) {
-    char response_buf[512];
-
     // Parse request line
     char method[16] = {0};
     char uri[128] = {0};
@@ -100,14 +1025,65 @@ void process_http_request(uint8_t sock, char *request, uint16_t len) {
     // Route handling
     if (strcmp(method, "GET") == 0) {
         if (strcmp(uri, "/") == 0 || strcmp(uri, "/index.html") == 0) {
-            // Serve main HTML page
-            send_http_response(sock, "200 OK", "text/html", HTML_PAGE);
+            // Serve main HTML page with the relay state filled in
+            handle_page(sock);
         }
         else if (strcmp(uri, "/api/relays") == 0) {
             // Return relay states as JSON
-            get_relays_json(response_buf, sizeof(response_buf));
-            send_http_response(sock, "200 OK", "application/json", response_buf);
+            handle_relays_get(sock, request);
+        }
+        else if (uri_path_is(uri, "/api/history")) {
+            handle_history_request(sock, uri);
         }
+        else if (strcmp(uri, "/api/events") == 0) {
+            handle_event_stream(sock);
+        }
+        else if (strcmp(uri, "/metrics") == 0) {
+            get_metrics_text(g_json_buf, sizeof(g_json_buf));
+            send_http_response(sock, "200 OK", "text/plain; version=0.0.4", g_json_buf);
+        }
+        else if (uri_path_is(uri, "/debug/bench")) {
+            handle_bench_request(sock, uri);
+        }
+        else if (uri_path_is(uri, "/debug/clients")) {
+            char by[12] = "";
+            get_query_param(uri, "by", by, sizeof(by));
+            clients_json(g_json_buf, sizeof(g_json_buf), by);
+            send_http_response(sock, "200 OK", "application/json", g_json_buf);
+        }
+        else if (strcmp(uri, "/debug/cpu") == 0) {
+            cpu_json(g_json_buf, sizeof(g_json_buf));
+            send_http_response(sock, "200 OK", "application/json", g_json_buf);
+        }
+        else if (strcmp(uri, "/debug/relaytest") == 0) {
+            relay_test_json(g_json_buf, sizeof(g_json_buf));
+            send_http_response(sock, "200 OK", "application/json", g_json_buf);
+        }
+        else if (strcmp(uri, "/debug/modbus") == 0) {
+            modbus_capture_json(g_json_buf, sizeof(g_json_buf));
+            send_http_response(sock, "200 OK", "application/json", g_json_buf);
+        }
+        else if (strcmp(uri, "/api/peers") == 0) {
+            peer_json(g_json_buf, sizeof(g_json_buf));
+            send_http_response(sock, "200 OK", "application/json", g_json_buf);
+        }
+#if ZC_ENABLE
+        else if (strcmp(uri, "/debug/zc") == 0) {
+            zc_json(g_json_buf, sizeof(g_json_buf));
+            send_http_response(sock, "200 OK", "application/json", g_json_buf);
+        }
+#endif
+#if CAPTURE_ENABLE
+        else if (strcmp(uri, "/debug/pcap") == 0) {
+            // Stream capture as a pcap file
+            capture_stream(sock);
+        }
+        else if (strcmp(uri, "/debug/pcap/status") == 0) {
+            char status[192];
+            capture_status_json(status, sizeof(status));
+            send_http_response(sock, "200 OK", "application/json", status);
+        }
+#endif
         else {
             send_http_response(sock, "404 Not Found", "text/plain", "Not Found");
         }
@@ -127,23 +1103,36 @@ void process_http_request(uint8_t sock, char *request, uint16_t len) {
                 } else if (strstr(body, "\"state\":0") || strstr(body, "\"state\": 0")) {
                     state = 0;
                 }
-                set_relay(relay_num, state);
-                send_http_response(sock, "200 OK", "application/json", "{\"success\":true}");
+                if (relay_num < 1 || relay_num > RELAY_COUNT) {
+                    send_http_response(sock, "404 Not Found", "text/plain", "Unknown relay");
+                } else {
+                    send_relay_result(sock, http_relay_update(request, state ? 1u << (relay_num - 1) : 0,
+                                                              state ? 0 : 1u << (relay_num - 1), 0));
+                }
             }
         }
         else if (strcmp(uri, "/api/relays/all/on") == 0) {
-            // Turn all relays ON
-            for (int i = 1; i <= RELAY_COUNT; i++) {
-                set_relay(i, 1);
-            }
-            send_http_response(sock, "200 OK", "application/json", "{\"success\":true}");
+            // Turn all relays ON (one command, one GPIO write)
+            send_relay_result(sock, http_relay_update(request, (1u << RELAY_COUNT) - 1, 0, 0));
         }
         else if (strcmp(uri, "/api/relays/all/off") == 0) {
             // Turn all relays OFF
-            for (int i = 1; i <= RELAY_COUNT; i++) {
-                set_relay(i, 0);
-            }
-            send_http_response(sock, "200 OK", "application/json", "{\"success\":true}");
+            send_relay_result(sock, http_relay_update(request, 0, (1u << RELAY_COUNT) - 1, 0));
+        }
+        else if (strcmp(uri, "/api/relays/mask") == 0) {
+            // Set/clear/toggle in one command, optionally conditional on If-Match
+            handle_relay_mask(sock, request);
+        }
+        else if (uri_path_is(uri, "/debug/relaytest")) {
+            handle_relay_test_start(sock, uri);
+        }
+#if CAPTURE_ENABLE
+        else if (uri_path_is(uri, "/debug/pcap")) {
+            handle_capture_control(sock, uri);
+        }
+#endif
+        else if (uri_path_is(uri, "/debug/modbus")) {
+            handle_modbus_control(sock, uri);
         }
         else {
             send_http_response(sock, "404 Not Found", "text/plain", "Not Found");
@@ -151,48 +1140,161 @@ void process_http_request(uint8_t sock, char *request, uint16_t len) {
     }
 }
 
+#if TUNNEL_ENABLE
 /**
- * HTTP server loop
+ * Serve a request that arrived through the hub tunnel (tunnel handler)
  */
-void http_server_run(uint8_t sock) {
-    uint8_t status = getSn_SR(sock);
-    uint16_t size = 0;
-    uint8_t buffer[MAX_HTTP_BUF];
+void on_tunnel_request(char *request, uint16_t len) {
+    uint8_t prev = cpu_enter(CPU_HTTP);
 
-    switch (status) {
-        case SOCK_ESTABLISHED:
-            // Check if data is available
-            if ((size = getSn_RX_RSR(sock)) > 0) {
-                if (size > MAX_HTTP_BUF) size = MAX_HTTP_BUF;
+    process_http_request(TUNNEL_SOCKET, request, len);
+    cpu_leave(prev);
+    if (!(g_http_pending & (1u << TUNNEL_SOCKET))) tunnel_end_response();
+}
 
-                // Receive HTTP request
-                recv(sock, buffer, size);
-                buffer[size] = '\0';
+/**
+ * Telemetry acknowledgements and time sync from the hub (tunnel control handler)
+ */
+void on_tunnel_control(uint8_t type, uint32_t value) {
+    if (type == TUNNEL_ACK) telemetry_ack(value);
+    else if (type == TUNNEL_TIME) telemetry_set_time(value);
+}
+#endif
 
-                // Process request
-                process_http_request(sock, (char*)buffer, size);
+/**
+ * Read the request and route it; the response is queued for http_conn
+ */
+void http_conn_request(uint8_t sock) {
+    uint16_t size = getSn_RX_RSR(sock);
 
-                // Close connection
-                disconnect(sock);
-            }
-            break;
+    if (size > MAX_HTTP_BUF) size = MAX_HTTP_BUF;
+    recv(sock, g_http_rx, size);
+    g_http_rx[size] = '\0';
+    CAPTURE_TCP(sock, CAPTURE_RX, g_http_rx, size);
+
+    // Per-IP admission: a client over its rate gets no routing at all
+    if (!clients_admit(sock, size)) {
+        static const char limited[] =
+            "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\n"
+            "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        http_send(sock, limited, sizeof(limited) - 1);
+        return;
+    }
+
+    uint8_t prev = cpu_enter(CPU_HTTP);
+    process_http_request(sock, (char *)g_http_rx, size);
+    cpu_leave(prev);
+}
+
+/**
+ * HTTP connection coroutine: one per socket, accept / request / response
+ * (or stream) / close, forever
+ */
+int http_conn(coro_t *co) {
+    http_conn_t *c = co->frame;
+
+    CORO_BEGIN(co);
+    for (;;) {
+        g_http_pending &= ~(1u << c->sock);
+        g_http_stream &= ~(1u << c->sock);
+        c->closing = 0;
 
-        case SOCK_CLOSE_WAIT:
-            disconnect(sock);
-            break;
+        if (socket(c->sock, Sn_MR_TCP, HTTP_PORT, 0) != c->sock || listen(c->sock) != SOCK_OK) {
+            CORO_SLEEP(co, 100);
+            continue;
+        }
+        CORO_AWAIT_CONNECT(co, c->sock, 0);
+
+        // Idle clients would hold the socket forever
+        CORO_AWAIT_READABLE(co, c->sock, HTTP_REQUEST_TIMEOUT_MS);
+        if (getSn_RX_RSR(c->sock) > 0) http_conn_request(c->sock);
+
+        // Deferred response: wait for the background job or the client to leave
+        while (g_http_pending & (1u << c->sock)) {
+            if (http_deferred_service(c->sock)) break;
+            CORO_AWAIT_EVENT(co, CORO_EV_BENCH, c->sock, 0);
+            if (getSn_SR(c->sock) != SOCK_ESTABLISHED) break;
+        }
 
-        case SOCK_INIT:
-            listen(sock);
-            printf("HTTP Server listening on port %d\n", HTTP_PORT);
-            break;
+        // Queued response: each chunk once the TX buffer has room for it
+        while (http_tx_pending(c->sock)) {
+            CORO_AWAIT_WRITABLE(co, c->sock, http_tx_chunk(c->sock), HTTP_SEND_TIMEOUT_MS);
+            if (co->timed_out) break;
+            if (http_tx_flush(c->sock) == SOCK_BUSY) CORO_YIELD(co);
+        }
+        http_tx_reset(c->sock);
 
-        case SOCK_CLOSED:
-            socket(sock, Sn_MR_TCP, HTTP_PORT, 0);
-            break;
+        // Server-sent events: relay state on every change, keepalive when idle
+        if (g_http_stream & (1u << c->sock)) {
+            c->keepalive = 0;
+            while (!c->closing) {
+                for (;;) {
+                    CORO_AWAIT_WRITABLE(co, c->sock, HTTP_SSE_MAX_EVENT, HTTP_SSE_KEEPALIVE_MS);
+                    if (co->timed_out || getSn_SR(c->sock) != SOCK_ESTABLISHED) {
+                        c->closing = 1;
+                        break;
+                    }
+                    if (http_sse_send(c->sock, c->keepalive) != SOCK_BUSY) break;
+                    CORO_YIELD(co);
+                }
+                if (c->closing) break;
 
-        default:
-            break;
+                CORO_AWAIT_EVENT(co, CORO_EV_RELAYS, c->sock, HTTP_SSE_KEEPALIVE_MS);
+                c->keepalive = co->timed_out;
+                if (getSn_SR(c->sock) != SOCK_ESTABLISHED) c->closing = 1;
+            }
+        }
+
+        disconnect(c->sock);
     }
+    CORO_END(co);
+}
+
+/**
+ * Start one connection coroutine per HTTP socket
+ */
+void http_server_init(void) {
+    for (uint8_t i = 0; i < HTTP_SOCKETS; i++) {
+        coro_t *co = coro_spawn(http_conn, sizeof(http_conn_t));
+        if (!co) break;
+        ((http_conn_t *)co->frame)->sock = HTTP_SOCKET + i;
+        coro_watch(HTTP_SOCKET + i);
+    }
+    printf("HTTP Server listening on port %d (%d connections)\n", HTTP_PORT, HTTP_SOCKETS);
+}
+
+/**
+ * Connection coroutines and the tunnel (scheduler task)
+ */
+void net_task(void) {
+    coro_run();
+#if TUNNEL_ENABLE
+    tunnel_service();
+    if (http_deferred_service(TUNNEL_SOCKET)) tunnel_end_response();
+#endif
+}
+
+/**
+ * RP2350 die temperature in 0.1 C (on-chip sensor: 0.706 V at 27 C, -1.721 mV/C)
+ */
+int32_t read_chip_temp_dc(void) {
+    adc_select_input(ADC_TEMPERATURE_CHANNEL_NUM);
+    int32_t uv = (int32_t)((int64_t)adc_read() * 3300000 / 4096);
+    return 270 - (uv - 706000) * 10 / 1721;
+}
+
+/**
+ * Periodic history and telemetry samples (scheduler task)
+ */
+void sample_task(void) {
+    int32_t temp = read_chip_temp_dc();
+
+    history_record(HIST_RELAYS, get_relay_mask());
+    history_record(HIST_INPUTS, di_sampler_state());
+    history_record(HIST_TEMP_DC, temp);
+    telemetry_put(HIST_RELAYS, TELEMETRY_SAMPLE, get_relay_mask());
+    telemetry_put(HIST_INPUTS, TELEMETRY_SAMPLE, di_sampler_state());
+    telemetry_put(HIST_TEMP_DC, TELEMETRY_SAMPLE, temp);
 }
 
 /**
@@ -237,22 +1339,69 @@ int main() {
     network_initialize(net_info);
     print_network_information(net_info);
 
+    // Cycle accounting; hooks the W5500 chip select set up above
+    cpu_init();
+
     // 4. Initialize relays
     printf("\nInitializing relays...\n");
     relay_init();
+    input_init();
+    di_sampler_init();
+    modbus_init();
+
+    // 5. Initialize history (die temperature is sampled with the relay state)
+    history_init();
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+    di_sampler_subscribe(on_input_edge);
+    modbus_pzem_subscribe(on_pzem_reading);
+    relay_test_init();
+#if ZC_ENABLE
+    // Claims the detector DI before anyone sees its edges
+    zc_init();
+#endif
+    cmd_bus_init();
+    cmd_bus_subscribe(on_relay_change);
+
+    // Peer links mirror DI edges and relay changes to other boards
+    peer_init();
+    di_sampler_subscribe(peer_on_input_edge);
+    cmd_bus_subscribe(peer_on_relay_change);
 
-    // 5. Initialize HTTP server socket
+#if TUNNEL_ENABLE
+    // Outbound hub connection: API and telemetry without inbound ports
+    tunnel_init(on_tunnel_request, on_tunnel_control);
+    telemetry_init(tunnel_event, tunnel_connected);
+#else
+    telemetry_init(NULL, NULL);
+#endif
+
+    // 6. Start HTTP connection coroutines
     printf("\nStarting HTTP server...\n");
-    socket(HTTP_SOCKET, Sn_MR_TCP, HTTP_PORT, 0);
+    coro_init();
+    page_init();
+    http_server_init();
 
     printf("\n========================================\n");
     printf("Server ready!\n");
     printf("Open browser: http://%d.%d.%d.%d\n", ip[0], ip[1], ip[2], ip[3]);
     printf("========================================\n\n");
 
-    // 6. Main server loop
+    // 7. Background services: period and run-time budget in us, CPU subsystem.
+    // Input edges are recorded as they arrive, samples periodically (first one now)
+    sched_periodic("net",        net_task,             SCHED_TICK_US, 1000, CPU_NET);
+    sched_periodic("cmd_bus",    cmd_bus_service,      SCHED_TICK_US, 200, CPU_OTHER);
+    sched_periodic("di",         di_sampler_service,   SCHED_TICK_US, 200, CPU_SENSOR);
+    sched_periodic("peer",       peer_service,         SCHED_TICK_US, 500, CPU_NET);
+    sched_periodic("modbus",     modbus_service,       SCHED_TICK_US, 200, CPU_SENSOR);
+    sched_periodic("relay_test", relay_test_service,   SCHED_TICK_US, 100, CPU_SENSOR);
+    sched_periodic("bench",      bench_service,        SCHED_TICK_US, BENCH_SLICE_US + 500, CPU_OTHER);
+    sched_periodic("telemetry",  telemetry_service,    10 * SCHED_TICK_US, 1000, CPU_OTHER);
+    sched_periodic("sample",     sample_task,          HISTORY_SAMPLE_MS * 1000u, 500, CPU_OTHER);
+    sched_periodic("cpu",        cpu_tick,             1000000, 50, CPU_OTHER);
+
     while (1) {
-        http_server_run(HTTP_SOCKET);
+        sched_run();
     }
 
     return 0;
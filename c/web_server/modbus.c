@@ -0,0 +1,499 @@
+/**
+ * Modbus RTU Bus Capture and Timing Analyzer
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Passively listens on the meter UART while the server keeps running.
+ * Every received byte is timestamped in the RX interrupt (FIFO off, so
+ * one interrupt per byte), frames are split on T3.5 silence and checked
+ * with the table-driven CRC. A frame from a slave address that follows
+ * a request to the same address is paired as its response.
+ *
+ * With PZEM_POLL_MS set (off by default) the board is not passive: the
+ * receiver runs from boot and polls the PZEM-004T itself. The FIFO is
+ * switched on just for the request, whose 8 bytes go into it at once and
+ * leave back to back whatever the main loop does meanwhile; bytes read
+ * in one interrupt then get timestamps spaced one character apart. The
+ * response goes through the same framing before its registers are
+ * decoded for subscribers. Capture only decides whether frames and per-slave
+ * statistics are recorded, so starting or stopping it never interrupts
+ * the meter readings.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "hardware/gpio.h"
+
+#include "config.h"
+#include "modbus.h"
+#include "cpu.h"
+#include "fmt.h"
+
+typedef struct {
+    uint32_t t_us;
+    uint8_t b;
+} modbus_byte_t;
+
+typedef struct {
+    uint32_t t_start_us;
+    uint32_t t_end_us;
+    uint32_t gap_us;        // Silence before the frame
+    uint16_t len;
+    uint8_t crc_ok;
+    uint8_t data[MODBUS_FRAME_STORE];
+} modbus_frame_t;
+
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} stat_t;
+
+typedef struct {
+    uint8_t addr;           // 0 = unused slot
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t exceptions;
+    stat_t resp_us;         // End of request -> start of response
+} modbus_slave_t;
+
+// CRC-16/MODBUS (poly 0xA001 reflected)
+static const uint16_t crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+static modbus_byte_t g_bytes[MODBUS_BYTE_RING];
+static volatile uint16_t g_bytes_head;  // Written by IRQ
+static volatile uint16_t g_bytes_tail;  // Read by main loop
+
+static modbus_frame_t g_frames[MODBUS_CAPTURE_FRAMES];
+static uint16_t g_frames_head;
+static uint16_t g_frames_count;
+static modbus_slave_t g_slaves[MODBUS_MAX_SLAVES];
+
+// Frame being assembled
+static uint8_t g_cur[256];
+static uint16_t g_cur_len;
+static uint32_t g_cur_start_us;
+static uint32_t g_cur_last_us;
+static uint32_t g_prev_end_us;
+
+// Request waiting for its response
+static struct {
+    uint8_t active;
+    uint8_t addr;
+    uint32_t t_end_us;
+} g_pending;
+
+static uint8_t g_rx_on;                 // UART receiver and framing running
+static uint8_t g_enabled;               // Capture: frames and slave statistics recorded
+static uint32_t g_baud = MODBUS_BAUD;
+static uint32_t g_t35_us;
+static uint32_t g_char_us;
+static uint32_t g_byte_count;
+static uint32_t g_frame_count;
+static uint32_t g_crc_errors;
+static volatile uint32_t g_overruns;
+
+// PZEM poller
+static modbus_pzem_handler_t g_pzem_handler;
+static uint8_t g_poll_req[8];
+static uint8_t g_poll_tx;               // Request in the TX FIFO, FIFO on
+static uint32_t g_poll_ms;
+static uint32_t g_pzem_readings;
+
+static void modbus_rx_start(uint32_t baud);
+
+/**
+ * CRC-16/MODBUS, table driven
+ */
+uint16_t modbus_crc16(const uint8_t *data, uint16_t len) {
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc = (crc >> 8) ^ crc_table[(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+static void stat_add(stat_t *s, uint32_t v) {
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (s->n == 0 || v > s->max) s->max = v;
+    s->sum += v;
+    s->n++;
+}
+
+/**
+ * UART RX interrupt: timestamp each byte. With the FIFO on several bytes
+ * arrive together; the last one ended now, earlier ones a character apart
+ */
+static void modbus_uart_irq(void) {
+    uint8_t prev = cpu_enter(CPU_IRQ);
+    uint8_t buf[32];
+    uint8_t n = 0;
+    uint32_t now = time_us_32();
+
+    while (uart_is_readable(MODBUS_UART) && n < sizeof(buf)) buf[n++] = uart_getc(MODBUS_UART);
+
+    for (uint8_t i = 0; i < n; i++) {
+        uint16_t next = (g_bytes_head + 1) % MODBUS_BYTE_RING;
+
+        if (next == g_bytes_tail) {
+            g_overruns++;
+            continue;
+        }
+        g_bytes[g_bytes_head].t_us = now - (n - 1 - i) * g_char_us;
+        g_bytes[g_bytes_head].b = buf[i];
+        g_bytes_head = next;
+    }
+    cpu_leave(prev);
+}
+
+/**
+ * Configure meter UART pins (capture stays off until started)
+ */
+void modbus_init(void) {
+    uart_init(MODBUS_UART, MODBUS_BAUD);
+    gpio_set_function(MODBUS_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(MODBUS_RX_PIN, GPIO_FUNC_UART_AUX);
+    irq_set_exclusive_handler(UART_IRQ_NUM(MODBUS_UART), modbus_uart_irq);
+
+    printf("Modbus UART ready (TX=%d, RX=%d)\n", MODBUS_TX_PIN, MODBUS_RX_PIN);
+
+    if (PZEM_POLL_MS) {
+        // Read input registers 0..9: V, I, P, E, F, PF, alarm
+        static const uint8_t req[6] = {PZEM_ADDR, 0x04, 0x00, 0x00, 0x00, 0x0A};
+        uint16_t crc = modbus_crc16(req, sizeof(req));
+        memcpy(g_poll_req, req, sizeof(req));
+        g_poll_req[6] = crc & 0xFF;
+        g_poll_req[7] = crc >> 8;
+        modbus_rx_start(MODBUS_BAUD);
+    }
+}
+
+/**
+ * Register handler for decoded PZEM readings
+ */
+void modbus_pzem_subscribe(modbus_pzem_handler_t handler) {
+    g_pzem_handler = handler;
+}
+
+static modbus_slave_t *modbus_slave(uint8_t addr) {
+    modbus_slave_t *free_slot = NULL;
+
+    for (int i = 0; i < MODBUS_MAX_SLAVES; i++) {
+        if (g_slaves[i].addr == addr) return &g_slaves[i];
+        if (!g_slaves[i].addr && !free_slot) free_slot = &g_slaves[i];
+    }
+    if (free_slot) {
+        memset(free_slot, 0, sizeof(*free_slot));
+        free_slot->addr = addr;
+    }
+    return free_slot;
+}
+
+/**
+ * Decode a PZEM-004T v3 input register response (10 registers, 32-bit
+ * values low word first)
+ */
+static void modbus_pzem_decode(const uint8_t *f, uint16_t len) {
+    if (PZEM_POLL_MS == 0 || !g_pzem_handler) return;
+    if (len != 25 || f[0] != PZEM_ADDR || f[1] != 0x04 || f[2] != 20) return;
+
+    pzem_reading_t r;
+    r.voltage_dv = (f[3] << 8) | f[4];
+    r.current_ma = (f[5] << 8) | f[6] | ((uint32_t)f[7] << 24) | ((uint32_t)f[8] << 16);
+    r.power_dw = (f[9] << 8) | f[10] | ((uint32_t)f[11] << 24) | ((uint32_t)f[12] << 16);
+    r.energy_wh = (f[13] << 8) | f[14] | ((uint32_t)f[15] << 24) | ((uint32_t)f[16] << 16);
+    r.freq_dhz = (f[17] << 8) | f[18];
+    r.pf_pct = (f[19] << 8) | f[20];
+    g_pzem_readings++;
+    g_pzem_handler(&r);
+}
+
+/**
+ * Close the frame being assembled: pair it with its request (always,
+ * the poller depends on it), record it and its timing while capturing
+ */
+static void modbus_end_frame(void) {
+    uint8_t crc_ok = g_cur_len >= 4 &&
+                     modbus_crc16(g_cur, g_cur_len) == 0;   // CRC over data+CRC is 0
+    modbus_slave_t *slave = NULL;
+
+    if (g_enabled) {
+        modbus_frame_t *f = &g_frames[g_frames_head];
+
+        f->t_start_us = g_cur_start_us;
+        f->t_end_us = g_cur_last_us;
+        f->gap_us = g_cur_start_us - g_prev_end_us;
+        f->len = g_cur_len;
+        f->crc_ok = crc_ok;
+        memcpy(f->data, g_cur, g_cur_len < MODBUS_FRAME_STORE ? g_cur_len : MODBUS_FRAME_STORE);
+
+        g_frames_head = (g_frames_head + 1) % MODBUS_CAPTURE_FRAMES;
+        if (g_frames_count < MODBUS_CAPTURE_FRAMES) g_frames_count++;
+        g_frame_count++;
+        if (!crc_ok) g_crc_errors++;
+    }
+    g_prev_end_us = g_cur_last_us;
+
+    if (crc_ok) {
+        uint8_t addr = g_cur[0];
+
+        if (g_enabled) slave = modbus_slave(addr);
+        if (g_pending.active && g_pending.addr == addr) {
+            // Same address right after a request: the slave's response
+            if (slave) {
+                slave->responses++;
+                if (g_cur[1] & 0x80) slave->exceptions++;
+                stat_add(&slave->resp_us, g_cur_start_us - g_pending.t_end_us);
+            }
+            g_pending.active = 0;
+            modbus_pzem_decode(g_cur, g_cur_len);
+        } else {
+            if (slave) slave->requests++;
+            g_pending.active = 1;
+            g_pending.addr = addr;
+            g_pending.t_end_us = g_cur_last_us;
+        }
+    }
+    g_cur_len = 0;
+}
+
+/**
+ * Run the receiver at the given baud rate, framing from a clean state
+ */
+static void modbus_rx_start(uint32_t baud) {
+    uart_set_irq_enables(MODBUS_UART, false, false);
+
+    g_baud = baud;
+    uart_set_baudrate(MODBUS_UART, g_baud);
+    // One interrupt per byte for per-byte timestamps
+    uart_set_fifo_enabled(MODBUS_UART, false);
+
+    // T3.5: 3.5 characters of 11 bits, fixed 1750 us above 19200 baud
+    g_t35_us = (g_baud > 19200) ? 1750 : (uint32_t)(38500000ull / g_baud);
+    g_char_us = 11000000u / g_baud;
+    g_poll_tx = 0;
+
+    g_cur_len = 0;
+    g_pending.active = 0;
+    g_bytes_tail = g_bytes_head;
+    g_prev_end_us = time_us_32();
+    g_rx_on = 1;
+
+    irq_set_enabled(UART_IRQ_NUM(MODBUS_UART), true);
+    uart_set_irq_enables(MODBUS_UART, true, false);
+}
+
+/**
+ * Start capturing at the given baud rate (0 = current). While the PZEM
+ * poller owns the bus the rate is fixed and a poll in flight is left
+ * alone; returns 0 if baud conflicts with it
+ */
+int modbus_capture_start(uint32_t baud) {
+    if (PZEM_POLL_MS && baud && baud != MODBUS_BAUD) return 0;
+    if (!baud) baud = g_rx_on ? g_baud : MODBUS_BAUD;
+
+    memset(g_frames, 0, sizeof(g_frames));
+    memset(g_slaves, 0, sizeof(g_slaves));
+    g_frames_head = g_frames_count = 0;
+    g_byte_count = g_frame_count = g_crc_errors = g_overruns = 0;
+    if (!g_rx_on || baud != g_baud) modbus_rx_start(baud);
+    g_enabled = 1;
+
+    printf("Modbus capture started (%lu baud, T3.5 %lu us)\n",
+           (unsigned long)g_baud, (unsigned long)g_t35_us);
+    return 1;
+}
+
+/**
+ * Stop capturing, keep results; the receiver keeps running for the poller
+ */
+void modbus_capture_stop(void) {
+    if (g_enabled && g_cur_len) modbus_end_frame();
+    g_enabled = 0;
+    if (PZEM_POLL_MS) return;
+    uart_set_irq_enables(MODBUS_UART, false, false);
+    g_rx_on = 0;
+}
+
+/**
+ * Send the PZEM request through the TX FIFO in one go; FIFO off again
+ * once it is on the wire
+ */
+static void modbus_poll_service(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if (g_poll_tx) {
+        if (uart_get_hw(MODBUS_UART)->fr & UART_UARTFR_BUSY_BITS) return;
+        // Bytes still in the RX FIFO would be flushed with it
+        if (uart_is_readable(MODBUS_UART)) return;
+        uart_set_fifo_enabled(MODBUS_UART, false);
+        g_poll_tx = 0;
+        return;
+    }
+    // Don't talk over a frame in progress or an unanswered request
+    if (now - g_poll_ms < PZEM_POLL_MS || g_cur_len || g_pending.active) return;
+    g_poll_ms = now;
+
+    // 8 bytes fit the 32-byte FIFO: never waits
+    uart_set_fifo_enabled(MODBUS_UART, true);
+    uart_write_blocking(MODBUS_UART, g_poll_req, sizeof(g_poll_req));
+    g_poll_tx = 1;
+
+    // Response time counts from the end of the last character on the wire
+    g_pending.active = 1;
+    g_pending.addr = PZEM_ADDR;
+    g_pending.t_end_us = time_us_32() + sizeof(g_poll_req) * g_char_us;
+    modbus_slave_t *slave = g_enabled ? modbus_slave(PZEM_ADDR) : NULL;
+    if (slave) slave->requests++;
+}
+
+/**
+ * Split buffered bytes into frames (main loop)
+ */
+void modbus_service(void) {
+    if (!g_rx_on) return;
+    if (PZEM_POLL_MS) modbus_poll_service();
+
+    while (g_bytes_tail != g_bytes_head) {
+        modbus_byte_t e = g_bytes[g_bytes_tail];
+        g_bytes_tail = (g_bytes_tail + 1) % MODBUS_BYTE_RING;
+        if (g_enabled) g_byte_count++;
+
+        if (g_cur_len && e.t_us - g_cur_last_us > g_t35_us) modbus_end_frame();
+        if (g_cur_len == 0) g_cur_start_us = e.t_us;
+        if (g_cur_len < sizeof(g_cur)) g_cur[g_cur_len++] = e.b;
+        g_cur_last_us = e.t_us;
+    }
+
+    uint32_t now = time_us_32();
+
+    // Bus silent for T3.5: the frame is complete
+    if (g_cur_len && now - g_cur_last_us > g_t35_us) modbus_end_frame();
+
+    if (g_pending.active && now - g_pending.t_end_us > MODBUS_RESPONSE_TIMEOUT_MS * 1000u) {
+        modbus_slave_t *slave = g_enabled ? modbus_slave(g_pending.addr) : NULL;
+        if (slave) slave->timeouts++;
+        g_pending.active = 0;
+    }
+}
+
+/**
+ * Render capture, per-slave statistics and recent frames as JSON
+ */
+void modbus_capture_json(char *buffer, size_t bufsize) {
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_char(&f, '{');
+    fmt_key(&f, "enabled");
+    fmt_bool(&f, g_enabled);
+    fmt_key(&f, "polling");
+    fmt_bool(&f, PZEM_POLL_MS != 0);
+    fmt_key(&f, "baud");
+    fmt_u32(&f, g_baud);
+    fmt_key(&f, "t35_us");
+    fmt_u32(&f, g_t35_us);
+    fmt_key(&f, "bytes");
+    fmt_u32(&f, g_byte_count);
+    fmt_key(&f, "frames");
+    fmt_u32(&f, g_frame_count);
+    fmt_key(&f, "crc_errors");
+    fmt_u32(&f, g_crc_errors);
+    fmt_key(&f, "overruns");
+    fmt_u32(&f, g_overruns);
+    fmt_key(&f, "pzem_readings");
+    fmt_u32(&f, g_pzem_readings);
+    fmt_key(&f, "slaves");
+    fmt_char(&f, '[');
+
+    for (int i = 0; i < MODBUS_MAX_SLAVES; i++) {
+        const modbus_slave_t *s = &g_slaves[i];
+        if (!s->addr) continue;
+        fmt_sep(&f);
+        fmt_char(&f, '{');
+        fmt_key(&f, "addr");
+        fmt_u32(&f, s->addr);
+        fmt_key(&f, "requests");
+        fmt_u32(&f, s->requests);
+        fmt_key(&f, "responses");
+        fmt_u32(&f, s->responses);
+        fmt_key(&f, "timeouts");
+        fmt_u32(&f, s->timeouts);
+        fmt_key(&f, "exceptions");
+        fmt_u32(&f, s->exceptions);
+        fmt_key(&f, "resp_us");
+        fmt_char(&f, '[');
+        fmt_u32(&f, s->resp_us.min);
+        fmt_char(&f, ',');
+        fmt_u32(&f, s->resp_us.n ? s->resp_us.sum / s->resp_us.n : 0);
+        fmt_char(&f, ',');
+        fmt_u32(&f, s->resp_us.max);
+        fmt_str(&f, "]}");
+    }
+    fmt_str(&f, "],\"recent\":[");
+
+    // Oldest first
+    for (uint16_t i = 0; i < g_frames_count; i++) {
+        const modbus_frame_t *fr =
+            &g_frames[(g_frames_head + MODBUS_CAPTURE_FRAMES - g_frames_count + i) % MODBUS_CAPTURE_FRAMES];
+        uint16_t stored = fr->len < MODBUS_FRAME_STORE ? fr->len : MODBUS_FRAME_STORE;
+
+        // Leave room for the closing brackets
+        if (f.len + 128 + stored * 2 >= bufsize) break;
+
+        fmt_sep(&f);
+        fmt_char(&f, '{');
+        fmt_key(&f, "t_us");
+        fmt_u32(&f, fr->t_start_us);
+        fmt_key(&f, "gap_us");
+        fmt_u32(&f, fr->gap_us);
+        fmt_key(&f, "dur_us");
+        fmt_u32(&f, fr->t_end_us - fr->t_start_us);
+        fmt_key(&f, "len");
+        fmt_u32(&f, fr->len);
+        fmt_key(&f, "crc");
+        fmt_bool(&f, fr->crc_ok);
+        fmt_key(&f, "hex");
+        fmt_char(&f, '"');
+        fmt_hex_bytes(&f, fr->data, stored);
+        fmt_str(&f, "\"}");
+    }
+    fmt_str(&f, "]}");
+}
@@ -0,0 +1,32 @@
+/**
+ * Modbus RTU Bus Capture and Timing Analyzer
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _MODBUS_H_
+#define _MODBUS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Decoded PZEM-004T reading (meter's native fixed-point units)
+typedef struct {
+    int32_t voltage_dv;     // 0.1 V
+    int32_t current_ma;
+    int32_t power_dw;       // 0.1 W
+    int32_t energy_wh;
+    int32_t freq_dhz;       // 0.1 Hz
+    int32_t pf_pct;         // Power factor x100
+} pzem_reading_t;
+
+typedef void (*modbus_pzem_handler_t)(const pzem_reading_t *r);
+
+uint16_t modbus_crc16(const uint8_t *data, uint16_t len);
+void modbus_init(void);
+int modbus_capture_start(uint32_t baud);
+void modbus_capture_stop(void);
+void modbus_service(void);
+void modbus_pzem_subscribe(modbus_pzem_handler_t handler);
+void modbus_capture_json(char *buffer, size_t bufsize);
+
+#endif /* _MODBUS_H_ */
@@ -0,0 +1,682 @@
+/**
+ * Peer Links (board-to-board relay mirroring)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Local DI edges and relay changes are mirrored to relays on peer boards
+ * over UDP, without a server in the path. Every datagram carries the full
+ * mirrored state (mask + value), so retries and heartbeats are idempotent.
+ * Datagrams are tagged with SipHash-2-4 under the shared PEER_KEY and
+ * carry a boot id and sequence number against replay.
+ *
+ * A boot id alone can't tell a peer's new boot from a frame captured
+ * during an earlier one, so each board also keeps a random challenge per
+ * peer and sends it in every datagram. State and heartbeats are applied
+ * only when they echo the receiver's current challenge, and the receiver
+ * draws a new one whenever it accepts a new boot id: frames from any
+ * earlier exchange carry a stale echo and are dropped.
+ *
+ * State changes are acked by the receiver after the relay write and
+ * resent every PEER_RETRY_MS until acked. Heartbeats repeat the current
+ * state; a receiver that hears nothing from a peer for
+ * PEER_LINK_TIMEOUT_MS forces the relays that peer drives to
+ * PEER_FAILSAFE_STATE.
+ *
+ * The W5500 resolves ARP on every UDP SEND and keeps the socket busy
+ * until the retransmit timeout if nobody answers, which would stall
+ * every other peer behind one dead board. A peer's MAC is therefore
+ * resolved on a separate socket (PEER_ARP_SOCKET) and cached from
+ * Sn_DHAR; datagrams to resolved peers leave PEER_SOCKET with SEND_MAC,
+ * without ARP. The MAC is re-resolved every PEER_ARP_REFRESH_MS and
+ * dropped when the link goes down.
+ *
+ * Edge-to-remote-relay latency is estimated per acked state change that
+ * went out on the first try: local event -> send, plus half the network
+ * round trip, plus the receiver's datagram -> relay write time, which it
+ * reports in the ACK.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+
+#include "socket.h"
+
+#include "config.h"
+#include "peer.h"
+#include "fmt.h"
+#include "cmd_bus.h"
+#include "di_sampler.h"
+
+#define PEER_MAGIC      0xA5
+#define PEER_MSG_STATE  1       // Mirrored state change, acked
+#define PEER_MSG_HB     2       // Heartbeat with current state, not acked
+#define PEER_MSG_ACK    3       // boot/seq/t_us echo the acked message
+
+#define PEER_SEND_WAIT_US   500     // Max wait for the previous datagram to leave
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t type;
+    uint8_t mask;           // Remote relays driven by the sender
+    uint8_t value;          // Requested state (ACK: state actually applied)
+    uint32_t boot;          // Sender boot id
+    uint32_t seq;
+    uint32_t t_us;          // Local event time, echoed in the ACK
+    uint32_t chal;          // Sender's challenge, to be echoed back
+    uint32_t echo;          // Receiver's challenge as last seen by the sender
+    uint32_t apply_us;      // ACK: datagram read -> relays written
+    uint8_t tag[8];         // SipHash-2-4 over the fields above
+} peer_msg_t;
+
+typedef struct {
+    uint8_t ip[4];          // 0.0.0.0 = unused entry
+    uint8_t di_mask;        // Local DIs mirrored, bit n -> remote relay n
+    uint8_t relay_mask;     // Local relays mirrored, bit n -> remote relay n
+} peer_config_t;
+
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} stat_t;
+
+typedef struct {
+    // Outbound
+    peer_msg_t pending;     // Last state message, resent until acked
+    uint8_t pending_active;
+    uint8_t retries;
+    uint8_t timed;          // Pending went out on the first try at tx_us
+    uint32_t tx_us;
+    uint8_t sent_value;
+    uint32_t sent_ms;
+    uint32_t hb_ms;
+    uint32_t peer_chal;     // Challenge to echo in datagrams to this peer
+    uint8_t mac[6];         // Cached from ARP, used with SEND_MAC
+    uint8_t mac_valid;
+    uint32_t arp_ms;        // Last resolve started
+    // Inbound
+    uint32_t chal;          // Our challenge for this peer
+    uint32_t rx_boot;
+    uint32_t rx_seq;
+    uint8_t rx_mask;        // Local relays this peer drives
+    uint8_t link_up;
+    uint32_t last_rx_ms;
+    // Statistics
+    uint32_t tx;
+    uint32_t rx;
+    uint32_t acks;
+    uint32_t retries_total;
+    uint32_t lost;          // State messages never acked
+    uint32_t dups;
+    uint32_t replays;
+    uint32_t resyncs;       // Dropped for a stale challenge echo
+    uint32_t auth_fail;
+    uint32_t failsafes;
+    uint32_t arp_timeouts;
+    stat_t lat_us;          // Local event -> ack (remote relay written)
+    stat_t rtt_us;          // Send -> ack, less the receiver's processing
+    stat_t relay_us;        // Local event -> remote relay written (estimate)
+} peer_t;
+
+static const peer_config_t g_config[PEER_MAX] = PEER_TABLE;
+static const uint8_t g_key[16] = PEER_KEY;
+
+static peer_t g_peers[PEER_MAX];
+static uint32_t g_boot;
+static uint32_t g_seq;
+static uint8_t g_inputs;
+static uint8_t g_relays;
+static uint32_t g_unknown;
+static uint32_t g_send_busy;
+
+// Datagram in flight per socket: [0] PEER_SOCKET, [1] PEER_ARP_SOCKET
+static struct {
+    uint8_t busy;
+    uint8_t peer;
+} g_tx[2];
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+} while (0)
+
+static uint64_t load64_le(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+/**
+ * SipHash-2-4 of a short message under PEER_KEY
+ */
+static uint64_t siphash24(const uint8_t *in, size_t len) {
+    uint64_t k0 = load64_le(g_key);
+    uint64_t k1 = load64_le(g_key + 8);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t b = (uint64_t)len << 56;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t m = load64_le(in + i);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (size_t j = 0; i + j < len; j++) {
+        b |= (uint64_t)in[i + j] << (8 * j);
+    }
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void peer_tag(const peer_msg_t *msg, uint8_t tag[8]) {
+    uint64_t h = siphash24((const uint8_t *)msg, offsetof(peer_msg_t, tag));
+    for (int i = 0; i < 8; i++) tag[i] = h >> (8 * i);
+}
+
+/**
+ * Check tag without an early exit on the first mismatch
+ */
+static int peer_tag_ok(const peer_msg_t *msg) {
+    uint8_t tag[8];
+    uint8_t diff = 0;
+
+    peer_tag(msg, tag);
+    for (int i = 0; i < 8; i++) diff |= tag[i] ^ msg->tag[i];
+    return diff == 0;
+}
+
+static void stat_add(stat_t *s, uint32_t v) {
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (v > s->max) s->max = v;
+    s->sum += v;
+    s->n++;
+}
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * Wait up to wait_us for the datagram in flight on socket k to leave;
+ * 0 if it is still busy. A finished send on the ARP socket caches the
+ * MAC the W5500 resolved for it (Sn_DHAR)
+ */
+static int peer_tx_idle(int k, uint32_t wait_us) {
+    uint8_t sn = k ? PEER_ARP_SOCKET : PEER_SOCKET;
+    uint32_t start = time_us_32();
+    uint8_t ir;
+
+    if (!g_tx[k].busy) return 1;
+    while (!((ir = getSn_IR(sn)) & (Sn_IR_SENDOK | Sn_IR_TIMEOUT))) {
+        if (time_us_32() - start >= wait_us) return 0;
+    }
+    setSn_IR(sn, ir & (Sn_IR_SENDOK | Sn_IR_TIMEOUT));
+    g_tx[k].busy = 0;
+
+    if (k) {
+        peer_t *p = &g_peers[g_tx[k].peer];
+        if (ir & Sn_IR_SENDOK) {
+            getSn_DHAR(sn, p->mac);
+            p->mac_valid = 1;
+        } else {
+            p->arp_timeouts++;      // Kept if cached: the link decides
+        }
+    }
+    return 1;
+}
+
+/**
+ * Send one datagram to peer idx without blocking on ARP/retransmission.
+ * Resolved peers get SEND_MAC on PEER_SOCKET; unresolved ones (and a due
+ * refresh) go through the ARP socket, so only that one waits out a dead
+ * peer. 0 if the socket to use is still busy with the previous datagram
+ */
+static int peer_send(int idx, peer_msg_t *msg) {
+    peer_t *p = &g_peers[idx];
+    int k = 0;
+
+    if (!p->mac_valid || now_ms() - p->arp_ms >= PEER_ARP_REFRESH_MS) {
+        if (getSn_SR(PEER_ARP_SOCKET) == SOCK_UDP && peer_tx_idle(1, 0)) k = 1;
+        else if (!p->mac_valid) return 0;
+    }
+
+    uint8_t sn = k ? PEER_ARP_SOCKET : PEER_SOCKET;
+    if (getSn_SR(sn) != SOCK_UDP) return 0;
+    if (!k && !peer_tx_idle(0, PEER_SEND_WAIT_US)) {
+        g_send_busy++;
+        return 0;
+    }
+
+    msg->chal = p->chal;
+    msg->echo = p->peer_chal;
+    peer_tag(msg, msg->tag);
+    setSn_DIPR(sn, (uint8_t *)g_config[idx].ip);
+    setSn_DPORT(sn, PEER_PORT);
+    if (!k) setSn_DHAR(sn, p->mac);
+    wiz_send_data(sn, (uint8_t *)msg, sizeof(*msg));
+    setSn_CR(sn, k ? Sn_CR_SEND : Sn_CR_SEND_MAC);
+    while (getSn_CR(sn));
+    g_tx[k].busy = 1;
+    g_tx[k].peer = idx;
+    if (k) p->arp_ms = now_ms();
+    return 1;
+}
+
+/**
+ * Mirrored state for a peer from the local inputs and relays
+ */
+static uint8_t peer_value(const peer_config_t *c) {
+    return (g_inputs & c->di_mask) | (g_relays & c->relay_mask);
+}
+
+/**
+ * Send new state to every peer whose mirrored value changed
+ */
+static void peer_update(uint32_t t_us) {
+    for (int i = 0; i < PEER_MAX; i++) {
+        const peer_config_t *c = &g_config[i];
+        peer_t *p = &g_peers[i];
+        uint8_t mask = c->di_mask | c->relay_mask;
+        uint8_t value = peer_value(c);
+
+        if (!c->ip[0] || !mask || value == p->sent_value) continue;
+
+        p->pending = (peer_msg_t){
+            .magic = PEER_MAGIC,
+            .type = PEER_MSG_STATE,
+            .mask = mask,
+            .value = value,
+            .boot = g_boot,
+            .seq = ++g_seq,
+            .t_us = t_us,
+        };
+        p->pending_active = 1;
+        p->retries = 0;
+        p->sent_value = value;
+        p->sent_ms = now_ms();
+        p->timed = 0;
+        if (peer_send(i, &p->pending)) {
+            p->tx++;
+            p->tx_us = time_us_32();
+            p->timed = 1;
+        }
+    }
+}
+
+/**
+ * Reset peer table and open the UDP socket
+ */
+void peer_init(void) {
+    memset(g_peers, 0, sizeof(g_peers));
+    g_boot = get_rand_32();
+    g_seq = 0;
+    g_inputs = di_sampler_state();
+    g_relays = get_relay_mask();
+
+    // Peers start from the current state on their first heartbeat
+    for (int i = 0; i < PEER_MAX; i++) {
+        g_peers[i].sent_value = peer_value(&g_config[i]);
+        g_peers[i].chal = get_rand_32();
+    }
+
+    memset(g_tx, 0, sizeof(g_tx));
+    socket(PEER_SOCKET, Sn_MR_UDP, PEER_PORT, 0);
+    socket(PEER_ARP_SOCKET, Sn_MR_UDP, PEER_PORT + 1, 0);
+    printf("Peer links on UDP port %d\n", PEER_PORT);
+}
+
+/**
+ * Mirror DI edges (DI sampler edge handler)
+ */
+void peer_on_input_edge(uint32_t t_us, uint8_t pins, uint8_t changed) {
+    g_inputs = pins;
+    peer_update(t_us);
+}
+
+/**
+ * Mirror relay changes (command bus event handler)
+ */
+void peer_on_relay_change(const cmd_event_t *ev) {
+    g_relays = ev->new_mask;
+    peer_update(time_us_32());
+}
+
+/**
+ * Apply state received from a peer to the relays it drives
+ */
+static void peer_apply(peer_t *p, uint8_t mask, uint8_t value) {
+    p->rx_mask = mask;
+    if (((get_relay_mask() ^ value) & mask) == 0) return;
+
+    cmd_bus_post(CMD_SRC_PEER, CMD_PRIO_NETWORK, value & mask, ~value & mask);
+    cmd_bus_service();
+}
+
+static void peer_send_ack(int idx, const peer_msg_t *msg, uint32_t apply_us) {
+    peer_msg_t ack = {
+        .magic = PEER_MAGIC,
+        .type = PEER_MSG_ACK,
+        .mask = msg->mask,
+        .value = get_relay_mask() & msg->mask,
+        .boot = msg->boot,
+        .seq = msg->seq,
+        .t_us = msg->t_us,
+        .apply_us = apply_us,
+    };
+    peer_send(idx, &ack);
+}
+
+/**
+ * Latency samples from the ACK of the outstanding state message. Only a
+ * first-try send is timed (a retry's ACK can't be matched to one send)
+ */
+static void peer_ack_latency(peer_t *p, const peer_msg_t *ack) {
+    uint32_t now = time_us_32();
+
+    stat_add(&p->lat_us, now - ack->t_us);
+    if (!p->timed || p->retries) return;
+
+    uint32_t flight = now - p->tx_us;
+    uint32_t rtt = flight > ack->apply_us ? flight - ack->apply_us : 0;
+    stat_add(&p->rtt_us, rtt);
+    stat_add(&p->relay_us, (p->tx_us - ack->t_us) + rtt / 2 + ack->apply_us);
+}
+
+/**
+ * Fresh datagram from a peer: keep its link up
+ */
+static void peer_alive(peer_t *p, const uint8_t ip[4]) {
+    p->last_rx_ms = now_ms();
+    if (!p->link_up) {
+        p->link_up = 1;
+        printf("Peer %d.%d.%d.%d: link up\n", ip[0], ip[1], ip[2], ip[3]);
+    }
+}
+
+static int peer_find(const uint8_t ip[4]) {
+    for (int i = 0; i < PEER_MAX; i++) {
+        if (g_config[i].ip[0] && memcmp(g_config[i].ip, ip, 4) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Handle one received datagram
+ */
+static void peer_receive(const uint8_t ip[4], const uint8_t *buf, int32_t len) {
+    uint32_t rx_us = time_us_32();
+    peer_msg_t msg;
+    int idx = peer_find(ip);
+
+    if (idx < 0) {
+        g_unknown++;
+        return;
+    }
+
+    peer_t *p = &g_peers[idx];
+    if (len != sizeof(msg)) {
+        p->auth_fail++;
+        return;
+    }
+    memcpy(&msg, buf, sizeof(msg));
+    if (msg.magic != PEER_MAGIC || !peer_tag_ok(&msg)) {
+        p->auth_fail++;
+        return;
+    }
+
+    p->rx++;
+    // Learned from any authentic frame: a stale one only delays the link
+    p->peer_chal = msg.chal;
+
+    if (msg.type == PEER_MSG_ACK) {
+        // Only acks for our current boot and outstanding message count
+        if (p->pending_active && msg.boot == g_boot && msg.seq == p->pending.seq) {
+            p->pending_active = 0;
+            p->acks++;
+            peer_ack_latency(p, &msg);
+            peer_alive(p, ip);
+        }
+        return;
+    }
+
+    if (msg.echo != p->chal) {
+        // Sender hasn't seen our current challenge yet, or a frame from an
+        // earlier exchange was replayed: send the challenge right away
+        p->resyncs++;
+        p->hb_ms = now_ms() - PEER_PROBE_MS;
+        return;
+    }
+
+    // Same boot must move forward
+    if (msg.boot == p->rx_boot && (int32_t)(msg.seq - p->rx_seq) <= 0) {
+        if (msg.type == PEER_MSG_STATE) {
+            // Late retry, state already superseded: ack, don't apply
+            p->dups++;
+            peer_send_ack(idx, &msg, 0);
+        } else {
+            p->replays++;
+        }
+        return;
+    }
+
+    if (msg.boot != p->rx_boot) {
+        // New boot window: retire the challenge it was opened with
+        p->chal = get_rand_32();
+        p->hb_ms = now_ms() - PEER_PROBE_MS;
+    }
+    p->rx_boot = msg.boot;
+    p->rx_seq = msg.seq;
+    peer_alive(p, ip);
+    peer_apply(p, msg.mask, msg.value);
+    if (msg.type == PEER_MSG_STATE) peer_send_ack(idx, &msg, time_us_32() - rx_us);
+}
+
+/**
+ * Receive, retry, heartbeat and link supervision (main loop)
+ */
+void peer_service(void) {
+    uint8_t buf[64];
+    uint8_t ip[4];
+    uint16_t port;
+
+    if (getSn_SR(PEER_SOCKET) != SOCK_UDP) {
+        socket(PEER_SOCKET, Sn_MR_UDP, PEER_PORT, 0);
+        g_tx[0].busy = 0;
+        return;
+    }
+    if (getSn_SR(PEER_ARP_SOCKET) != SOCK_UDP) {
+        socket(PEER_ARP_SOCKET, Sn_MR_UDP, PEER_PORT + 1, 0);
+        g_tx[1].busy = 0;
+    }
+    peer_tx_idle(1, 0);     // Pick up a resolved MAC
+    while (getSn_RX_RSR(PEER_ARP_SOCKET) > 0) {
+        // Replies go to PEER_PORT; anything here is stray
+        if (recvfrom(PEER_ARP_SOCKET, buf, sizeof(buf), ip, &port) <= 0) break;
+    }
+
+    while (getSn_RX_RSR(PEER_SOCKET) > 0) {
+        int32_t len = recvfrom(PEER_SOCKET, buf, sizeof(buf), ip, &port);
+        if (len <= 0) break;
+        peer_receive(ip, buf, len);
+    }
+
+    uint32_t now = now_ms();
+
+    for (int i = 0; i < PEER_MAX; i++) {
+        const peer_config_t *c = &g_config[i];
+        peer_t *p = &g_peers[i];
+        if (!c->ip[0]) continue;
+
+        if (p->pending_active && now - p->sent_ms >= PEER_RETRY_MS) {
+            if (p->retries >= PEER_MAX_RETRIES) {
+                // Give up; the next heartbeat carries the state anyway
+                p->pending_active = 0;
+                p->lost++;
+            } else {
+                p->retries++;
+                p->retries_total++;
+                p->sent_ms = now;
+                if (peer_send(i, &p->pending)) p->tx++;
+            }
+        }
+
+        // Dead peers are probed slowly so ARP timeouts don't hold the socket
+        uint32_t interval = p->link_up ? PEER_HEARTBEAT_MS : PEER_PROBE_MS;
+        if (now - p->hb_ms >= interval) {
+            peer_msg_t hb = {
+                .magic = PEER_MAGIC,
+                .type = PEER_MSG_HB,
+                .mask = c->di_mask | c->relay_mask,
+                .value = peer_value(c),
+                .boot = g_boot,
+                .seq = ++g_seq,
+                .t_us = time_us_32(),
+            };
+            p->hb_ms = now;
+            if (peer_send(i, &hb)) p->tx++;
+        }
+
+        if (p->link_up && now - p->last_rx_ms > PEER_LINK_TIMEOUT_MS) {
+            p->link_up = 0;
+            p->mac_valid = 0;       // Re-resolve: the address may have moved
+            if (p->rx_mask) {
+                cmd_bus_post(CMD_SRC_PEER, CMD_PRIO_SAFETY,
+                             PEER_FAILSAFE_STATE & p->rx_mask, ~PEER_FAILSAFE_STATE & p->rx_mask);
+                p->failsafes++;
+            }
+            printf("Peer %d.%d.%d.%d: link lost\n", c->ip[0], c->ip[1], c->ip[2], c->ip[3]);
+        }
+    }
+}
+
+static uint32_t stat_avg(const stat_t *s) {
+    return s->n ? (uint32_t)(s->sum / s->n) : 0;
+}
+
+/**
+ * Render statistic as "key":[min,avg,max]
+ */
+static void stat_json(fmt_t *f, const char *key, const stat_t *s) {
+    fmt_key(f, key);
+    fmt_char(f, '[');
+    fmt_u32(f, s->min);
+    fmt_char(f, ',');
+    fmt_u32(f, stat_avg(s));
+    fmt_char(f, ',');
+    fmt_u32(f, s->max);
+    fmt_char(f, ']');
+}
+
+/**
+ * Render peer table and link statistics as JSON
+ */
+void peer_json(char *buffer, size_t bufsize) {
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_str(&f, "{\"boot\":\"");
+    fmt_hex(&f, g_boot, 8);
+    fmt_char(&f, '"');
+    fmt_key(&f, "port");
+    fmt_u32(&f, PEER_PORT);
+    fmt_key(&f, "unknown");
+    fmt_u32(&f, g_unknown);
+    fmt_key(&f, "send_busy");
+    fmt_u32(&f, g_send_busy);
+    fmt_key(&f, "peers");
+    fmt_char(&f, '[');
+
+    for (int i = 0; i < PEER_MAX; i++) {
+        const peer_config_t *c = &g_config[i];
+        const peer_t *p = &g_peers[i];
+        if (!c->ip[0]) continue;
+
+        fmt_sep(&f);
+        fmt_str(&f, "{\"ip\":\"");
+        fmt_ip(&f, c->ip);
+        fmt_char(&f, '"');
+        fmt_key(&f, "link");
+        fmt_bool(&f, p->link_up);
+        fmt_key(&f, "di_mask");
+        fmt_u32(&f, c->di_mask);
+        fmt_key(&f, "relay_mask");
+        fmt_u32(&f, c->relay_mask);
+        fmt_key(&f, "driven_mask");
+        fmt_u32(&f, p->rx_mask);
+        fmt_key(&f, "tx");
+        fmt_u32(&f, p->tx);
+        fmt_key(&f, "rx");
+        fmt_u32(&f, p->rx);
+        fmt_key(&f, "acks");
+        fmt_u32(&f, p->acks);
+        fmt_key(&f, "retries");
+        fmt_u32(&f, p->retries_total);
+        fmt_key(&f, "lost");
+        fmt_u32(&f, p->lost);
+        fmt_key(&f, "dups");
+        fmt_u32(&f, p->dups);
+        fmt_key(&f, "replays");
+        fmt_u32(&f, p->replays);
+        fmt_key(&f, "resyncs");
+        fmt_u32(&f, p->resyncs);
+        fmt_key(&f, "auth_fail");
+        fmt_u32(&f, p->auth_fail);
+        fmt_key(&f, "failsafes");
+        fmt_u32(&f, p->failsafes);
+        fmt_key(&f, "mac");
+        fmt_bool(&f, p->mac_valid);
+        fmt_key(&f, "arp_timeouts");
+        fmt_u32(&f, p->arp_timeouts);
+        stat_json(&f, "lat_us", &p->lat_us);
+        stat_json(&f, "rtt_us", &p->rtt_us);
+        stat_json(&f, "relay_us", &p->relay_us);
+        fmt_char(&f, '}');
+    }
+    fmt_str(&f, "]}");
+}
+
+/**
+ * Render per-peer link statistics in Prometheus text format
+ */
+void peer_metrics(fmt_t *f) {
+    for (int i = 0; i < PEER_MAX; i++) {
+        const peer_config_t *c = &g_config[i];
+        const peer_t *p = &g_peers[i];
+        char ip[16];
+        fmt_t ipf;
+        if (!c->ip[0]) continue;
+
+        fmt_init(&ipf, ip, sizeof(ip));
+        fmt_ip(&ipf, c->ip);
+        fmt_metric_label(f, "peer_link_up", "peer", ip, p->link_up);
+        fmt_metric_label(f, "peer_retries_total", "peer", ip, p->retries_total);
+        fmt_metric_label(f, "peer_lost_total", "peer", ip, p->lost);
+        fmt_metric_label(f, "peer_auth_failures_total", "peer", ip, p->auth_fail);
+        fmt_metric_label(f, "peer_failsafe_total", "peer", ip, p->failsafes);
+        fmt_metric_label(f, "peer_latency_avg_us", "peer", ip, stat_avg(&p->lat_us));
+        fmt_metric_label(f, "peer_latency_max_us", "peer", ip, p->lat_us.max);
+        fmt_metric_label(f, "peer_relay_latency_avg_us", "peer", ip, stat_avg(&p->relay_us));
+        fmt_metric_label(f, "peer_relay_latency_max_us", "peer", ip, p->relay_us.max);
+        fmt_metric_label(f, "peer_rtt_avg_us", "peer", ip, stat_avg(&p->rtt_us));
+        fmt_metric_label(f, "peer_arp_timeouts_total", "peer", ip, p->arp_timeouts);
+    }
+}
@@ -0,0 +1,22 @@
+/**
+ * Peer Links (board-to-board relay mirroring)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _PEER_H_
+#define _PEER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cmd_bus.h"
+#include "fmt.h"
+
+void peer_init(void);
+void peer_service(void);
+void peer_on_input_edge(uint32_t t_us, uint8_t pins, uint8_t changed);
+void peer_on_relay_change(const cmd_event_t *ev);
+void peer_json(char *buffer, size_t bufsize);
+void peer_metrics(fmt_t *f);
+
+#endif /* _PEER_H_ */
@@ -0,0 +1,279 @@
+/**
+ * Relay Actuation Self-test (DI loopback)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * With a relay contact wired to a digital input, cycles the relay from a
+ * hardware alarm and matches the contact edges captured by the PIO DI
+ * sampler against the command times. Reports actuation delay, release
+ * delay and bounce per channel; run averages go to history as trends.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+
+#include "config.h"
+#include "history.h"
+#include "di_sampler.h"
+#include "relay_test.h"
+#include "cpu.h"
+#include "fmt.h"
+
+// Command times kept for phases not yet finalized
+#define PHASE_RING      8
+// Edges younger than this may still be in flight from the PIO FIFO
+#define EDGE_GUARD_US   100
+
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} stat_t;
+
+typedef struct {
+    uint32_t cycles;        // Completed on/off cycles
+    uint32_t missed;        // Phases without any contact edge
+    uint32_t bounces;       // Extra open/close pairs after the first edge
+    stat_t act_us;          // Command ON -> first contact edge
+    stat_t rel_us;          // Command OFF -> first contact edge
+    stat_t bounce_us;       // First -> last contact edge within a phase
+} relay_test_stats_t;
+
+static relay_test_stats_t g_stats[RELAY_COUNT];
+
+static struct {
+    volatile uint8_t active;
+    uint8_t relay;                      // 0-based
+    uint8_t di;                         // 0-based
+    uint8_t restore;                    // Relay state before the test
+    uint32_t phases_total;              // 2 per cycle
+    volatile uint32_t phases_cmd;       // Phases commanded by the alarm
+    volatile uint32_t phase_t[PHASE_RING];
+    uint32_t phases_done;               // Phases finalized by the main loop
+    // Current phase
+    uint32_t edges;
+    uint32_t first_us;
+    uint32_t last_us;
+} g_test;
+
+static void stat_add(stat_t *s, uint32_t v) {
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (s->n == 0 || v > s->max) s->max = v;
+    s->sum += v;
+    s->n++;
+}
+
+static uint32_t stat_avg(const stat_t *s) {
+    return s->n ? (uint32_t)(s->sum / s->n) : 0;
+}
+
+/**
+ * Alarm callback: drive the next phase, even phases energize the relay
+ */
+static int64_t relay_test_alarm_cb(alarm_id_t id, void *user_data) {
+    uint8_t prev = cpu_enter(CPU_IRQ);
+    uint32_t phase = g_test.phases_cmd;
+    uint8_t on = !(phase & 1);
+    int64_t next_us = 0;
+
+    if (phase >= g_test.phases_total) {
+        // Closing marker so the last phase can be finalized
+        gpio_put(RELAY_CH1 + g_test.relay, g_test.restore);
+    } else {
+        gpio_put(RELAY_CH1 + g_test.relay, on);
+        // Negative: reschedule relative to this alarm's target time, so the
+        // pulse train does not drift by the callback latency (positive is from now)
+        next_us = -(int64_t)(on ? RELAYTEST_ON_MS : RELAYTEST_OFF_MS) * 1000;
+    }
+    g_test.phase_t[phase % PHASE_RING] = time_us_32();
+    g_test.phases_cmd = phase + 1;
+
+    cpu_leave(prev);
+    return next_us;
+}
+
+static void relay_test_finish(void) {
+    relay_test_stats_t *s = &g_stats[g_test.relay];
+
+    g_test.active = 0;
+    g_relay_states[g_test.relay] = g_test.restore;
+
+    history_record(HIST_RELAY_ACT_US + g_test.relay, stat_avg(&s->act_us));
+    history_record(HIST_RELAY_REL_US + g_test.relay, stat_avg(&s->rel_us));
+    history_record(HIST_RELAY_BOUNCE_US + g_test.relay, s->bounce_us.max);
+
+    printf("Relay %d test done: act %lu us, rel %lu us, bounce max %lu us, missed %lu\n",
+           g_test.relay + 1, (unsigned long)stat_avg(&s->act_us),
+           (unsigned long)stat_avg(&s->rel_us), (unsigned long)s->bounce_us.max,
+           (unsigned long)s->missed);
+}
+
+/**
+ * Close the oldest open phase
+ */
+static void relay_test_finalize_phase(void) {
+    relay_test_stats_t *s = &g_stats[g_test.relay];
+    uint32_t phase = g_test.phases_done;
+    uint32_t t_cmd = g_test.phase_t[phase % PHASE_RING];
+
+    if (g_test.edges == 0) {
+        s->missed++;
+    } else {
+        stat_add((phase & 1) ? &s->rel_us : &s->act_us, g_test.first_us - t_cmd);
+        stat_add(&s->bounce_us, g_test.last_us - g_test.first_us);
+        s->bounces += (g_test.edges - 1) / 2;
+    }
+    if (phase & 1) s->cycles++;
+
+    g_test.edges = 0;
+    if (++g_test.phases_done >= g_test.phases_total) relay_test_finish();
+}
+
+/**
+ * Finalize every phase whose successor was commanded before t
+ */
+static void relay_test_advance(uint32_t t) {
+    while (g_test.active && g_test.phases_done + 1 < g_test.phases_cmd &&
+           (int32_t)(t - g_test.phase_t[(g_test.phases_done + 1) % PHASE_RING]) >= 0) {
+        relay_test_finalize_phase();
+    }
+}
+
+/**
+ * DI edge handler
+ */
+static void relay_test_on_edge(uint32_t t_us, uint8_t pins, uint8_t changed) {
+    if (!g_test.active || !(changed & (1u << g_test.di))) return;
+
+    relay_test_advance(t_us);
+    if (!g_test.active || g_test.phases_done >= g_test.phases_cmd) return;
+
+    // Ignore edges from before the phase was commanded
+    if ((int32_t)(t_us - g_test.phase_t[g_test.phases_done % PHASE_RING]) < 0) return;
+
+    if (g_test.edges == 0) g_test.first_us = t_us;
+    g_test.last_us = t_us;
+    g_test.edges++;
+}
+
+/**
+ * Register with the DI sampler
+ */
+void relay_test_init(void) {
+    memset(g_stats, 0, sizeof(g_stats));
+    di_sampler_subscribe(relay_test_on_edge);
+}
+
+/**
+ * Start test: relay and di are 1-based; 0 if busy or invalid, -1 if no alarm slot
+ */
+int relay_test_start(uint8_t relay, uint8_t di, uint32_t cycles) {
+    if (g_test.active || relay < 1 || relay > RELAY_COUNT || di < 1 || di > DI_COUNT ||
+        cycles < 1 || cycles > RELAYTEST_MAX_CYCLES) {
+        return 0;
+    }
+
+    memset(&g_test, 0, sizeof(g_test));
+    memset(&g_stats[relay - 1], 0, sizeof(g_stats[0]));
+    g_test.relay = relay - 1;
+    g_test.di = di - 1;
+    g_test.restore = g_relay_states[relay - 1];
+    g_test.phases_total = cycles * 2;
+    g_test.active = 1;
+
+    // Start from a released contact so the first ON is a real transition
+    gpio_put(RELAY_CH1 + g_test.relay, 0);
+    if (add_alarm_in_ms(RELAYTEST_OFF_MS, relay_test_alarm_cb, NULL, true) <= 0) {
+        gpio_put(RELAY_CH1 + g_test.relay, g_test.restore);
+        g_test.active = 0;
+        printf("Relay %d test not started: no alarm slot\n", relay);
+        return -1;
+    }
+
+    printf("Relay %d test started: DI%d, %lu cycles\n", relay, di, (unsigned long)cycles);
+    return 1;
+}
+
+/**
+ * Finalize phases that are complete (call after di_sampler_service)
+ */
+void relay_test_service(void) {
+    if (g_test.active) relay_test_advance(time_us_32() - EDGE_GUARD_US);
+}
+
+/**
+ * Measured average actuation/release delays of a relay (0-based); 0 if never tested
+ */
+int relay_test_delays(uint8_t relay, uint32_t *act_us, uint32_t *rel_us) {
+    if (relay >= RELAY_COUNT) return 0;
+
+    const relay_test_stats_t *s = &g_stats[relay];
+    if (!s->act_us.n || !s->rel_us.n) return 0;
+    *act_us = stat_avg(&s->act_us);
+    *rel_us = stat_avg(&s->rel_us);
+    return 1;
+}
+
+/**
+ * Relays currently driven by the test (bit 0 = relay 1)
+ */
+uint8_t relay_test_active_mask(void) {
+    return g_test.active ? (1u << g_test.relay) : 0;
+}
+
+/**
+ * Render statistic as "key":[min,avg,max]
+ */
+static void stat_json(fmt_t *f, const char *key, const stat_t *s) {
+    fmt_key(f, key);
+    fmt_char(f, '[');
+    fmt_u32(f, s->min);
+    fmt_char(f, ',');
+    fmt_u32(f, stat_avg(s));
+    fmt_char(f, ',');
+    fmt_u32(f, s->max);
+    fmt_char(f, ']');
+}
+
+/**
+ * Render test status and per-channel results as JSON
+ */
+void relay_test_json(char *buffer, size_t bufsize) {
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_str(&f, "{\"active\":");
+    fmt_bool(&f, g_test.active);
+    if (g_test.active) {
+        fmt_key(&f, "relay");
+        fmt_u32(&f, g_test.relay + 1);
+        fmt_key(&f, "di");
+        fmt_u32(&f, g_test.di + 1);
+        fmt_key(&f, "phase");
+        fmt_u32(&f, g_test.phases_done);
+        fmt_key(&f, "phases");
+        fmt_u32(&f, g_test.phases_total);
+    }
+    fmt_key(&f, "channels");
+    fmt_char(&f, '[');
+
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        const relay_test_stats_t *s = &g_stats[i];
+        fmt_sep(&f);
+        fmt_str(&f, "{\"relay\":");
+        fmt_u32(&f, i + 1);
+        fmt_key(&f, "cycles");
+        fmt_u32(&f, s->cycles);
+        fmt_key(&f, "missed");
+        fmt_u32(&f, s->missed);
+        fmt_key(&f, "bounces");
+        fmt_u32(&f, s->bounces);
+        stat_json(&f, "act_us", &s->act_us);
+        stat_json(&f, "rel_us", &s->rel_us);
+        stat_json(&f, "bounce_us", &s->bounce_us);
+        fmt_char(&f, '}');
+    }
+    fmt_str(&f, "]}");
+}
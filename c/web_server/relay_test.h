@@ -0,0 +1,19 @@
+/**
+ * Relay Actuation Self-test (DI loopback)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _RELAY_TEST_H_
+#define _RELAY_TEST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+void relay_test_init(void);
+int relay_test_start(uint8_t relay, uint8_t di, uint32_t cycles);
+void relay_test_service(void);
+uint8_t relay_test_active_mask(void);
+int relay_test_delays(uint8_t relay, uint32_t *act_us, uint32_t *rel_us);
+void relay_test_json(char *buffer, size_t bufsize);
+
+#endif /* _RELAY_TEST_H_ */
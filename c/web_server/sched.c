@@ -0,0 +1,225 @@
+/**
+ * Cooperative Deadline Scheduler
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Runs the firmware's background services as periodic or one-shot tasks
+ * from the main loop. Among the tasks that are released, the one with
+ * the earliest deadline runs first (a periodic task's deadline is its
+ * next release); equal deadlines go in registration order. Tasks are
+ * not preempted: a run longer than the task's budget is counted as an
+ * overrun, one that ends after its deadline as a miss.
+ *
+ * When nothing is released the core waits in WFE until the next
+ * release. Interrupts (PIO DI edges, UART, alarms, USB) wake it early;
+ * their handlers only queue data, and the tasks that drain it run on
+ * their next release. Each task's cycles go to its CPU subsystem, the
+ * sleep to CPU_IDLE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "sched.h"
+#include "fmt.h"
+#include "cpu.h"
+
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} stat_t;
+
+typedef struct {
+    const char *name;
+    sched_fn_t fn;
+    uint32_t period_us;     // 0 = one-shot
+    uint32_t budget_us;
+    uint8_t cpu;            // Subsystem charged for the run
+    uint64_t release_us;
+    uint64_t deadline_us;
+    uint64_t last_start_us;
+    uint8_t used;
+
+    // Statistics
+    uint32_t runs;
+    uint32_t overruns;      // Ran longer than budget_us
+    uint32_t misses;        // Finished after the deadline
+    uint32_t skipped;       // Releases dropped because the task fell a period behind
+    stat_t latency_us;      // Release to start
+    stat_t jitter_us;       // |start interval - period|
+    stat_t run_us;
+} sched_task_t;
+
+static sched_task_t g_tasks[SCHED_MAX_TASKS];
+static uint32_t g_passes;
+static uint32_t g_sleeps;
+static uint64_t g_idle_us;
+static uint64_t g_started_us;
+
+static void stat_add(stat_t *s, uint32_t v) {
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (s->n == 0 || v > s->max) s->max = v;
+    s->sum += v;
+    s->n++;
+}
+
+static uint32_t stat_avg(const stat_t *s) {
+    return s->n ? (uint32_t)(s->sum / s->n) : 0;
+}
+
+static int sched_add(const char *name, sched_fn_t fn, uint32_t period_us, uint32_t delay_us,
+                     uint32_t budget_us, uint8_t cpu) {
+    uint64_t now = time_us_64();
+
+    if (!g_started_us) g_started_us = now;
+
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        sched_task_t *t = &g_tasks[i];
+        if (t->used) continue;
+
+        memset(t, 0, sizeof(*t));
+        t->name = name;
+        t->fn = fn;
+        t->period_us = period_us;
+        t->budget_us = budget_us;
+        t->cpu = cpu;
+        t->release_us = now + delay_us;
+        t->deadline_us = t->release_us + (period_us ? period_us : SCHED_ONESHOT_DEADLINE_US);
+        t->used = 1;
+        return i;
+    }
+    printf("Sched: no slot for task '%s'\n", name);
+    return -1;
+}
+
+/**
+ * Add task released every period_us, first release now; -1 if the table is full
+ */
+int sched_periodic(const char *name, sched_fn_t fn, uint32_t period_us, uint32_t budget_us, uint8_t cpu) {
+    return sched_add(name, fn, period_us, 0, budget_us, cpu);
+}
+
+/**
+ * Add task run once after delay_us, its deadline SCHED_ONESHOT_DEADLINE_US
+ * after release; -1 if the table is full
+ */
+int sched_once(const char *name, sched_fn_t fn, uint32_t delay_us, uint32_t budget_us, uint8_t cpu) {
+    return sched_add(name, fn, 0, delay_us, budget_us, cpu);
+}
+
+/**
+ * Remove task (its slot and statistics are reused)
+ */
+void sched_cancel(int id) {
+    if (id >= 0 && id < SCHED_MAX_TASKS) g_tasks[id].used = 0;
+}
+
+/**
+ * Released task with the earliest deadline, -1 if none
+ */
+static int sched_pick(uint64_t now) {
+    int best = -1;
+
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        const sched_task_t *t = &g_tasks[i];
+        if (!t->used || t->release_us > now) continue;
+        if (best < 0 || t->deadline_us < g_tasks[best].deadline_us) best = i;
+    }
+    return best;
+}
+
+static void sched_dispatch(sched_task_t *t) {
+    uint64_t start = time_us_64();
+
+    stat_add(&t->latency_us, (uint32_t)(start - t->release_us));
+    if (t->period_us && t->last_start_us) {
+        uint32_t interval = (uint32_t)(start - t->last_start_us);
+        stat_add(&t->jitter_us, interval > t->period_us ? interval - t->period_us
+                                                        : t->period_us - interval);
+    }
+    t->last_start_us = start;
+
+    uint8_t prev = cpu_enter(t->cpu);
+    t->fn();
+    cpu_leave(prev);
+
+    uint64_t end = time_us_64();
+    uint32_t run = (uint32_t)(end - start);
+
+    stat_add(&t->run_us, run);
+    t->runs++;
+    if (run > t->budget_us) t->overruns++;
+    if (end > t->deadline_us) t->misses++;
+
+    if (!t->period_us) {
+        t->used = 0;
+        return;
+    }
+
+    // Next release keeps the phase; whole periods already past are dropped
+    t->release_us += t->period_us;
+    if (t->release_us <= end) {
+        uint32_t behind = (uint32_t)((end - t->release_us) / t->period_us) + 1;
+        t->skipped += behind;
+        t->release_us += (uint64_t)behind * t->period_us;
+    }
+    t->deadline_us = t->release_us + t->period_us;
+}
+
+/**
+ * Run every released task in deadline order, then sleep until the next
+ * release (or an interrupt)
+ */
+void sched_run(void) {
+    uint64_t now = time_us_64();
+    uint64_t next = UINT64_MAX;
+    int i;
+
+    g_passes++;
+    while ((i = sched_pick(now)) >= 0) {
+        sched_dispatch(&g_tasks[i]);
+        now = time_us_64();
+    }
+
+    for (i = 0; i < SCHED_MAX_TASKS; i++) {
+        if (g_tasks[i].used && g_tasks[i].release_us < next) next = g_tasks[i].release_us;
+    }
+    if (next == UINT64_MAX || next < now + SCHED_IDLE_MIN_US) return;
+
+    g_sleeps++;
+    uint8_t prev = cpu_enter(CPU_IDLE);
+    best_effort_wfe_or_timeout(from_us_since_boot(next));
+    cpu_leave(prev);
+    g_idle_us += time_us_64() - now;
+}
+
+/**
+ * Render per-task latency, jitter and budget statistics in Prometheus text format
+ */
+void sched_metrics(fmt_t *f) {
+    uint64_t uptime = time_us_64() - g_started_us;
+
+    fmt_metric(f, "sched_passes_total", g_passes);
+    fmt_metric(f, "sched_sleeps_total", g_sleeps);
+    fmt_str(f, "sched_idle_ratio ");
+    fmt_ratio(f, g_idle_us, uptime, 3);
+    fmt_char(f, '\n');
+
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        const sched_task_t *t = &g_tasks[i];
+        if (!t->used || !t->period_us) continue;
+
+        fmt_metric_label(f, "sched_runs_total", "task", t->name, t->runs);
+        fmt_metric_label(f, "sched_overruns_total", "task", t->name, t->overruns);
+        fmt_metric_label(f, "sched_deadline_misses_total", "task", t->name, t->misses);
+        fmt_metric_label(f, "sched_skipped_total", "task", t->name, t->skipped);
+        fmt_metric_label(f, "sched_latency_avg_us", "task", t->name, stat_avg(&t->latency_us));
+        fmt_metric_label(f, "sched_latency_max_us", "task", t->name, t->latency_us.max);
+        fmt_metric_label(f, "sched_jitter_avg_us", "task", t->name, stat_avg(&t->jitter_us));
+        fmt_metric_label(f, "sched_jitter_max_us", "task", t->name, t->jitter_us.max);
+        fmt_metric_label(f, "sched_run_max_us", "task", t->name, t->run_us.max);
+    }
+}
@@ -0,0 +1,24 @@
+/**
+ * Cooperative Deadline Scheduler
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "fmt.h"
+#include "cpu.h"
+
+typedef void (*sched_fn_t)(void);
+
+int sched_periodic(const char *name, sched_fn_t fn, uint32_t period_us, uint32_t budget_us, uint8_t cpu);
+int sched_once(const char *name, sched_fn_t fn, uint32_t delay_us, uint32_t budget_us, uint8_t cpu);
+void sched_cancel(int id);
+void sched_run(void);
+void sched_metrics(fmt_t *f);
+
+#endif /* _SCHED_H_ */
@@ -0,0 +1,629 @@
+/**
+ * Telemetry Store-and-Forward Queue
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Every telemetry point (history metrics: samples and state-change
+ * events) first passes the metric's reporting policy from
+ * TELEMETRY_POLICIES: deadband, change-only, min/max report interval.
+ * Suppressed points never reach an exporter; the suppression ratio per
+ * metric is exported in /metrics.
+ *
+ * Reported points go straight to the uplink while it is reachable. While it is not,
+ * each point is appended to a ring of 32-byte records in reserved flash
+ * sectors. Appends only fill a RAM image of the current flash page;
+ * telemetry_service() programs it once it is full or TELEMETRY_FLUSH_MS
+ * old, so a page is programmed about once per TM_PER_PAGE records and a
+ * reset loses at most that unwritten page. The service also erases the
+ * next sector ahead of the head while it holds no pending records; only
+ * a full ring erases inline, dropping its oldest sector (drop-oldest).
+ *
+ * After reconnect the backlog is drained at TELEMETRY_DRAIN_PER_S,
+ * interleaved with live points, with its original timestamps. A record
+ * stays in flash until the collector acknowledges its sequence number,
+ * so a reboot or a dropped connection mid-drain does not lose it. Each
+ * acknowledged record is marked in place by programming its consumed
+ * byte 0xFF -> 0x00; no erase is needed.
+ *
+ * Points recorded before the first TIME of their boot carry uptime only;
+ * a point from an earlier boot without wall-clock time cannot be placed
+ * in time, so the drain drops such records instead of sending them
+ * (telemetry_untimed_dropped_total). Unsent points of the current boot
+ * get their time once it is known.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "pico/rand.h"
+#include "hardware/flash.h"
+
+#include "config.h"
+#include "telemetry.h"
+#include "cpu.h"
+#include "fmt.h"
+#include "history.h"
+
+typedef struct {
+    uint32_t seq;           // 0xFFFFFFFF = empty slot
+    uint32_t unix_s;        // Wall-clock time, 0 if not synced yet
+    uint32_t up_ms;         // Uptime at record time
+    uint16_t boot;          // Boot id
+    uint8_t metric;         // history_metric_t
+    uint8_t kind;           // TELEMETRY_SAMPLE / TELEMETRY_EVENT
+    int32_t value;
+    uint8_t reserved[11];
+    uint8_t consumed;       // 0xFF = pending, 0x00 = acknowledged
+} telemetry_record_t;
+
+#define TM_RECORD_SIZE      32
+#define TM_PER_PAGE         (FLASH_PAGE_SIZE / TM_RECORD_SIZE)
+#define TM_PER_SECTOR       (FLASH_SECTOR_SIZE / TM_RECORD_SIZE)
+#define TM_SLOTS            (TELEMETRY_FLASH_SECTORS * TM_PER_SECTOR)
+#define TM_EMPTY            0xFFFFFFFFu
+
+_Static_assert(sizeof(telemetry_record_t) == TM_RECORD_SIZE, "record size");
+
+typedef struct {
+    const char *metric;
+    int32_t deadband;
+    uint16_t deadband_pct10;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint8_t change_only;
+} telemetry_policy_t;
+
+// Per-metric reporting state
+typedef struct {
+    const telemetry_policy_t *policy;   // NULL = report every point
+    uint8_t reported;       // last/last_ms valid
+    uint8_t held;           // Change held back by min_ms
+    uint8_t held_kind;
+    int32_t held_value;
+    uint32_t held_up_ms;
+    int32_t last;           // Last reported value
+    uint32_t last_ms;
+    uint32_t offered;
+    uint32_t suppressed;
+} telemetry_metric_t;
+
+static const telemetry_policy_t g_policies[] = TELEMETRY_POLICIES;
+static telemetry_metric_t g_metrics[HIST_METRIC_COUNT];
+
+static const telemetry_record_t *const g_records =
+    (const telemetry_record_t *)(XIP_BASE + TELEMETRY_FLASH_OFFSET);
+
+static telemetry_sink_t g_sink;
+static telemetry_sink_up_t g_sink_up;
+static uint16_t g_boot;
+static uint32_t g_seq;              // Last sequence number used
+static uint32_t g_time_offset;      // unix_s - uptime_s, 0 = not synced
+
+// Ring positions (slots)
+static uint32_t g_head;             // Next slot to write
+static uint32_t g_tail;             // Oldest unacknowledged record
+static uint32_t g_send;             // Next record to send
+static uint32_t g_count;            // Records tail..head
+static uint32_t g_inflight;         // Records tail..send
+static uint32_t g_progress_ms;      // Last ack or send start
+
+// Drain rate limit (token bucket, milli-tokens)
+static uint32_t g_tokens;
+static uint32_t g_tokens_ms;
+
+// Flash page image for programming
+static uint8_t g_page[FLASH_PAGE_SIZE];
+static uint32_t g_page_offset;
+static uint32_t g_erase_offset;
+
+// Head page buffered in RAM: its last g_unwritten records are not in flash yet
+static uint8_t g_head_page[FLASH_PAGE_SIZE];
+static uint32_t g_unwritten;
+static uint32_t g_unwritten_ms;     // First unwritten record appended
+static int32_t g_erased = -1;       // Sector known to be blank, -1 = none
+
+// Statistics
+static uint32_t g_live;
+static uint32_t g_stored;
+static uint32_t g_drained;
+static uint32_t g_acked;
+static uint32_t g_dropped;
+static uint32_t g_untimed;
+static uint32_t g_programs;
+static uint32_t g_erases;
+static uint32_t g_resends;
+static uint32_t g_rate_count;
+static uint32_t g_rate_ms;
+static uint32_t g_drain_rate;       // Records/s over the last second
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static void tm_program_cb(void *param) {
+    flash_range_program(g_page_offset, g_page, FLASH_PAGE_SIZE);
+}
+
+static void tm_erase_cb(void *param) {
+    flash_range_erase(g_erase_offset, FLASH_SECTOR_SIZE);
+}
+
+/**
+ * Program g_page over flash page; 0xFF bytes leave existing data untouched
+ */
+static void tm_program_page(uint32_t page) {
+    uint8_t prev = cpu_enter(CPU_FLASH);
+
+    g_page_offset = TELEMETRY_FLASH_OFFSET + page * FLASH_PAGE_SIZE;
+    flash_safe_execute(tm_program_cb, NULL, UINT32_MAX);
+    g_programs++;
+    cpu_leave(prev);
+}
+
+static void tm_erase_sector(uint32_t sector) {
+    uint8_t prev = cpu_enter(CPU_FLASH);
+
+    g_erase_offset = TELEMETRY_FLASH_OFFSET + sector * FLASH_SECTOR_SIZE;
+    flash_safe_execute(tm_erase_cb, NULL, UINT32_MAX);
+    g_erases++;
+    g_erased = sector;
+    cpu_leave(prev);
+}
+
+/**
+ * Slot not yet programmed: still only in g_head_page
+ */
+static int tm_unwritten(uint32_t slot) {
+    return (g_head + TM_SLOTS - slot - 1) % TM_SLOTS < g_unwritten;
+}
+
+/**
+ * Record in slot, from RAM while its page is not programmed yet
+ */
+static const telemetry_record_t *tm_record(uint32_t slot) {
+    if (tm_unwritten(slot)) {
+        return (const telemetry_record_t *)(g_head_page + (slot % TM_PER_PAGE) * TM_RECORD_SIZE);
+    }
+    return &g_records[slot];
+}
+
+/**
+ * Program the unwritten records of the head page (0xFF elsewhere leaves
+ * the ones already in flash untouched)
+ */
+static void tm_flush(void) {
+    uint32_t first = (g_head + TM_SLOTS - g_unwritten) % TM_SLOTS;
+    uint32_t off = (first % TM_PER_PAGE) * TM_RECORD_SIZE;
+
+    if (!g_unwritten) return;
+    memset(g_page, 0xFF, sizeof(g_page));
+    memcpy(g_page + off, g_head_page + off, g_unwritten * TM_RECORD_SIZE);
+    tm_program_page(first / TM_PER_PAGE);
+    g_unwritten = 0;
+}
+
+/**
+ * Sector holds a record of the pending range tail..head
+ */
+static int tm_sector_pending(uint32_t sector) {
+    uint32_t first = sector * TM_PER_SECTOR;
+
+    if (!g_count) return 0;
+    if (g_tail >= first && g_tail < first + TM_PER_SECTOR) return 1;
+    return (first + TM_SLOTS - g_tail) % TM_SLOTS < g_count;
+}
+
+/**
+ * Rebuild ring state from flash after boot
+ */
+static void tm_scan(void) {
+    uint32_t max_seq = 0, min_pending = TM_EMPTY;
+    uint32_t max_slot = 0, tail_slot = 0;
+
+    g_count = 0;
+    for (uint32_t i = 0; i < TM_SLOTS; i++) {
+        const telemetry_record_t *r = &g_records[i];
+        if (r->seq == TM_EMPTY) continue;
+        if (r->seq > max_seq) {
+            max_seq = r->seq;
+            max_slot = i;
+        }
+        if (r->consumed == 0xFF) {
+            g_count++;
+            if (r->seq < min_pending) {
+                min_pending = r->seq;
+                tail_slot = i;
+            }
+        }
+    }
+
+    g_seq = max_seq;
+    g_head = max_seq ? (max_slot + 1) % TM_SLOTS : 0;
+    g_tail = g_count ? tail_slot : g_head;
+    g_send = g_tail;
+    g_inflight = 0;
+}
+
+
+/**
+ * Bind reporting policies, reset queue state from flash and attach the
+ * uplink. Without a sink only the policies run (accounting only).
+ */
+void telemetry_init(telemetry_sink_t sink, telemetry_sink_up_t sink_up) {
+    memset(g_metrics, 0, sizeof(g_metrics));
+    for (size_t i = 0; i < sizeof(g_policies) / sizeof(g_policies[0]); i++) {
+        int metric = history_metric_by_name(g_policies[i].metric);
+        if (metric < 0) {
+            printf("Telemetry: policy for unknown metric '%s' ignored\n", g_policies[i].metric);
+            continue;
+        }
+        g_metrics[metric].policy = &g_policies[i];
+    }
+
+    g_sink = sink;
+    g_sink_up = sink_up;
+    if (!g_sink) return;
+
+    g_boot = get_rand_32();
+    g_time_offset = 0;
+    g_tokens = TELEMETRY_DRAIN_BURST * 1000;
+    g_tokens_ms = g_rate_ms = now_ms();
+
+    tm_scan();
+    printf("Telemetry: %lu queued records, next seq %lu\n",
+           (unsigned long)g_count, (unsigned long)g_seq + 1);
+}
+
+/**
+ * Wall-clock time from the collector; points recorded before it carry uptime only
+ */
+void telemetry_set_time(uint32_t unix_s) {
+    g_time_offset = unix_s - now_ms() / 1000;
+}
+
+/**
+ * Render point as JSON for the uplink; a point of this boot stored before
+ * the time was known gets it now
+ */
+static void tm_render(const telemetry_record_t *r, int backlog, char *json, size_t size) {
+    uint32_t unix_s = r->unix_s;
+    fmt_t f;
+
+    if (!unix_s && r->boot == g_boot && g_time_offset) unix_s = g_time_offset + r->up_ms / 1000;
+
+    fmt_init(&f, json, size);
+    fmt_str(&f, "{\"type\":\"point\",\"metric\":");
+    fmt_json_str(&f, history_metric_name(r->metric));
+    fmt_key(&f, "kind");
+    fmt_str(&f, r->kind == TELEMETRY_EVENT ? "\"event\"" : "\"sample\"");
+    fmt_key(&f, "value");
+    fmt_i32(&f, r->value);
+    fmt_key(&f, "seq");
+    fmt_u32(&f, r->seq);
+    fmt_key(&f, "boot");
+    fmt_u32(&f, r->boot);
+    fmt_key(&f, "t");
+    fmt_u32(&f, unix_s);
+    fmt_key(&f, "up_ms");
+    fmt_u32(&f, r->up_ms);
+    fmt_key(&f, "backlog");
+    fmt_bool(&f, backlog);
+    fmt_char(&f, '}');
+}
+
+/**
+ * Append record at head into the RAM page. Flash is touched only when a
+ * burst fills the page before telemetry_service() wrote it, or the head
+ * enters a sector the service could not erase ahead (ring full: its
+ * records are dropped)
+ */
+static void tm_append(const telemetry_record_t *rec) {
+    if (g_head % TM_PER_PAGE == 0) {
+        tm_flush();
+        memset(g_head_page, 0xFF, sizeof(g_head_page));
+    }
+    if (g_head % TM_PER_SECTOR == 0 && g_erased != (int32_t)(g_head / TM_PER_SECTOR)) {
+        uint32_t sector = g_head / TM_PER_SECTOR;
+        uint32_t first = sector * TM_PER_SECTOR;
+
+        // Ring full: the oldest records live in the sector about to be erased
+        if (g_count && g_tail >= first && g_tail < first + TM_PER_SECTOR) {
+            uint32_t lost = first + TM_PER_SECTOR - g_tail;
+            if (lost > g_count) lost = g_count;
+            g_dropped += lost;
+            g_count -= lost;
+            g_tail = (first + TM_PER_SECTOR) % TM_SLOTS;
+            g_send = g_tail;
+            g_inflight = 0;
+        }
+
+        int blank = 1;
+        for (uint32_t i = first; i < first + TM_PER_SECTOR && blank; i++) {
+            if (g_records[i].seq != TM_EMPTY) blank = 0;
+        }
+        if (!blank) tm_erase_sector(sector);
+    }
+    // The head sector is in use from here on
+    if (g_head % TM_PER_SECTOR == 0) g_erased = -1;
+
+    memcpy(g_head_page + (g_head % TM_PER_PAGE) * TM_RECORD_SIZE, rec, TM_RECORD_SIZE);
+    if (!g_unwritten) g_unwritten_ms = now_ms();
+    g_unwritten++;
+
+    g_head = (g_head + 1) % TM_SLOTS;
+    g_count++;
+    g_stored++;
+}
+
+/**
+ * Mark the tail record consumed and advance past it. Flushed records are
+ * collected in g_page for *page; the caller programs the last one
+ */
+static void tm_consume_tail(int32_t *page) {
+    uint32_t consumed = (g_tail % TM_PER_PAGE) * TM_RECORD_SIZE + offsetof(telemetry_record_t, consumed);
+
+    if (tm_unwritten(g_tail)) {
+        // Still in RAM: reaches flash already consumed
+        g_head_page[consumed] = 0x00;
+    } else {
+        if ((int32_t)(g_tail / TM_PER_PAGE) != *page) {
+            if (*page >= 0) tm_program_page(*page);
+            *page = g_tail / TM_PER_PAGE;
+            memset(g_page, 0xFF, sizeof(g_page));
+        }
+        g_page[consumed] = 0x00;
+    }
+    g_tail = (g_tail + 1) % TM_SLOTS;
+    g_count--;
+}
+
+/**
+ * Record of an earlier boot that never got wall-clock time
+ */
+static int tm_untimed(const telemetry_record_t *r) {
+    return !r->unix_s && r->boot != g_boot;
+}
+
+/**
+ * Drop the untimed records at tail (nothing in flight)
+ */
+static void tm_drop_untimed(void) {
+    int32_t page = -1;
+
+    while (g_count && tm_untimed(tm_record(g_tail))) {
+        tm_consume_tail(&page);
+        g_untimed++;
+    }
+    if (page >= 0) tm_program_page(page);
+    g_send = g_tail;
+}
+
+/**
+ * Flash upkeep outside the hot path: program the head page once it is
+ * full or old enough, erase the next sector while it holds nothing pending
+ */
+static void tm_flash_service(uint32_t now) {
+    if (g_unwritten && (g_head % TM_PER_PAGE == 0 || now - g_unwritten_ms >= TELEMETRY_FLUSH_MS)) {
+        tm_flush();
+    }
+
+    uint32_t next = (g_head / TM_PER_SECTOR + 1) % TELEMETRY_FLASH_SECTORS;
+    if (g_head % TM_PER_SECTOR == 0) next = g_head / TM_PER_SECTOR;
+    if (g_erased == (int32_t)next || tm_sector_pending(next)) return;
+
+    for (uint32_t i = next * TM_PER_SECTOR; i < (next + 1) * TM_PER_SECTOR; i++) {
+        if (g_records[i].seq != TM_EMPTY) {
+            tm_erase_sector(next);
+            return;
+        }
+    }
+    g_erased = next;
+}
+
+/**
+ * Send point live when possible, queue it in flash otherwise
+ */
+static void tm_emit(uint8_t metric, uint8_t kind, int32_t value, uint32_t up_ms) {
+    telemetry_metric_t *m = &g_metrics[metric];
+    telemetry_record_t rec;
+    char json[192];
+
+    m->reported = 1;
+    m->held = 0;
+    m->last = value;
+    m->last_ms = now_ms();
+    if (!g_sink) return;
+
+    memset(&rec, 0xFF, sizeof(rec));
+    rec.seq = ++g_seq;
+    rec.unix_s = g_time_offset ? g_time_offset + up_ms / 1000 : 0;
+    rec.up_ms = up_ms;
+    rec.boot = g_boot;
+    rec.metric = metric;
+    rec.kind = kind;
+    rec.value = value;
+
+    if (g_sink_up()) {
+        tm_render(&rec, 0, json, sizeof(json));
+        if (g_sink(json)) {
+            g_live++;
+            return;
+        }
+    }
+    tm_append(&rec);
+}
+
+/**
+ * Value differs enough from the last reported one to be worth sending
+ */
+static int tm_changed(const telemetry_metric_t *m, int32_t value) {
+    const telemetry_policy_t *p = m->policy;
+    int64_t diff = (int64_t)value - m->last;
+    int64_t base = m->last;
+
+    if (p->change_only) return value != m->last;
+    if (!p->deadband && !p->deadband_pct10) return 1;
+
+    if (diff < 0) diff = -diff;
+    if (base < 0) base = -base;
+    if (p->deadband && diff > p->deadband) return 1;
+    if (p->deadband_pct10 && diff * 1000 > base * p->deadband_pct10) return 1;
+    return 0;
+}
+
+/**
+ * Offer a telemetry point; the metric's policy decides whether it is reported
+ */
+void telemetry_put(uint8_t metric, uint8_t kind, int32_t value) {
+    if (metric >= HIST_METRIC_COUNT) return;
+
+    telemetry_metric_t *m = &g_metrics[metric];
+    const telemetry_policy_t *p = m->policy;
+    uint32_t now = now_ms();
+
+    m->offered++;
+    if (!p || !m->reported) {
+        tm_emit(metric, kind, value, now);
+        return;
+    }
+
+    // A newer value supersedes the held one
+    if (m->held) {
+        m->held = 0;
+        m->suppressed++;
+    }
+
+    uint32_t since = now - m->last_ms;
+    if (p->max_ms && since >= p->max_ms) {
+        tm_emit(metric, kind, value, now);
+        return;
+    }
+    if (!tm_changed(m, value)) {
+        m->suppressed++;
+        return;
+    }
+
+    if (p->min_ms && since < p->min_ms) {
+        m->held = 1;
+        m->held_kind = kind;
+        m->held_value = value;
+        m->held_up_ms = now;
+        return;
+    }
+    tm_emit(metric, kind, value, now);
+}
+
+/**
+ * Collector acknowledged backlog records up to seq: mark them consumed,
+ * one page program per page touched
+ */
+void telemetry_ack(uint32_t seq) {
+    int32_t page = -1;
+
+    while (g_inflight && tm_record(g_tail)->seq <= seq) {
+        tm_consume_tail(&page);
+        g_inflight--;
+        g_acked++;
+    }
+    if (page >= 0) tm_program_page(page);
+    g_progress_ms = now_ms();
+}
+
+/**
+ * Release held changes, drain backlog at the configured rate (main loop)
+ */
+void telemetry_service(void) {
+    uint32_t now = now_ms();
+    char json[192];
+
+    // Changes held back by min_ms go out once it has passed
+    for (int i = 0; i < HIST_METRIC_COUNT; i++) {
+        telemetry_metric_t *m = &g_metrics[i];
+        if (m->held && now - m->last_ms >= m->policy->min_ms) {
+            tm_emit(i, m->held_kind, m->held_value, m->held_up_ms);
+        }
+    }
+    if (!g_sink) return;
+    tm_flash_service(now);
+
+    if (now - g_rate_ms >= 1000) {
+        g_drain_rate = g_rate_count * 1000 / (now - g_rate_ms);
+        g_rate_count = 0;
+        g_rate_ms = now;
+    }
+
+    g_tokens += (now - g_tokens_ms) * TELEMETRY_DRAIN_PER_S;
+    if (g_tokens > TELEMETRY_DRAIN_BURST * 1000) g_tokens = TELEMETRY_DRAIN_BURST * 1000;
+    g_tokens_ms = now;
+
+    if (!g_sink_up()) {
+        // Unacked records go again after reconnect
+        g_send = g_tail;
+        g_inflight = 0;
+        return;
+    }
+
+    // Collector stopped acking: resend from the oldest unacked record
+    if (g_inflight && now - g_progress_ms > TELEMETRY_ACK_TIMEOUT_MS) {
+        g_resends += g_inflight;
+        g_send = g_tail;
+        g_inflight = 0;
+    }
+
+    while (g_inflight < g_count && g_inflight < TELEMETRY_DRAIN_WINDOW && g_tokens >= 1000) {
+        const telemetry_record_t *r = tm_record(g_send);
+        if (tm_untimed(r)) {
+            // Dropped once everything before it is acked
+            if (g_inflight) break;
+            tm_drop_untimed();
+            continue;
+        }
+        tm_render(r, 1, json, sizeof(json));
+        if (!g_sink(json)) break;
+        if (g_inflight == 0) g_progress_ms = now;
+        g_send = (g_send + 1) % TM_SLOTS;
+        g_inflight++;
+        g_tokens -= 1000;
+        g_drained++;
+        g_rate_count++;
+    }
+}
+
+/**
+ * Render per-metric policy and queue statistics in Prometheus text format
+ */
+void telemetry_metrics(fmt_t *f) {
+    for (int i = 0; i < HIST_METRIC_COUNT; i++) {
+        const telemetry_metric_t *m = &g_metrics[i];
+        if (!m->offered && !m->policy) continue;
+        const char *name = history_metric_name(i);
+        fmt_metric_label(f, "telemetry_points_total", "metric", name, m->offered);
+        fmt_metric_label(f, "telemetry_suppressed_total", "metric", name, m->suppressed);
+        fmt_str(f, "telemetry_suppression_ratio{metric=\"");
+        fmt_str(f, name);
+        fmt_str(f, "\"} ");
+        fmt_ratio(f, m->suppressed, m->offered, 3);
+        fmt_char(f, '\n');
+    }
+    if (!g_sink) return;
+
+    uint32_t oldest_s = 0;
+    // Uptime of an earlier boot is meaningless here
+    if (g_count && tm_record(g_tail)->boot == g_boot) oldest_s = (now_ms() - tm_record(g_tail)->up_ms) / 1000;
+
+    fmt_metric(f, "telemetry_backlog", g_count);
+    fmt_metric(f, "telemetry_backlog_capacity", TM_SLOTS);
+    fmt_metric(f, "telemetry_backlog_oldest_seconds", oldest_s);
+    fmt_metric(f, "telemetry_inflight", g_inflight);
+    fmt_metric(f, "telemetry_drain_rate", g_drain_rate);
+    fmt_metric(f, "telemetry_live_total", g_live);
+    fmt_metric(f, "telemetry_stored_total", g_stored);
+    fmt_metric(f, "telemetry_drained_total", g_drained);
+    fmt_metric(f, "telemetry_acked_total", g_acked);
+    fmt_metric(f, "telemetry_resent_total", g_resends);
+    fmt_metric(f, "telemetry_dropped_total", g_dropped);
+    fmt_metric(f, "telemetry_untimed_dropped_total", g_untimed);
+    fmt_metric(f, "telemetry_flash_programs_total", g_programs);
+    fmt_metric(f, "telemetry_flash_erases_total", g_erases);
+}
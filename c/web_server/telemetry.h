@@ -0,0 +1,29 @@
+/**
+ * Telemetry Store-and-Forward Queue
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fmt.h"
+
+// Point kinds
+#define TELEMETRY_SAMPLE    0   // Periodic sample
+#define TELEMETRY_EVENT     1   // State change (relay, DI edge)
+
+// Uplink: send one JSON point, 0 if it could not be sent (NULL = policies only)
+typedef int (*telemetry_sink_t)(const char *json);
+typedef int (*telemetry_sink_up_t)(void);
+
+void telemetry_init(telemetry_sink_t sink, telemetry_sink_up_t sink_up);
+void telemetry_put(uint8_t metric, uint8_t kind, int32_t value);
+void telemetry_service(void);
+void telemetry_ack(uint32_t seq);
+void telemetry_set_time(uint32_t unix_s);
+void telemetry_metrics(fmt_t *f);
+
+#endif /* _TELEMETRY_H_ */
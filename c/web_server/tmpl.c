@@ -0,0 +1,72 @@
+/**
+ * Streaming Page Templates
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * A page is stored in flash once, with slot markers where live state
+ * goes. tmpl_compile() finds the markers at boot; a response is then
+ * the static fragments written straight from flash with the slots'
+ * current contents between them. Nothing is copied or concatenated per
+ * request, and the Content-Length is known before the first byte.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "tmpl.h"
+
+/**
+ * Split src at its slot markers; 0 if it has more than TMPL_MAX_SLOTS,
+ * a slot number outside 0..slot_count-1 or does not fit the 16-bit offsets
+ */
+int tmpl_compile(tmpl_t *t, const char *src, uint8_t slot_count) {
+    size_t len = strlen(src);
+    const char *p = src;
+    const char *mark;
+
+    memset(t, 0, sizeof(*t));
+    t->src = src;
+    if (len > UINT16_MAX || slot_count > 10) return 0;
+
+    while ((mark = memchr(p, TMPL_MARK, src + len - p)) != NULL) {
+        if (t->slots == TMPL_MAX_SLOTS || mark[1] < '0' || mark[1] >= '0' + slot_count) {
+            printf("Tmpl: bad slot marker at %u\n", (unsigned)(mark - src));
+            return 0;
+        }
+        t->frag_off[t->slots] = p - src;
+        t->frag_len[t->slots] = mark - p;
+        t->slot_id[t->slots] = mark[1] - '0';
+        t->static_len += mark - p;
+        t->slots++;
+        p = mark + 2;
+    }
+    t->frag_off[t->slots] = p - src;
+    t->frag_len[t->slots] = src + len - p;
+    t->static_len += src + len - p;
+    return 1;
+}
+
+/**
+ * Rendered size with the given slot contents (indexed by slot number)
+ */
+uint32_t tmpl_length(const tmpl_t *t, const tmpl_slot_t *slots) {
+    uint32_t len = t->static_len;
+
+    for (uint8_t i = 0; i < t->slots; i++) len += slots[t->slot_id[i]].len;
+    return len;
+}
+
+/**
+ * Write the page: each static fragment from flash through write_static
+ * (it may keep a reference), then the next slot through write
+ */
+void tmpl_send(const tmpl_t *t, const tmpl_slot_t *slots, tmpl_write_fn write_static,
+               tmpl_write_fn write, uint8_t sock) {
+    for (uint8_t i = 0; i <= t->slots; i++) {
+        if (t->frag_len[i]) write_static(sock, t->src + t->frag_off[i], t->frag_len[i]);
+        if (i == t->slots) break;
+
+        const tmpl_slot_t *s = &slots[t->slot_id[i]];
+        if (s->len) write(sock, s->data, s->len);
+    }
+}
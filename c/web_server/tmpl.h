@@ -0,0 +1,41 @@
+/**
+ * Streaming Page Templates
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _TMPL_H_
+#define _TMPL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+// Slot marker in template text: TMPL_MARK followed by the slot number ('0'..)
+#define TMPL_MARK       '\x01'
+#define TMPL_MAX_SLOTS  8
+
+// Template split into static fragments: frag 0, slot, frag 1, slot, ...
+typedef struct {
+    const char *src;
+    uint8_t slots;                          // Slot references (fragments - 1)
+    uint8_t slot_id[TMPL_MAX_SLOTS];
+    uint16_t frag_off[TMPL_MAX_SLOTS + 1];
+    uint16_t frag_len[TMPL_MAX_SLOTS + 1];
+    uint32_t static_len;
+} tmpl_t;
+
+// Current content of one slot
+typedef struct {
+    const char *data;
+    uint16_t len;
+} tmpl_slot_t;
+
+typedef void (*tmpl_write_fn)(uint8_t sock, const void *data, uint16_t len);
+
+int tmpl_compile(tmpl_t *t, const char *src, uint8_t slot_count);
+uint32_t tmpl_length(const tmpl_t *t, const tmpl_slot_t *slots);
+void tmpl_send(const tmpl_t *t, const tmpl_slot_t *slots, tmpl_write_fn write_static,
+               tmpl_write_fn write, uint8_t sock);
+
+#endif /* _TMPL_H_ */
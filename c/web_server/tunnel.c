@@ -0,0 +1,591 @@
+/**
+ * Hub Tunnel (outbound control channel)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * Boards behind NAT keep one outbound TCP connection (optionally TLS)
+ * to a hub. The hub sends raw HTTP requests as REQ frames; they go
+ * through the same request router as the local server and the response
+ * comes back as RESP chunks closed by END. Telemetry points (see
+ * telemetry.c) are pushed as EVENT frames and acknowledged by the hub
+ * with ACK frames; the hub also supplies wall-clock time. Requests are served one at a time: while a
+ * response is open, further frames stay in the receive buffer.
+ *
+ * Frames are queued and written as the socket's TX buffer frees up; the
+ * socket stays non-blocking, and a queue that stops draining closes the
+ * link instead of stalling the main loop.
+ *
+ * Keep-alive pings detect dead connections; reconnects back off
+ * exponentially with jitter.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+
+#include "socket.h"
+
+#include "config.h"
+#include "tunnel.h"
+#include "fmt.h"
+
+#if TUNNEL_ENABLE
+
+#if TUNNEL_TLS
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#endif
+
+#define TUNNEL_HDR      6
+#define TUNNEL_RX_BUF   (TUNNEL_HDR + MAX_HTTP_BUF)
+
+#if TUNNEL_TLS
+_Static_assert(sizeof(TUNNEL_CA_PEM) > 1, "TUNNEL_TLS needs TUNNEL_CA_PEM to verify the hub");
+#endif
+
+typedef enum {
+    TUNNEL_IDLE = 0,        // Closed, waiting for the backoff to expire
+    TUNNEL_CONNECTING,
+    TUNNEL_HANDSHAKE,       // TLS handshake in progress
+    TUNNEL_UP
+} tunnel_state_t;
+
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} stat_t;
+
+static const uint8_t g_hub_ip[4] = TUNNEL_HUB_IP;
+
+static tunnel_request_handler_t g_handler;
+static tunnel_control_handler_t g_control;
+static tunnel_state_t g_state;
+static uint32_t g_backoff_ms;
+static uint32_t g_retry_at_ms;
+static uint32_t g_state_ms;         // Time of last state change
+static uint32_t g_last_rx_ms;
+static uint32_t g_last_tx_ms;
+static uint32_t g_ping_us;          // Outstanding ping send time, 0 = none
+
+static uint8_t g_rx[TUNNEL_RX_BUF];
+static uint16_t g_rx_len;
+static uint8_t g_txq[TUNNEL_TX_QUEUE];
+static uint16_t g_txq_len;
+static uint32_t g_tx_progress_ms;   // Last time queued bytes went out
+static char g_request[MAX_HTTP_BUF + 1];
+
+static uint8_t g_resp_open;
+static uint16_t g_resp_id;
+static uint32_t g_resp_start_us;
+
+// Statistics
+static uint32_t g_connects;
+static uint32_t g_disconnects;
+static uint32_t g_requests;
+static uint32_t g_events;
+static uint32_t g_events_dropped;
+static uint32_t g_protocol_errors;
+static uint32_t g_tx_stalls;
+static uint64_t g_bytes_tx;
+static uint64_t g_bytes_rx;
+static stat_t g_ping_rtt_us;
+static stat_t g_req_us;             // REQ received -> END sent
+
+#if TUNNEL_TLS
+static mbedtls_ssl_context g_ssl;
+static mbedtls_ssl_config g_ssl_conf;
+static mbedtls_x509_crt g_ca;
+static mbedtls_entropy_context g_entropy;
+static mbedtls_ctr_drbg_context g_drbg;
+static uint8_t g_tls_ready;          // CA loaded: connecting is allowed
+static uint16_t g_tls_write_len;    // Length of a write that returned WANT_WRITE
+#endif
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static void stat_add(stat_t *s, uint32_t v) {
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (v > s->max) s->max = v;
+    s->sum += v;
+    s->n++;
+}
+
+static void tunnel_set_state(tunnel_state_t state) {
+    g_state = state;
+    g_state_ms = now_ms();
+}
+
+#if TUNNEL_TLS
+static int tls_bio_send(void *ctx, const unsigned char *buf, size_t len) {
+    uint16_t room = getSn_TX_FSR(TUNNEL_SOCKET);
+
+    if (len > room) len = room;
+    if (len == 0) return MBEDTLS_ERR_SSL_WANT_WRITE;
+    int32_t n = send(TUNNEL_SOCKET, (uint8_t *)buf, len);
+    if (n == SOCK_BUSY) return MBEDTLS_ERR_SSL_WANT_WRITE;
+    return n < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : (int)n;
+}
+
+static int tls_bio_recv(void *ctx, unsigned char *buf, size_t len) {
+    uint16_t avail = getSn_RX_RSR(TUNNEL_SOCKET);
+
+    if (avail == 0) {
+        return getSn_SR(TUNNEL_SOCKET) == SOCK_ESTABLISHED ?
+               MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    if (len > avail) len = avail;
+    int32_t n = recv(TUNNEL_SOCKET, buf, len);
+    return n < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : (int)n;
+}
+
+/**
+ * One-time TLS setup; without a usable CA the tunnel never connects
+ */
+static void tls_init(void) {
+    static const char ca_pem[] = TUNNEL_CA_PEM;
+
+    mbedtls_ssl_init(&g_ssl);
+    mbedtls_ssl_config_init(&g_ssl_conf);
+    mbedtls_x509_crt_init(&g_ca);
+    mbedtls_entropy_init(&g_entropy);
+    mbedtls_ctr_drbg_init(&g_drbg);
+
+    mbedtls_ctr_drbg_seed(&g_drbg, mbedtls_entropy_func, &g_entropy,
+                          (const unsigned char *)TUNNEL_TOKEN, strlen(TUNNEL_TOKEN));
+    mbedtls_ssl_config_defaults(&g_ssl_conf, MBEDTLS_SSL_IS_CLIENT,
+                                MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    mbedtls_ssl_conf_rng(&g_ssl_conf, mbedtls_ctr_drbg_random, &g_drbg);
+
+    if (mbedtls_x509_crt_parse(&g_ca, (const unsigned char *)ca_pem, sizeof(ca_pem)) != 0) {
+        printf("Tunnel: TUNNEL_CA_PEM does not parse, tunnel disabled\n");
+        return;
+    }
+    mbedtls_ssl_conf_ca_chain(&g_ssl_conf, &g_ca, NULL);
+    mbedtls_ssl_conf_authmode(&g_ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+
+    mbedtls_ssl_setup(&g_ssl, &g_ssl_conf);
+    mbedtls_ssl_set_hostname(&g_ssl, TUNNEL_HUB_NAME);
+    mbedtls_ssl_set_bio(&g_ssl, NULL, tls_bio_send, tls_bio_recv, NULL);
+    g_tls_ready = 1;
+}
+#endif
+
+/**
+ * Write what the TX buffer takes right now: >0 count, 0 full, <0 connection error
+ */
+static int tunnel_io_write(const uint8_t *data, uint16_t len) {
+#if TUNNEL_TLS
+    // A write that returned WANT_WRITE must be repeated with the same length
+    if (g_tls_write_len) len = g_tls_write_len;
+    int n = mbedtls_ssl_write(&g_ssl, data, len);
+    if (n == MBEDTLS_ERR_SSL_WANT_WRITE || n == MBEDTLS_ERR_SSL_WANT_READ) {
+        g_tls_write_len = len;
+        return 0;
+    }
+    g_tls_write_len = 0;
+    return n;
+#else
+    uint16_t room = getSn_TX_FSR(TUNNEL_SOCKET);
+
+    if (len > room) len = room;
+    if (len == 0) return 0;
+    int32_t n = send(TUNNEL_SOCKET, (uint8_t *)data, len);
+    return n == SOCK_BUSY ? 0 : n;
+#endif
+}
+
+/**
+ * Read available bytes: >0 count, 0 nothing pending, <0 connection error
+ */
+static int tunnel_io_read(uint8_t *buf, uint16_t len) {
+#if TUNNEL_TLS
+    int n = mbedtls_ssl_read(&g_ssl, buf, len);
+    if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) return 0;
+    return n == 0 ? -1 : n;
+#else
+    uint16_t avail = getSn_RX_RSR(TUNNEL_SOCKET);
+    if (avail == 0) return 0;
+    if (len > avail) len = avail;
+    return recv(TUNNEL_SOCKET, buf, len);
+#endif
+}
+
+/**
+ * Close the connection and schedule a reconnect with backoff and jitter
+ */
+static void tunnel_close(const char *reason) {
+    if (g_state == TUNNEL_UP || g_state == TUNNEL_HANDSHAKE) {
+        g_disconnects++;
+        printf("Tunnel: closed (%s)\n", reason);
+    }
+#if TUNNEL_TLS
+    if (g_state == TUNNEL_UP) mbedtls_ssl_close_notify(&g_ssl);
+#endif
+    close(TUNNEL_SOCKET);
+
+    // +-25% jitter so a site full of boards doesn't reconnect in lockstep
+    uint32_t jitter = g_backoff_ms / 2 ? get_rand_32() % (g_backoff_ms / 2) : 0;
+    g_retry_at_ms = now_ms() + g_backoff_ms - g_backoff_ms / 4 + jitter;
+    g_backoff_ms *= 2;
+    if (g_backoff_ms > TUNNEL_BACKOFF_MAX_MS) g_backoff_ms = TUNNEL_BACKOFF_MAX_MS;
+
+    g_rx_len = 0;
+    g_txq_len = 0;
+#if TUNNEL_TLS
+    g_tls_write_len = 0;
+#endif
+    g_resp_open = 0;
+    g_ping_us = 0;
+    tunnel_set_state(TUNNEL_IDLE);
+}
+
+/**
+ * Write queued bytes until the socket's TX buffer is full; never waits
+ */
+static void tunnel_flush(void) {
+    uint16_t off = 0;
+
+    while (off < g_txq_len) {
+        int n = tunnel_io_write(g_txq + off, g_txq_len - off);
+        if (n == 0) break;
+        if (n < 0) {
+            tunnel_close("write failed");
+            return;
+        }
+        off += n;
+    }
+    if (off == 0) return;
+
+    memmove(g_txq, g_txq + off, g_txq_len - off);
+    g_txq_len -= off;
+    g_bytes_tx += off;
+    g_last_tx_ms = g_tx_progress_ms = now_ms();
+}
+
+/**
+ * Queue one frame and start writing it; 0 if the tunnel is down, the payload
+ * exceeds TUNNEL_CHUNK or the queue has no room for it
+ */
+static int tunnel_send_frame(uint8_t type, uint16_t id, const void *data, size_t len) {
+    if (g_state != TUNNEL_UP || len > TUNNEL_CHUNK) return 0;
+    if (g_txq_len + TUNNEL_HDR + len > sizeof(g_txq)) return 0;
+
+    uint8_t *h = g_txq + g_txq_len;
+    if (g_txq_len == 0) g_tx_progress_ms = now_ms();
+    h[0] = type;
+    h[1] = 0;
+    h[2] = id >> 8;
+    h[3] = id;
+    h[4] = len >> 8;
+    h[5] = len;
+    if (len) memcpy(h + TUNNEL_HDR, data, len);
+    g_txq_len += TUNNEL_HDR + len;
+
+    tunnel_flush();
+    return g_state == TUNNEL_UP;
+}
+
+static void tunnel_send_hello(void) {
+    uint8_t mac[6], ip[4];
+    char hello[160];
+    fmt_t f;
+
+    getSHAR(mac);
+    getSIPR(ip);
+    fmt_init(&f, hello, sizeof(hello));
+    fmt_str(&f, "{\"token\":");
+    fmt_json_str(&f, TUNNEL_TOKEN);
+    fmt_str(&f, ",\"mac\":\"");
+    for (int i = 0; i < 6; i++) {
+        if (i) fmt_char(&f, ':');
+        fmt_hex(&f, mac[i], 2);
+    }
+    fmt_str(&f, "\",\"ip\":\"");
+    fmt_ip(&f, ip);
+    fmt_str(&f, "\",\"board\":\"RP2350-POE-ETH-8DI-8RO\"}");
+    tunnel_send_frame(TUNNEL_HELLO, 0, hello, f.len);
+}
+
+/**
+ * Connection established (and TLS handshake done)
+ */
+static void tunnel_up(void) {
+    tunnel_set_state(TUNNEL_UP);
+    g_connects++;
+    g_last_rx_ms = g_last_tx_ms = now_ms();
+    printf("Tunnel: connected to %d.%d.%d.%d:%d\n",
+           g_hub_ip[0], g_hub_ip[1], g_hub_ip[2], g_hub_ip[3], TUNNEL_HUB_PORT);
+    tunnel_send_hello();
+}
+
+/**
+ * Handle one complete frame from the hub
+ */
+static void tunnel_frame(uint8_t type, uint16_t id, const uint8_t *payload, uint16_t len) {
+    switch (type) {
+        case TUNNEL_REQ:
+            memcpy(g_request, payload, len);
+            g_request[len] = '\0';
+            g_requests++;
+            g_resp_open = 1;
+            g_resp_id = id;
+            g_resp_start_us = time_us_32();
+            g_handler(g_request, len);
+            break;
+
+        case TUNNEL_PING:
+            // Echoed back, so it must fit one outgoing frame
+            if (len > TUNNEL_CHUNK) {
+                g_protocol_errors++;
+                break;
+            }
+            tunnel_send_frame(TUNNEL_PONG, id, payload, len);
+            break;
+
+        case TUNNEL_ACK:
+        case TUNNEL_TIME:
+            if (len == 4 && g_control) {
+                g_control(type, ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
+                                ((uint32_t)payload[2] << 8) | payload[3]);
+            }
+            break;
+
+        case TUNNEL_PONG:
+            if (g_ping_us) {
+                stat_add(&g_ping_rtt_us, time_us_32() - g_ping_us);
+                g_ping_us = 0;
+            }
+            break;
+
+        default:
+            // Unknown frames are skipped for forward compatibility
+            break;
+    }
+}
+
+/**
+ * Parse buffered frames; stops while a response is still open or queued
+ */
+static void tunnel_parse(void) {
+    uint16_t off = 0;
+
+    while (g_state == TUNNEL_UP && !g_resp_open && !g_txq_len && g_rx_len - off >= TUNNEL_HDR) {
+        const uint8_t *h = g_rx + off;
+        uint16_t id = (h[2] << 8) | h[3];
+        uint16_t len = (h[4] << 8) | h[5];
+
+        if (len > MAX_HTTP_BUF) {
+            g_protocol_errors++;
+            tunnel_close("frame too large");
+            return;
+        }
+        if (g_rx_len - off < TUNNEL_HDR + len) break;
+
+        off += TUNNEL_HDR + len;
+        tunnel_frame(h[0], id, h + TUNNEL_HDR, len);
+    }
+
+    if (g_state != TUNNEL_UP) return;
+    if (off) {
+        memmove(g_rx, g_rx + off, g_rx_len - off);
+        g_rx_len -= off;
+    }
+}
+
+/**
+ * Start backoff state (socket not opened until the hub is due)
+ */
+void tunnel_init(tunnel_request_handler_t handler, tunnel_control_handler_t control) {
+    g_handler = handler;
+    g_control = control;
+    g_backoff_ms = TUNNEL_BACKOFF_MIN_MS;
+    g_retry_at_ms = now_ms();
+    tunnel_set_state(TUNNEL_IDLE);
+#if TUNNEL_TLS
+    tls_init();
+#endif
+    printf("Tunnel: hub %d.%d.%d.%d:%d%s\n", g_hub_ip[0], g_hub_ip[1], g_hub_ip[2], g_hub_ip[3],
+           TUNNEL_HUB_PORT, TUNNEL_TLS ? " (TLS)" : "");
+}
+
+/**
+ * Connect, read frames, keep-alive (main loop)
+ */
+void tunnel_service(void) {
+    uint32_t now = now_ms();
+    uint8_t sr = getSn_SR(TUNNEL_SOCKET);
+
+    switch (g_state) {
+        case TUNNEL_IDLE:
+#if TUNNEL_TLS
+            if (!g_tls_ready) return;
+#endif
+            if ((int32_t)(now - g_retry_at_ms) < 0) return;
+            // Non-blocking connect; completion is polled below
+            socket(TUNNEL_SOCKET, Sn_MR_TCP, 0, SF_IO_NONBLOCK);
+            connect(TUNNEL_SOCKET, (uint8_t *)g_hub_ip, TUNNEL_HUB_PORT);
+            tunnel_set_state(TUNNEL_CONNECTING);
+            return;
+
+        case TUNNEL_CONNECTING:
+            if (sr == SOCK_ESTABLISHED) {
+                setSn_KPALVTR(TUNNEL_SOCKET, TUNNEL_KEEPALIVE_MS / 5000);
+#if TUNNEL_TLS
+                mbedtls_ssl_session_reset(&g_ssl);
+                tunnel_set_state(TUNNEL_HANDSHAKE);
+#else
+                tunnel_up();
+#endif
+            } else if (sr == SOCK_CLOSED || now - g_state_ms > TUNNEL_TIMEOUT_MS) {
+                tunnel_close("connect failed");
+            }
+            return;
+
+#if TUNNEL_TLS
+        case TUNNEL_HANDSHAKE: {
+            int ret = mbedtls_ssl_handshake(&g_ssl);
+            if (ret == 0) {
+                tunnel_up();
+            } else if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                       now - g_state_ms > TUNNEL_TIMEOUT_MS) {
+                printf("Tunnel: TLS handshake failed (-0x%04x)\n", (unsigned)-ret);
+                tunnel_close("handshake");
+            }
+            return;
+        }
+#endif
+
+        case TUNNEL_UP:
+            break;
+
+        default:
+            return;
+    }
+
+    if (sr != SOCK_ESTABLISHED) {
+        tunnel_close("connection lost");
+        return;
+    }
+
+    tunnel_flush();
+    if (g_state != TUNNEL_UP) return;
+    if (g_txq_len && now - g_tx_progress_ms > TUNNEL_TIMEOUT_MS) {
+        g_tx_stalls++;
+        tunnel_close("send stalled");
+        return;
+    }
+
+    if (g_rx_len < sizeof(g_rx)) {
+        int n = tunnel_io_read(g_rx + g_rx_len, sizeof(g_rx) - g_rx_len);
+        if (n < 0) {
+            tunnel_close("read failed");
+            return;
+        }
+        if (n > 0) {
+            g_rx_len += n;
+            g_bytes_rx += n;
+            g_last_rx_ms = now;
+            // Hub is talking to us: the connection is good, reset the backoff
+            g_backoff_ms = TUNNEL_BACKOFF_MIN_MS;
+        }
+    }
+    tunnel_parse();
+    if (g_state != TUNNEL_UP) return;
+
+    if (now - g_last_rx_ms > TUNNEL_TIMEOUT_MS) {
+        tunnel_close("keep-alive timeout");
+        return;
+    }
+    if (now - g_last_tx_ms >= TUNNEL_KEEPALIVE_MS && !g_ping_us) {
+        g_ping_us = time_us_32();
+        tunnel_send_frame(TUNNEL_PING, 0, NULL, 0);
+    }
+}
+
+/**
+ * Hub connection is up
+ */
+int tunnel_connected(void) {
+    return g_state == TUNNEL_UP;
+}
+
+/**
+ * Everything queued has been written to the socket
+ */
+int tunnel_tx_idle(void) {
+    return g_txq_len == 0;
+}
+
+/**
+ * Response bytes for the open request, split into RESP frames; a response
+ * larger than the send queue closes the link (the hub sees it cut short)
+ */
+void tunnel_write(const void *data, uint16_t len) {
+    const uint8_t *p = data;
+
+    while (len > 0 && g_resp_open) {
+        uint16_t n = len > TUNNEL_CHUNK ? TUNNEL_CHUNK : len;
+        if (!tunnel_send_frame(TUNNEL_RESP, g_resp_id, p, n)) {
+            if (g_state == TUNNEL_UP) tunnel_close("send queue full");
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+/**
+ * Close the open response and resume reading requests
+ */
+void tunnel_end_response(void) {
+    if (!g_resp_open) return;
+    if (!tunnel_send_frame(TUNNEL_END, g_resp_id, NULL, 0)) {
+        if (g_state == TUNNEL_UP) tunnel_close("send queue full");
+        return;
+    }
+    stat_add(&g_req_us, time_us_32() - g_resp_start_us);
+    g_resp_open = 0;
+}
+
+/**
+ * Push JSON event to the hub; 0 if the tunnel is down, it exceeds TUNNEL_CHUNK
+ * or the send queue is full (telemetry resends it later)
+ */
+int tunnel_event(const char *json) {
+    if (!tunnel_send_frame(TUNNEL_EVENT, 0, json, strlen(json))) {
+        g_events_dropped++;
+        return 0;
+    }
+    g_events++;
+    return 1;
+}
+
+/**
+ * Render tunnel statistics in Prometheus text format
+ */
+void tunnel_metrics(fmt_t *f) {
+    fmt_metric(f, "tunnel_up", g_state == TUNNEL_UP);
+    fmt_metric(f, "tunnel_connects_total", g_connects);
+    fmt_metric(f, "tunnel_disconnects_total", g_disconnects);
+    fmt_metric(f, "tunnel_backoff_ms", g_backoff_ms);
+    fmt_metric(f, "tunnel_requests_total", g_requests);
+    fmt_metric(f, "tunnel_events_total", g_events);
+    fmt_metric(f, "tunnel_events_dropped_total", g_events_dropped);
+    fmt_metric(f, "tunnel_protocol_errors_total", g_protocol_errors);
+    fmt_metric(f, "tunnel_tx_queued_bytes", g_txq_len);
+    fmt_metric(f, "tunnel_tx_stalls_total", g_tx_stalls);
+    fmt_metric(f, "tunnel_tx_bytes_total", g_bytes_tx);
+    fmt_metric(f, "tunnel_rx_bytes_total", g_bytes_rx);
+    fmt_metric(f, "tunnel_ping_rtt_avg_us", g_ping_rtt_us.n ? g_ping_rtt_us.sum / g_ping_rtt_us.n : 0);
+    fmt_metric(f, "tunnel_request_avg_us", g_req_us.n ? g_req_us.sum / g_req_us.n : 0);
+    fmt_metric(f, "tunnel_request_max_us", g_req_us.max);
+}
+
+#endif /* TUNNEL_ENABLE */
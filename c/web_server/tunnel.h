@@ -0,0 +1,43 @@
+/**
+ * Hub Tunnel (outbound control channel)
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _TUNNEL_H_
+#define _TUNNEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "fmt.h"
+
+// Frame types (6-byte header: type, flags, id BE16, len BE16)
+#define TUNNEL_HELLO    1       // Board -> hub: identification and token
+#define TUNNEL_REQ      2       // Hub -> board: raw HTTP request
+#define TUNNEL_RESP     3       // Board -> hub: response bytes for request id
+#define TUNNEL_END      4       // Board -> hub: response complete
+#define TUNNEL_EVENT    5       // Board -> hub: JSON event
+#define TUNNEL_PING     6
+#define TUNNEL_PONG     7
+#define TUNNEL_ACK      8       // Hub -> board: telemetry acknowledged up to seq (BE32)
+#define TUNNEL_TIME     9       // Hub -> board: wall-clock time, unix seconds (BE32)
+
+// Request handler: writes its response with tunnel_write(), then tunnel_end_response()
+typedef void (*tunnel_request_handler_t)(char *request, uint16_t len);
+
+// Control handler: ACK / TIME frames with their 32-bit value
+typedef void (*tunnel_control_handler_t)(uint8_t type, uint32_t value);
+
+#if TUNNEL_ENABLE
+void tunnel_init(tunnel_request_handler_t handler, tunnel_control_handler_t control);
+void tunnel_service(void);
+int tunnel_connected(void);
+int tunnel_tx_idle(void);
+void tunnel_write(const void *data, uint16_t len);
+void tunnel_end_response(void);
+int tunnel_event(const char *json);
+void tunnel_metrics(fmt_t *f);
+#endif
+
+#endif /* _TUNNEL_H_ */
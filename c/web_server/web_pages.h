@@ -6,6 +6,12 @@
 #ifndef _WEB_PAGES_H_
 #define _WEB_PAGES_H_
 
+// Slots of HTML_PAGE filled with live state when it is served (see tmpl.c)
+#define PAGE_SLOT(n)        "\x01" #n
+#define PAGE_SLOT_RELAYS    0   // Relay cards as of the request
+#define PAGE_SLOT_IP        1   // Board address
+#define PAGE_SLOT_COUNT     2
+
 // Main HTML page (minified)
 const char HTML_PAGE[] =
 "<!DOCTYPE html>"
@@ -34,6 +40,10 @@ const char HTML_PAGE[] =
 ".buttons button:first-child:hover{background:#218838}"
 ".buttons button:last-child{background:#dc3545;color:white}"
 ".buttons button:last-child:hover{background:#c82333}"
+".charts{display:grid;grid-template-columns:repeat(auto-fit,minmax(350px,1fr));gap:20px;margin-top:30px}"
+".chart-card{background:white;border-radius:10px;padding:20px;box-shadow:0 2px 5px rgba(0,0,0,0.1)}"
+".chart-card h3{margin-bottom:10px;color:#333}"
+".chart-card canvas{width:100%;height:160px}"
 ".footer{text-align:center;margin-top:30px;color:#666}"
 "</style>"
 "</head><body>"
@@ -44,8 +54,12 @@ const char HTML_PAGE[] =
 "<button class=\"danger\" onclick=\"allOff()\">All OFF</button>"
 "<button onclick=\"refresh()\">Refresh</button>"
 "</div>"
-"<div class=\"relay-grid\" id=\"relays\"></div>"
-"<div class=\"footer\"><p>Waveshare RP2350-POE-ETH-8DI-8RO</p><p>IP: 192.168.1.100</p></div>"
+"<div class=\"relay-grid\" id=\"relays\">" PAGE_SLOT(0) "</div>"
+"<div class=\"charts\">"
+"<div class=\"chart-card\"><h3>Power, W: <span id=\"v-power_dw\">-</span></h3><canvas id=\"c-power_dw\"></canvas></div>"
+"<div class=\"chart-card\"><h3>Chip temperature, &deg;C: <span id=\"v-temp_dc\">-</span></h3><canvas id=\"c-temp_dc\"></canvas></div>"
+"</div>"
+"<div class=\"footer\"><p>Waveshare RP2350-POE-ETH-8DI-8RO</p><p>IP: " PAGE_SLOT(1) "</p></div>"
 "</div>"
 "<script>"
 "async function setRelay(relay,state){"
@@ -74,29 +88,54 @@ const char HTML_PAGE[] =
 "el.textContent=state?'ON':'OFF';"
 "el.className='status '+(state?'on':'off');"
 "}"
-"async function loadRelays(){"
+"function watchRelays(){"
+"const es=new EventSource('/api/events');"
+"es.addEventListener('relays',e=>{"
+"const relays=JSON.parse(e.data);"
+"for(let i=1;i<=8;i++)updateStatus(i,relays[`relay_${i}`].state);"
+"});"
+"}"
+"const SPAN=3600;"
+"const charts={power_dw:{next:0,t:[],v:[]},temp_dc:{next:0,t:[],v:[]}};"
+"async function loadCharts(){"
+"const ms=Object.keys(charts);"
 "try{"
-"const r=await fetch('/api/relays');"
-"const relays=await r.json();"
-"const grid=document.getElementById('relays');"
-"grid.innerHTML='';"
-"for(let i=1;i<=8;i++){"
-"const relay=relays[`relay_${i}`];"
-"const card=document.createElement('div');"
-"card.className='relay-card';"
-"card.innerHTML=`<h3>Relay ${i}</h3>`+"
-"`<div class=\"status ${relay.state?'on':'off'}\" id=\"status-${i}\">${relay.state?'ON':'OFF'}</div>`+"
-"`<div class=\"buttons\">`+"
-"`<button onclick=\"setRelay(${i},1)\">Turn ON</button>`+"
-"`<button onclick=\"setRelay(${i},0)\">Turn OFF</button>`+"
-"`</div>`;"
-"grid.appendChild(card);"
+"const r=await fetch(`/api/history?metric=${ms.join(',')}&format=bin&since=${ms.map(m=>charts[m].next).join(',')}`);"
+"const d=new DataView(await r.arrayBuffer());"
+"let o=0;"
+"for(const m of ms){"
+"const c=charts[m];"
+"const next=d.getUint32(o,true),now=d.getUint32(o+4,true),first=d.getUint32(o+8,true),n=d.getUint16(o+12,true);"
+"if(first!=c.next){c.t=[];c.v=[];}"
+"for(let i=0;i<n;i++){c.t.push(d.getUint32(o+16+i*8,true));c.v.push(d.getInt32(o+20+i*8,true));}"
+"o+=16+n*8;"
+"c.next=next;"
+"while(c.t.length&&c.t[0]<now-SPAN){c.t.shift();c.v.shift();}"
+"draw(m,now);"
+"}"
+"}catch(e){console.error('Error loading history:',e);}"
 "}"
-"}catch(e){console.error('Error loading relays:',e);}"
+"function draw(m,now){"
+"const c=charts[m],cv=document.getElementById(`c-${m}`),g=cv.getContext('2d');"
+"const w=cv.width=cv.clientWidth,h=cv.height=cv.clientHeight;"
+"g.clearRect(0,0,w,h);"
+"if(!c.v.length)return;"
+"let lo=Math.min(...c.v),hi=Math.max(...c.v);"
+"if(hi==lo){hi++;lo--;}"
+"const span=Math.max(60,Math.min(SPAN,now-c.t[0]));"
+"const x=t=>(t-now+span)/span*w,y=v=>h-4-(v-lo)/(hi-lo)*(h-8);"
+"g.strokeStyle='#007bff';g.lineWidth=1.5;g.beginPath();"
+"c.t.forEach((t,i)=>i?g.lineTo(x(t),y(c.v[i])):g.moveTo(x(t),y(c.v[i])));"
+"g.stroke();"
+"g.fillStyle='#666';g.font='11px Arial';"
+"g.fillText((hi/10).toFixed(1),2,12);"
+"g.fillText((lo/10).toFixed(1),2,h-2);"
+"document.getElementById(`v-${m}`).textContent=(c.v[c.v.length-1]/10).toFixed(1);"
 "}"
 "function refresh(){location.reload();}"
-"loadRelays();"
-"setInterval(loadRelays,5000);"
+"loadCharts();"
+"watchRelays();"
+"setInterval(loadCharts,10000);"
 "</script>"
 "</body></html>";
 
@@ -0,0 +1,425 @@
+/**
+ * Zero-Cross Synchronized Relay Switching
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ *
+ * A mains zero-cross detector on a spare DI channel is timestamped by
+ * the PIO sampler (1 us). Its edges are claimed from the sampler so they
+ * never reach history or telemetry, and give the edge period (checked
+ * against the PZEM frequency when available).
+ *
+ * Relay changes from the command bus are not written immediately. Each
+ * changed relay gets an alarm at the predicted zero crossing plus the
+ * configured phase, minus that relay's actuation (or release) delay as
+ * measured by the relay self-test, so the contact itself moves at the
+ * chosen phase. Without a locked zero-cross signal relays switch at once.
+ *
+ * With a relay contact looped back to a DI, the contact edge is compared
+ * with the target time to measure the switching-phase error.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+
+#include "config.h"
+#include "zc.h"
+#include "cpu.h"
+#include "fmt.h"
+#include "di_sampler.h"
+#include "relay_test.h"
+
+#if ZC_ENABLE
+
+// Edge period in 1/16 us
+#define ZC_Q                16
+// Contact edge expected within this after the alarm fired
+#define ZC_MEASURE_WINDOW_US 100000
+
+typedef struct {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} stat_t;
+
+// Switching-phase error from the DI loopback (contact edge - target)
+typedef struct {
+    uint32_t n;
+    uint32_t missed;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint64_t sum_abs;
+} zc_error_t;
+
+typedef struct {
+    volatile alarm_id_t alarm;      // Pending switch, 0 = none
+    volatile uint8_t target;        // State the alarm applies
+    uint32_t fire_us;
+    uint32_t switches;              // Synchronized switches
+    // Loopback measurement in progress
+    uint8_t measuring;
+    uint32_t meas_fire_us;
+    uint32_t meas_contact_us;
+    zc_error_t error;
+} zc_relay_t;
+
+static const uint8_t g_loopback_di[RELAY_COUNT] = ZC_LOOPBACK_DI;
+
+static zc_relay_t g_relays[RELAY_COUNT];
+
+// Detector tracking
+static uint32_t g_last_edge_us;
+static uint32_t g_period_q;         // Filtered edge period, 1/16 us
+static uint32_t g_valid_edges;      // Consecutive edges within the expected period
+static uint32_t g_pzem_period_us;   // From PZEM frequency, 0 = unknown
+static uint32_t g_edges;
+static uint32_t g_glitches;         // Edges too soon after the previous one
+static uint32_t g_resyncs;          // Gaps longer than a period
+static stat_t g_jitter_us;          // |edge interval - filtered period|
+
+// Switching
+static uint32_t g_immediate;        // Switched at once (not in ZC_RELAYS or not locked)
+static uint32_t g_unlocked;         // ... of which because the detector was not locked
+static stat_t g_fire_late_us;       // Alarm callback behind its target
+
+static void stat_add(stat_t *s, uint32_t v) {
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (s->n == 0 || v > s->max) s->max = v;
+    s->sum += v;
+    s->n++;
+}
+
+static uint32_t stat_avg(const stat_t *s) {
+    return s->n ? (uint32_t)(s->sum / s->n) : 0;
+}
+
+/**
+ * Plausible edge interval range, us
+ */
+static void zc_period_range(uint32_t *lo, uint32_t *hi) {
+    if (g_pzem_period_us) {
+        *lo = g_pzem_period_us - g_pzem_period_us / 20;
+        *hi = g_pzem_period_us + g_pzem_period_us / 20;
+    } else {
+        // 45-65 Hz mains
+        *lo = 1000000 / (65 * ZC_EDGES_PER_CYCLE);
+        *hi = 1000000 / (45 * ZC_EDGES_PER_CYCLE);
+    }
+}
+
+/**
+ * Zero-cross detector edge handler (claimed DI channel)
+ */
+static void zc_on_detector(uint32_t t_us, uint8_t pins, uint8_t changed) {
+    if (!pins) return;          // Rising edges only
+
+    uint32_t dt = t_us - g_last_edge_us;
+    uint32_t lo, hi;
+
+    g_edges++;
+    zc_period_range(&lo, &hi);
+
+    if (g_valid_edges && dt < lo) {
+        // Detector noise: keep the previous reference edge
+        g_glitches++;
+        return;
+    }
+    g_last_edge_us = t_us;
+
+    if (!g_valid_edges || dt > hi) {
+        // First edge or missed edges: restart the lock from here
+        if (g_valid_edges) g_resyncs++;
+        g_valid_edges = 1;
+        g_period_q = 0;
+        return;
+    }
+
+    if (!g_period_q) {
+        g_period_q = dt * ZC_Q;
+    } else {
+        int32_t diff = (int32_t)(dt * ZC_Q - g_period_q);
+        stat_add(&g_jitter_us, (uint32_t)(diff < 0 ? -diff : diff) / ZC_Q);
+        g_period_q += diff / 8;
+    }
+    if (g_valid_edges < 0xFFFFFFFF) g_valid_edges++;
+}
+
+static int zc_locked(uint32_t now) {
+    return g_valid_edges > ZC_LOCK_EDGES && g_period_q &&
+           now - g_last_edge_us < ZC_TIMEOUT_MS * 1000u;
+}
+
+/**
+ * Alarm callback: switch one relay at its computed time
+ */
+static int64_t zc_alarm_cb(alarm_id_t id, void *user_data) {
+    uint8_t prev = cpu_enter(CPU_IRQ);
+    zc_relay_t *rl = &g_relays[(uintptr_t)user_data];
+    int32_t late = (int32_t)(time_us_32() - rl->fire_us);
+
+    gpio_put(RELAY_CH1 + (uintptr_t)user_data, rl->target);
+    stat_add(&g_fire_late_us, late > 0 ? (uint32_t)late : 0);
+    rl->alarm = 0;
+    cpu_leave(prev);
+    return 0;
+}
+
+static void zc_cancel(zc_relay_t *rl) {
+    uint32_t irq = save_and_disable_interrupts();
+    alarm_id_t id = rl->alarm;
+    rl->alarm = 0;
+    restore_interrupts(irq);
+    if (id > 0) cancel_alarm(id);
+}
+
+/**
+ * Arm the alarm so relay r's contact moves at the next usable zero crossing
+ */
+static void zc_schedule(uint8_t r, uint8_t on, uint32_t now) {
+    zc_relay_t *rl = &g_relays[r];
+    uint32_t act_us, rel_us;
+
+    if (!relay_test_delays(r, &act_us, &rel_us)) {
+        act_us = ZC_DEFAULT_ACT_US;
+        rel_us = ZC_DEFAULT_REL_US;
+    }
+
+    int64_t cycle_q = (int64_t)g_period_q * ZC_EDGES_PER_CYCLE;
+    int32_t offset = ZC_DETECTOR_US + (int32_t)(cycle_q * ZC_PHASE_DEG / 360 / ZC_Q);
+
+    // Fire time relative to now for the reference edge itself, then whole periods later
+    int64_t fire = (int32_t)(g_last_edge_us - now) + offset - (int32_t)(on ? act_us : rel_us);
+    int64_t need = ZC_LEAD_US - fire;
+    int64_t k = need <= 0 ? 0 : (need * ZC_Q + g_period_q - 1) / g_period_q;
+    fire += k * g_period_q / ZC_Q;
+
+    rl->target = on;
+    rl->fire_us = now + (uint32_t)fire;
+
+    if (g_loopback_di[r]) {
+        if (rl->measuring) rl->error.missed++;
+        rl->measuring = 1;
+        rl->meas_fire_us = rl->fire_us;
+        rl->meas_contact_us = rl->fire_us + (on ? act_us : rel_us);
+    }
+
+    // Interrupts off: the callback can't run (and clear rl->alarm) before the id is stored
+    uint32_t irq = save_and_disable_interrupts();
+    uint64_t t64 = time_us_64();
+    alarm_id_t id = add_alarm_at(from_us_since_boot(t64 + (int32_t)(rl->fire_us - (uint32_t)t64)),
+                                 zc_alarm_cb, (void *)(uintptr_t)r, true);
+    if (id > 0) rl->alarm = id;
+    restore_interrupts(irq);
+
+    if (id > 0) {
+        rl->switches++;
+    } else if (id < 0) {
+        // No alarm slot: don't lose the command
+        gpio_put(RELAY_CH1 + r, on);
+        rl->measuring = 0;
+        g_immediate++;
+    } else {
+        rl->switches++;     // Target already passed, fired inline
+    }
+}
+
+/**
+ * Apply a relay change (command bus): ZC_RELAYS at the zero crossing, the rest now
+ */
+void zc_switch(uint8_t changed, uint8_t mask) {
+    uint32_t now = time_us_32();
+    uint8_t sync = changed & ZC_RELAYS;
+
+    if (sync && !zc_locked(now)) {
+        g_unlocked += __builtin_popcount(sync);
+        sync = 0;
+    }
+
+    uint8_t now_mask = changed & ~sync;
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        if (!(changed & (1u << r))) continue;
+        zc_cancel(&g_relays[r]);
+        if (now_mask & (1u << r)) g_relays[r].measuring = 0;
+    }
+    if (now_mask) {
+        gpio_put_masked((uint32_t)now_mask << RELAY_CH1, (uint32_t)mask << RELAY_CH1);
+        g_immediate += __builtin_popcount(now_mask);
+    }
+
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        if (!(sync & (1u << r))) continue;
+        uint8_t on = (mask >> r) & 1;
+        // A pending switch was cancelled before it moved the contact
+        if (gpio_get_out_level(RELAY_CH1 + r) == on) {
+            g_relays[r].measuring = 0;
+            continue;
+        }
+        zc_schedule(r, on, now);
+    }
+}
+
+/**
+ * Loopback DI edge handler: contact edge vs target time
+ */
+static void zc_on_input_edge(uint32_t t_us, uint8_t pins, uint8_t changed) {
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        zc_relay_t *rl = &g_relays[r];
+        zc_error_t *e = &rl->error;
+
+        if (!rl->measuring || !(changed & (1u << (g_loopback_di[r] - 1)))) continue;
+        if ((int32_t)(t_us - rl->meas_fire_us) < 0) continue;   // Before the switch
+
+        rl->measuring = 0;
+        if (t_us - rl->meas_fire_us > ZC_MEASURE_WINDOW_US) {
+            e->missed++;
+            continue;
+        }
+
+        int32_t err = (int32_t)(t_us - rl->meas_contact_us);
+        if (e->n == 0 || err < e->min) e->min = err;
+        if (e->n == 0 || err > e->max) e->max = err;
+        e->sum += err;
+        e->sum_abs += err < 0 ? -err : err;
+        e->n++;
+    }
+}
+
+/**
+ * Relays with a synchronized switch still pending (an alarm will drive them)
+ */
+uint8_t zc_pending_mask(void) {
+    uint8_t mask = 0;
+
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        if (g_relays[r].alarm) mask |= 1u << r;
+    }
+    return mask;
+}
+
+/**
+ * Mains frequency from the PZEM (0.1 Hz) narrows the accepted edge period
+ */
+void zc_set_mains_freq(int32_t freq_dhz) {
+    g_pzem_period_us = (freq_dhz >= 400 && freq_dhz <= 700) ?
+                       10000000u / (freq_dhz * ZC_EDGES_PER_CYCLE) : 0;
+}
+
+/**
+ * Claim the detector channel and watch loopback DIs
+ */
+void zc_init(void) {
+    memset(g_relays, 0, sizeof(g_relays));
+    di_sampler_claim(1u << (ZC_DI - 1), zc_on_detector);
+    di_sampler_subscribe(zc_on_input_edge);
+
+    printf("Zero-cross switching: detector DI%d, phase %d deg, relays %02X\n",
+           ZC_DI, ZC_PHASE_DEG, ZC_RELAYS);
+}
+
+/**
+ * Render detector state, switching and loopback accuracy as JSON
+ */
+void zc_json(char *buffer, size_t bufsize) {
+    uint32_t period_us = g_period_q / ZC_Q;
+    uint32_t freq_dhz = g_period_q ?
+        (uint32_t)(10000000ull * ZC_Q / ((uint64_t)g_period_q * ZC_EDGES_PER_CYCLE)) : 0;
+    fmt_t f;
+
+    fmt_init(&f, buffer, bufsize);
+    fmt_str(&f, "{\"di\":");
+    fmt_u32(&f, ZC_DI);
+    fmt_key(&f, "locked");
+    fmt_bool(&f, zc_locked(time_us_32()));
+    fmt_key(&f, "period_us");
+    fmt_u32(&f, period_us);
+    fmt_key(&f, "freq_dhz");
+    fmt_u32(&f, freq_dhz);
+    fmt_key(&f, "pzem_period_us");
+    fmt_u32(&f, g_pzem_period_us);
+    fmt_key(&f, "phase_deg");
+    fmt_i32(&f, ZC_PHASE_DEG);
+    fmt_key(&f, "detector_us");
+    fmt_i32(&f, ZC_DETECTOR_US);
+    fmt_key(&f, "edges");
+    fmt_u32(&f, g_edges);
+    fmt_key(&f, "glitches");
+    fmt_u32(&f, g_glitches);
+    fmt_key(&f, "resyncs");
+    fmt_u32(&f, g_resyncs);
+    fmt_key(&f, "jitter_us");
+    fmt_char(&f, '[');
+    fmt_u32(&f, stat_avg(&g_jitter_us));
+    fmt_char(&f, ',');
+    fmt_u32(&f, g_jitter_us.max);
+    fmt_char(&f, ']');
+    fmt_key(&f, "immediate");
+    fmt_u32(&f, g_immediate);
+    fmt_key(&f, "unlocked");
+    fmt_u32(&f, g_unlocked);
+    fmt_key(&f, "fire_late_us");
+    fmt_char(&f, '[');
+    fmt_u32(&f, stat_avg(&g_fire_late_us));
+    fmt_char(&f, ',');
+    fmt_u32(&f, g_fire_late_us.max);
+    fmt_char(&f, ']');
+    fmt_key(&f, "relays");
+    fmt_char(&f, '[');
+
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        const zc_relay_t *rl = &g_relays[r];
+        const zc_error_t *e = &rl->error;
+        uint32_t act_us, rel_us;
+        int measured = relay_test_delays(r, &act_us, &rel_us);
+
+        if (!measured) {
+            act_us = ZC_DEFAULT_ACT_US;
+            rel_us = ZC_DEFAULT_REL_US;
+        }
+        fmt_sep(&f);
+        fmt_str(&f, "{\"relay\":");
+        fmt_u32(&f, r + 1);
+        fmt_key(&f, "sync");
+        fmt_bool(&f, (ZC_RELAYS >> r) & 1);
+        fmt_key(&f, "act_us");
+        fmt_u32(&f, act_us);
+        fmt_key(&f, "rel_us");
+        fmt_u32(&f, rel_us);
+        fmt_key(&f, "measured");
+        fmt_bool(&f, measured);
+        fmt_key(&f, "switches");
+        fmt_u32(&f, rl->switches);
+        if (g_loopback_di[r]) {
+            // Phase error in 0.1 degree of the mains cycle
+            uint64_t cycle_q = (uint64_t)g_period_q * ZC_EDGES_PER_CYCLE;
+            uint32_t mean_abs = e->n ? (uint32_t)(e->sum_abs / e->n) : 0;
+
+            fmt_key(&f, "loopback");
+            fmt_str(&f, "{\"di\":");
+            fmt_u32(&f, g_loopback_di[r]);
+            fmt_key(&f, "n");
+            fmt_u32(&f, e->n);
+            fmt_key(&f, "missed");
+            fmt_u32(&f, e->missed);
+            fmt_key(&f, "err_us");
+            fmt_char(&f, '[');
+            fmt_i32(&f, e->n ? e->min : 0);
+            fmt_char(&f, ',');
+            fmt_i32(&f, e->n ? (int32_t)(e->sum / e->n) : 0);
+            fmt_char(&f, ',');
+            fmt_i32(&f, e->n ? e->max : 0);
+            fmt_char(&f, ']');
+            fmt_key(&f, "abs_err_us");
+            fmt_u32(&f, mean_abs);
+            fmt_key(&f, "abs_err_ddeg");
+            fmt_u32(&f, cycle_q ? (uint32_t)(mean_abs * 3600ull * ZC_Q / cycle_q) : 0);
+            fmt_char(&f, '}');
+        }
+        fmt_char(&f, '}');
+    }
+    fmt_str(&f, "]}");
+}
+
+#endif /* ZC_ENABLE */
@@ -0,0 +1,22 @@
+/**
+ * Zero-Cross Synchronized Relay Switching
+ * Waveshare RP2350-POE-ETH-8DI-8RO
+ */
+
+#ifndef _ZC_H_
+#define _ZC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+#if ZC_ENABLE
+void zc_init(void);
+void zc_switch(uint8_t changed, uint8_t mask);
+uint8_t zc_pending_mask(void);
+void zc_set_mains_freq(int32_t freq_dhz);
+void zc_json(char *buffer, size_t bufsize);
+#endif
+
+#endif /* _ZC_H_ */
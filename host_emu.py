@@ -0,0 +1,521 @@
+"""
+Host emulator for the MicroPython server (w5500_lib/webserver_simple.py)
+Run: python host_emu.py [--port 8080] [--speed 1] [--ticks-start 0] [-v]
+
+Runs webserver_simple.py unmodified under CPython. Its imports of machine,
+dht, time, gc and w5500_simple get host fakes instead:
+- W5500 socket 0 is a real TCP listener on --port, with the chip's
+  behaviour: one connection at a time, a 2 KB RX buffer, no listener
+  while a connection is being served (other clients are refused; a
+  handshake the host queued just before is reset without data)
+- relays and inputs are plain pin values the harness can read and set
+- the PZEM-004T answers Modbus reads with Board.meter values; the DHT22
+  returns Board.climate
+- time.ticks_ms() runs on a virtual clock that can run faster than real
+  time and start anywhere, so ticks_ms wrap (2^30 ms) is hours away, not
+  12 days
+
+The C firmware (c/web_server) needs the Pico SDK and does not run here;
+the harnesses built on this module take a real board address for it.
+
+Other tools import Board; see trace_replay.py, soak.py, bench_stacks.py
+and bench_protocols.py.
+"""
+import argparse
+import builtins
+import os
+import select
+import socket
+import sys
+import threading
+import time
+import types
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SERVER = os.path.join(HERE, "w5500_lib", "webserver_simple.py")
+
+TICKS_PERIOD = 1 << 30          # MicroPython ticks_ms() wraps here on rp2
+RX_BUF = 2048                   # W5500 socket buffers as configured by the driver
+TX_CHUNK = 1024                 # Driver sends at most this per SEND command
+HEAP = 200 * 1024               # Reported by gc.mem_free() minus retained objects
+FIRST_DATA_S = 0.02             # Real time an accepted client gets to send its request
+
+class PowerCycle(BaseException):
+    """Raised inside the server thread to cut power (not caught by its except Exception)"""
+
+class Clock:
+    """Virtual millisecond clock: speed x real time, plus explicit jumps"""
+
+    def __init__(self, speed=1.0):
+        self.speed = speed
+        self.t0 = time.monotonic()
+        self.skipped = 0
+
+    def now_ms(self):
+        return self.skipped + (time.monotonic() - self.t0) * 1000 * self.speed
+
+    def advance(self, ms):
+        self.skipped += ms
+
+    def sleep_ms(self, ms):
+        if ms > 0:
+            time.sleep(ms / 1000 / self.speed)
+
+def ticks_diff(a, b):
+    half = TICKS_PERIOD // 2
+    return ((a - b + half) % TICKS_PERIOD) - half
+
+def ticks_add(t, delta):
+    return (t + delta) % TICKS_PERIOD
+
+def modbus_crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+class HostW5500:
+    """w5500_simple.W5500 with the chip's socket 0 mapped to a host TCP listener"""
+
+    SOCK_CLOSED = 0x00
+    SOCK_INIT = 0x13
+    SOCK_LISTEN_STATUS = 0x14
+    SOCK_ESTABLISHED = 0x17
+    SOCK_CLOSE_WAIT = 0x1C
+
+    def __init__(self, board):
+        self.board = board
+        self.ip = [0, 0, 0, 0]
+        self.state = self.SOCK_CLOSED
+        self.port = 0
+        self.listener = None
+        self.conn = None
+        self.rx = b""
+        self.fin = False
+
+    # Configuration registers
+    def set_mac(self, mac):
+        pass
+
+    def set_gateway(self, gw):
+        pass
+
+    def set_subnet(self, sn):
+        pass
+
+    def set_ip(self, ip):
+        self.ip = list(ip)
+
+    def get_ip(self):
+        return list(self.ip)
+
+    def get_link_status(self):
+        self.board.tick()
+        return self.board.link_up
+
+    # Socket 0 (other socket numbers are not used by the server)
+    def socket_open(self, sock, port, mode=0x01):
+        self.board.tick()
+        self._drop()
+        self.port = port
+        self.state = self.SOCK_INIT
+        return True
+
+    def socket_listen(self, sock):
+        if self.state != self.SOCK_INIT:
+            return False
+        if not self._listen():
+            return False
+        self.state = self.SOCK_LISTEN_STATUS
+        return True
+
+    def _listen(self):
+        try:
+            ls = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            ls.bind((self.board.host, self.board.port))
+            ls.listen(1)
+            ls.setblocking(False)
+        except OSError as e:
+            self.board.log(f"listen failed: {e}")
+            return False
+        self.listener = ls
+        return True
+
+    def socket_status(self, sock):
+        self.board.tick()
+        if not self.board.link_up:
+            # No link: connections die, new ones are refused instead of hanging
+            if self.state in (self.SOCK_ESTABLISHED, self.SOCK_CLOSE_WAIT):
+                self._drop()
+            elif self.listener:
+                self.listener.close()
+                self.listener = None
+        elif self.state == self.SOCK_LISTEN_STATUS and not self.listener:
+            self._listen()
+        if self.state == self.SOCK_LISTEN_STATUS and self.listener:
+            r, _, _ = select.select([self.listener], [], [], 0)
+            if r:
+                conn, _ = self.listener.accept()
+                # The chip has one socket: it stops listening while connected
+                self.listener.close()
+                self.listener = None
+                # On a LAN the request follows the handshake within a
+                # millisecond; with a fast clock host scheduling delays
+                # would otherwise hit the server's 50 ms wait for data
+                select.select([conn], [], [], FIRST_DATA_S)
+                conn.setblocking(False)
+                self.conn = conn
+                self.rx = b""
+                self.fin = False
+                self.state = self.SOCK_ESTABLISHED
+                self.board.stats["accepts"] += 1
+        if self.state == self.SOCK_ESTABLISHED:
+            self._pump()
+            if self.fin:
+                self.state = self.SOCK_CLOSE_WAIT
+        return self.state
+
+    def _pump(self):
+        """Move received bytes into the 2 KB RX buffer"""
+        if not self.conn or self.fin:
+            return
+        while len(self.rx) < RX_BUF:
+            try:
+                data = self.conn.recv(RX_BUF - len(self.rx))
+            except (BlockingIOError, InterruptedError):
+                return
+            except OSError:
+                self.fin = True
+                return
+            if not data:
+                self.fin = True
+                return
+            self.rx += data
+            self.board.stats["bytes_rx"] += len(data)
+
+    def socket_recv_available(self, sock):
+        self._pump()
+        return len(self.rx)
+
+    def socket_recv(self, sock, length=None):
+        self._pump()
+        n = len(self.rx) if length is None else min(length, len(self.rx))
+        data, self.rx = self.rx[:n], self.rx[n:]
+        return data
+
+    def socket_send(self, sock, data):
+        if not self.conn:
+            return 0
+        self.board.stats["send_cmds"] += (len(data) + TX_CHUNK - 1) // TX_CHUNK
+        try:
+            self.conn.setblocking(True)
+            self.conn.settimeout(2)
+            self.conn.sendall(data)
+            self.board.stats["bytes_tx"] += len(data)
+        except OSError:
+            self.board.stats["send_errors"] += 1
+        finally:
+            if self.conn:
+                self.conn.setblocking(False)
+        return len(data)
+
+    def socket_disconnect(self, sock):
+        if self.conn:
+            try:
+                self.conn.shutdown(socket.SHUT_WR)
+            except OSError:
+                pass
+        self._drop()
+
+    def socket_close(self, sock):
+        self._drop()
+
+    def _drop(self):
+        for s in (self.conn, self.listener):
+            if s:
+                s.close()
+        if self.conn:
+            self.board.stats["closes"] += 1
+        self.conn = self.listener = None
+        self.rx = b""
+        self.state = self.SOCK_CLOSED
+
+    def open_sockets(self):
+        return (self.conn is not None) + (self.listener is not None)
+
+class Board:
+    """One emulated board running the MicroPython server in a thread"""
+
+    RELAY_PINS = [17, 18, 19, 20, 21, 22, 23, 24]
+
+    def __init__(self, port=8080, host="127.0.0.1", clock=None, ticks_start=0, script=SERVER,
+                 verbose=False):
+        self.port = port
+        self.host = host
+        self.clock = clock or Clock()
+        self.ticks_start = ticks_start      # ticks_ms() right after reset
+        self.boot_ms = 0
+        self.script = script
+        self.verbose = verbose
+        self.pins = {}
+        self.meter = {"v": 230.0, "a": 1.5, "w": 345.0, "wh": 1200, "hz": 50.0, "pf": 0.98}
+        self.climate = (22.5, 40.0)
+        self.link_up = True
+        self.boots = 0
+        self.crash = None
+        self.ns = {}
+        self.w5500 = None
+        self.stats = dict(accepts=0, closes=0, bytes_rx=0, bytes_tx=0, send_cmds=0,
+                          send_errors=0)
+        self.stack_max = 0
+        self._power_cut = False
+        self._stopping = False
+        self._thread = None
+        self._ident = None
+        self._link_restore_ms = None
+        self.lines = []
+
+    # ---- control ----
+    def start(self):
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+        return self
+
+    def stop(self):
+        self._stopping = True
+        self._power_cut = True
+        if self._thread:
+            self._thread.join(5)
+
+    def power_cycle(self):
+        """Cut power: the server thread unwinds and boots again with fresh state"""
+        self._power_cut = True
+
+    def link_flap(self, down_ms):
+        """Take the Ethernet link down for down_ms of virtual time"""
+        self.link_up = False
+        self._link_restore_ms = self.clock.now_ms() + down_ms
+
+    def wait_ready(self, timeout=10):
+        """Block until the server listens on the host port"""
+        end = time.monotonic() + timeout
+        while time.monotonic() < end:
+            w = self.w5500
+            if w and w.state == w.SOCK_LISTEN_STATUS and w.listener:
+                return True
+            time.sleep(0.005)
+        return False
+
+    def relays(self):
+        return [self.pins.get(p, 0) for p in self.RELAY_PINS]
+
+    def set_input(self, gpio, value):
+        self.pins[gpio] = value
+
+    def cpu_seconds(self):
+        """CPU time used by the server thread"""
+        if self._ident is None:
+            return 0.0
+        try:
+            return time.clock_gettime(time.pthread_getcpuclockid(self._ident))
+        except (AttributeError, OSError):
+            return 0.0
+
+    def retained_bytes(self):
+        """Approximate size of the server's module-level data (lists, caches, buffers)"""
+        seen = set()
+
+        def size(obj, depth=0):
+            if id(obj) in seen or depth > 6:
+                return 0
+            seen.add(id(obj))
+            n = sys.getsizeof(obj)
+            if isinstance(obj, dict):
+                n += sum(size(k, depth + 1) + size(v, depth + 1) for k, v in obj.items())
+            elif isinstance(obj, (list, tuple, set)):
+                n += sum(size(v, depth + 1) for v in obj)
+            return n
+
+        return sum(size(v) for k, v in list(self.ns.items())
+                   if not k.startswith("__") and not isinstance(
+                       v, (types.ModuleType, types.FunctionType, type)) and
+                   not isinstance(v, (Fake, HostW5500)))
+
+    def ticks_ms(self):
+        return int(self.clock.now_ms() - self.boot_ms + self.ticks_start) % TICKS_PERIOD
+
+    def log(self, msg):
+        line = f"[emu {self.ticks_ms()}] {msg}"
+        self.lines.append(line)
+        del self.lines[:-200]
+        if self.verbose:
+            print(line)
+
+    # ---- called from the server thread ----
+    def tick(self):
+        if self._power_cut:
+            raise PowerCycle()
+        if self._link_restore_ms is not None and self.clock.now_ms() >= self._link_restore_ms:
+            self.link_up = True
+            self._link_restore_ms = None
+        depth, f = 0, sys._getframe()
+        while f:
+            depth += 1
+            f = f.f_back
+        if depth > self.stack_max:
+            self.stack_max = depth
+
+    def _print(self, *args, sep=" ", end="\n", **kw):
+        text = sep.join(str(a) for a in args)
+        self.lines.append(text)
+        del self.lines[:-200]
+        if self.verbose:
+            print(text, end=end)
+
+    def _modules(self):
+        board = self
+
+        class Pin:
+            IN, OUT, PULL_UP = 0, 1, 2
+
+            def __init__(self, pin, mode=0, pull=None, value=None):
+                self.pin = pin
+                if value is not None:
+                    board.pins[pin] = value
+                elif mode == Pin.IN and pull == Pin.PULL_UP:
+                    board.pins.setdefault(pin, 1)
+
+            def value(self, v=None):
+                if v is None:
+                    return board.pins.get(self.pin, 0)
+                board.pins[self.pin] = 1 if v else 0
+
+        class UART:
+            """PZEM-004T on the other end"""
+
+            def __init__(self, *a, **kw):
+                self.buf = b""
+
+            def any(self):
+                return len(self.buf)
+
+            def read(self, n=None):
+                data, self.buf = self.buf, b""
+                return data
+
+            def write(self, data):
+                if len(data) == 8 and data[1] == 0x04 and modbus_crc16(data[:6]) == data[6] | data[7] << 8:
+                    m = board.meter
+                    a, w = int(m["a"] * 1000), int(m["w"] * 10)
+                    regs = [int(m["v"] * 10), a & 0xFFFF, a >> 16, w & 0xFFFF, w >> 16,
+                            m["wh"] & 0xFFFF, m["wh"] >> 16, int(m["hz"] * 10), int(m["pf"] * 100), 0]
+                    body = bytes([data[0], 0x04, 20]) + b"".join(r.to_bytes(2, "big") for r in regs)
+                    crc = modbus_crc16(body)
+                    self.buf = body + bytes([crc & 0xFF, crc >> 8])
+                return len(data)
+
+        class SoftSPI:
+            def __init__(self, *a, **kw):
+                pass
+
+        class DHT22:
+            def __init__(self, pin):
+                pass
+
+            def measure(self):
+                if board.climate is None:
+                    raise OSError(110)      # ETIMEDOUT, as with no sensor
+
+            def temperature(self):
+                return board.climate[0]
+
+            def humidity(self):
+                return board.climate[1]
+
+        class W5500(HostW5500):
+            def __init__(self, spi, cs, rst=None):
+                super().__init__(board)
+                board.w5500 = self
+
+        clock = board.clock
+        fake_time = Fake("time", ticks_ms=board.ticks_ms, ticks_diff=ticks_diff, ticks_add=ticks_add,
+                         sleep_ms=lambda ms: (board.tick(), clock.sleep_ms(ms)),
+                         sleep=lambda s: clock.sleep_ms(s * 1000),
+                         time=lambda: clock.now_ms() / 1000)
+        fake_gc = Fake("gc", collect=lambda: None,
+                       mem_free=lambda: max(0, HEAP - board.retained_bytes()),
+                       mem_alloc=board.retained_bytes)
+        return {
+            "machine": Fake("machine", Pin=Pin, UART=UART, SoftSPI=SoftSPI),
+            "dht": Fake("dht", DHT22=DHT22),
+            "time": fake_time,
+            "gc": fake_gc,
+            "w5500_simple": Fake("w5500_simple", W5500=W5500),
+        }
+
+    def _run(self):
+        self._ident = threading.get_ident()
+        code = compile(open(self.script, encoding="utf-8").read(), self.script, "exec")
+
+        while not self._stopping:
+            modules = self._modules()
+
+            def _import(name, globals=None, locals=None, fromlist=(), level=0):
+                if name in modules:
+                    return modules[name]
+                return builtins.__import__(name, globals, locals, fromlist, level)
+
+            env = dict(vars(builtins))
+            env["__import__"] = _import
+            env["print"] = self._print
+            self.ns = {"__name__": "__main__", "__file__": self.script, "__builtins__": env}
+            self.pins = {}
+            self.boot_ms = self.clock.now_ms()
+            self.boots += 1
+            self._power_cut = False
+            try:
+                exec(code, self.ns)
+                return                          # Server loop returned (it never does)
+            except PowerCycle:
+                if self.w5500:
+                    self.w5500._drop()
+                self.log("power cycle" if not self._stopping else "stopped")
+            except Exception as e:              # Crash: keep it for the harness
+                self.crash = repr(e)
+                self.log(f"server crashed: {e!r}")
+                return
+
+class Fake(types.SimpleNamespace):
+    """Stand-in module"""
+
+    def __init__(self, name, **attrs):
+        super().__init__(**attrs)
+        self.__name__ = name
+
+def main():
+    ap = argparse.ArgumentParser(description="Run the MicroPython server on the host")
+    ap.add_argument("--port", type=int, default=8080, help="host TCP port for W5500 socket 0")
+    ap.add_argument("--speed", type=float, default=1.0, help="virtual clock speed (x real time)")
+    ap.add_argument("--ticks-start", type=int, default=0,
+                    help="ticks_ms at reset; e.g. %d wraps a minute after boot" % (TICKS_PERIOD - 60000))
+    ap.add_argument("-v", "--verbose", action="store_true", help="print server output")
+    args = ap.parse_args()
+
+    board = Board(args.port, clock=Clock(args.speed), ticks_start=args.ticks_start,
+                  verbose=args.verbose).start()
+    if not board.wait_ready():
+        print("Server did not start listening")
+        sys.exit(1)
+    print(f"Emulated board on http://127.0.0.1:{args.port} (clock x{args.speed:g})")
+    try:
+        while board._thread.is_alive():
+            time.sleep(0.5)
+        print(f"Server exited: {board.crash}")
+    except KeyboardInterrupt:
+        board.stop()
+
+if __name__ == "__main__":
+    main()
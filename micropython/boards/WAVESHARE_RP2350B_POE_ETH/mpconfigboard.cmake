@@ -0,0 +1,10 @@
+# cmake file for Waveshare RP2350-POE-ETH-8DI-8RO (RP2350B, W5500 on GPIO 33-36)
+set(PICO_BOARD "waveshare_rp2350b_poe_eth")
+set(PICO_BOARD_HEADER_DIRS ${MICROPY_BOARD_DIR})
+set(PICO_PLATFORM "rp2350")
+
+# W5500 in MACRAW mode with lwIP on top: regular socket module
+set(MICROPY_PY_LWIP 1)
+set(MICROPY_PY_NETWORK_WIZNET5K W5500)
+
+set(MICROPY_FROZEN_MANIFEST ${MICROPY_BOARD_DIR}/manifest.py)
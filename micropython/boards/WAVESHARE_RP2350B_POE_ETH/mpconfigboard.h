@@ -0,0 +1,27 @@
+// Board and hardware specific configuration
+#define MICROPY_HW_BOARD_NAME               "Waveshare RP2350-POE-ETH-8DI-8RO"
+#define MICROPY_HW_FLASH_STORAGE_BYTES      (PICO_FLASH_SIZE_BYTES - 1536 * 1024)
+
+// Enable networking
+#define MICROPY_PY_NETWORK                  (1)
+#define MICROPY_PY_NETWORK_HOSTNAME_DEFAULT "RP2350-POE-ETH"
+
+// Wiznet HW config: hardware SPI0 on the RP2350B high bank
+// (GPIO 34/35/36 are SPI0 SCK/TX/RX in the function table)
+#define MICROPY_HW_WIZNET_SPI_ID            (0)
+#define MICROPY_HW_WIZNET_SPI_BAUDRATE      (20 * 1000 * 1000)
+#define MICROPY_HW_WIZNET_SPI_SCK           (34)
+#define MICROPY_HW_WIZNET_SPI_MOSI          (35)
+#define MICROPY_HW_WIZNET_SPI_MISO          (36)
+#define MICROPY_HW_WIZNET_PIN_CS            (33)
+#define MICROPY_HW_WIZNET_PIN_RST           (25)
+// INTn is not routed to a GPIO on this board, the driver polls
+
+// Default SPI0 pins match the W5500 so machine.SPI(0) works without arguments
+#define MICROPY_HW_SPI0_SCK                 (34)
+#define MICROPY_HW_SPI0_MOSI                (35)
+#define MICROPY_HW_SPI0_MISO                (36)
+
+// PZEM-004T meter UART
+#define MICROPY_HW_UART1_TX                 (40)
+#define MICROPY_HW_UART1_RX                 (43)
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Build RP2350B MicroPython firmware
+#
+# Usage: ./build.sh [micropython_dir]
+#   default:                          WeAct RP2350B + frozen SoftSPI web server
+#   BOARD=WAVESHARE_RP2350B_POE_ETH:  native network.WIZNET5K on GPIO 33-36
+# Result: build/firmware.uf2
+
+set -e
+
+MPY_VERSION=v1.27.0
+BOARD=${BOARD:-WEACTSTUDIO_RP2350B_CORE}
+HERE=$(cd "$(dirname "$0")" && pwd)
+MPY_DIR=${1:-$HERE/build/micropython}
+
+if [ ! -d "$MPY_DIR" ]; then
+    git clone --depth 1 --branch $MPY_VERSION https://github.com/micropython/micropython.git "$MPY_DIR"
+fi
+
+# Boards kept in this repo build out of tree with their own manifest
+if [ -d "$HERE/boards/$BOARD" ]; then
+    BOARD_ARGS="BOARD_DIR=$HERE/boards/$BOARD"
+else
+    BOARD_ARGS="BOARD=$BOARD FROZEN_MANIFEST=$HERE/manifest.py"
+fi
+
+make -C "$MPY_DIR/mpy-cross" -j4
+make -C "$MPY_DIR/ports/rp2" $BOARD_ARGS submodules
+make -C "$MPY_DIR/ports/rp2" $BOARD_ARGS -j4
+
+mkdir -p "$HERE/build"
+cp "$MPY_DIR/ports/rp2/build-$BOARD/firmware.uf2" "$HERE/build/firmware.uf2"
+echo "Firmware: $HERE/build/firmware.uf2"
@@ -0,0 +1 @@
+import webserver_simple
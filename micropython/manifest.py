@@ -0,0 +1,12 @@
+# Frozen modules for the RP2350B web server firmware
+# Paths are relative to this file
+
+# Board defaults (asyncio, etc.)
+include("$(PORT_DIR)/boards/manifest.py")
+
+# W5500 driver and HTTP server, compiled to .mpy at build time
+module("w5500_simple.py", base_path="../w5500_lib")
+module("webserver_simple.py", base_path="../w5500_lib")
+
+# No frozen main.py: it would run before the filesystem one.
+# Boot entry is micropython/main.py copied to the board.
@@ -0,0 +1,487 @@
+"""
+Accelerated soak test of the MicroPython server on the host emulator
+Run: python soak.py [--hours 6] [--speed 30] [--clients 2] [--window 15]
+     python soak.py --hours 1 --speed 20 --csv soak.csv
+
+Runs webserver_simple.py in host_emu.py with its clock --speed times
+faster than real time (6 virtual hours at 30x take 12 minutes) and:
+- sends mixed traffic from --clients clients: state polls, page loads,
+  relay commands, pulses, logs, 404s, and connections that send nothing
+  or only half a request
+- takes the link down (--flap-every) and cuts power (--power-every)
+- starts ticks_ms shortly before its 2^30 ms wrap, so the wrap falls in
+  the middle of the run (--wrap-at; kept there across power cycles)
+- changes the DHT22 reading every virtual minute
+
+Every virtual second it samples W5500 socket use, host file descriptors,
+the server's retained data (what gc.mem_free() is computed from), the
+deepest server stack and the log/pulse lists. Per --window virtual
+minutes it keeps latency percentiles, errors, CPU per request and the
+maxima of the samples.
+
+Fails (exit code 1) when:
+- a per-window series trends upward: latency, CPU per request, sockets,
+  descriptors, retained bytes, stack depth or list lengths (robust slope
+  over the run beyond the metric's tolerance, windows mostly rising; the
+  first window is warm-up)
+- a relay pulse is restored early or late (5 s, checked across the wrap)
+- the DHT value served is staler than its 30 s cache allows
+- the server is not serving again --recovery-max virtual seconds after a
+  link flap or power cycle, or errors outside faults exceed --max-errors
+- the server thread crashes
+"""
+import argparse
+import os
+import random
+import socket
+import sys
+import threading
+import time
+
+from host_emu import Board, Clock, SERVER, TICKS_PERIOD
+
+PULSE_RELAY = 8             # Pulses go to relay 8; /r commands use 1..7
+PULSE_MS = 5000
+PULSE_TOL_MS = 1000         # Main loop passes: up to ~200 ms per served request
+DHT_CACHE_MS = 30000
+
+# Traffic mix: (weight, kind)
+MIX = [
+    (45, "api"),
+    (10, "page"),
+    (15, "relay"),
+    (4, "all"),
+    (8, "pulse"),
+    (6, "log"),
+    (5, "junk"),
+    (4, "silent"),      # Connect, send nothing
+    (3, "partial"),     # Request line without the blank line
+]
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+class Window:
+    """Statistics of one window of virtual time"""
+
+    def __init__(self, index):
+        self.index = index
+        self.latency = []
+        self.requests = 0
+        self.errors = 0             # Outside faults
+        self.fault_errors = 0
+        self.cpu0 = None
+        self.max = {}
+
+    def sample(self, name, value):
+        if value > self.max.get(name, value - 1):
+            self.max[name] = value
+
+    def row(self, cpu_s):
+        lat = self.latency or [0]
+        return {
+            "p50_ms": percentile(lat, 50),
+            "p99_ms": percentile(lat, 99),
+            "cpu_ms_req": cpu_s * 1000 / max(1, self.requests),
+            "requests": self.requests,
+            "errors": self.errors,
+            "fault_errors": self.fault_errors,
+            **self.max,
+        }
+
+# Series checked for upward trends: (name, absolute tolerance, relative tolerance)
+# Latencies are virtual ms: host scheduling noise is multiplied by --speed
+TRENDS = [
+    ("p50_ms", 50, 0.3),
+    ("p99_ms", 150, 0.5),
+    ("cpu_ms_req", 0.5, 0.25),
+    ("w5500_sockets", 0, 0),
+    ("host_fds", 2, 0),
+    ("threads", 0, 0),
+    ("retained_b", 512, 0.05),
+    ("stack_depth", 1, 0),
+    ("logs", 0, 0),
+    ("pulse_tasks", 0, 0),
+]
+
+TREND_TAU = 0.5            # Windows must mostly rise, not just end high
+
+def trend(values):
+    """(growth over the run, Kendall tau): Theil-Sen slope times the run
+    length, so one noisy window does not make a trend"""
+    slopes, concordant = [], 0
+    pairs = 0
+    for i in range(len(values)):
+        for j in range(i + 1, len(values)):
+            d = values[j] - values[i]
+            slopes.append(d / (j - i))
+            concordant += (d > 0) - (d < 0)
+            pairs += 1
+    slopes.sort()
+    return slopes[len(slopes) // 2] * (len(values) - 1), concordant / pairs
+
+class Soak:
+    def __init__(self, args):
+        self.args = args
+        self.clock = Clock(args.speed)
+        duration_ms = args.hours * 3600_000
+        self.wrap_ms = duration_ms * args.wrap_at
+        ticks_start = (TICKS_PERIOD - int(self.wrap_ms)) % TICKS_PERIOD
+        self.board = Board(args.port, clock=self.clock, ticks_start=ticks_start, script=args.script)
+        self.end_ms = duration_ms
+        self.rng = random.Random(args.seed)
+        self.lock = threading.Lock()
+        self.windows = [Window(0)]
+        self.failures = []
+        self.notes = []
+        self.faults = []            # (start_ms, end_ms) with recovery allowance
+        self.fault_active = None    # Start of the fault being recovered from
+        self.recoveries = []
+        self.pulse = None           # (sent_ms, toggled, restore, answered_ms)
+        self.pulses_ok = 0
+        self.dht_staleness = []
+        self.climate_set = []       # (virtual ms, temperature)
+        self.stop = False
+        self.wrapped_ms = None
+
+    def now(self):
+        return self.clock.now_ms()
+
+    def window(self):
+        return self.windows[-1]
+
+    def fail(self, msg):
+        with self.lock:
+            self.failures.append(f"[{self.now() / 60000:7.1f} min] {msg}")
+
+    # ---- client side ----
+    def request(self, raw, expect_response=True):
+        """One request on a fresh connection: response bytes or None.
+        Refused connects and resets before any data (the one socket was
+        busy) are retried for up to 2 s, as a browser would"""
+        deadline = time.monotonic() + 2
+        while True:
+            data = b""
+            try:
+                s = socket.create_connection(("127.0.0.1", self.args.port), timeout=2)
+            except ConnectionRefusedError:
+                if time.monotonic() > deadline:
+                    return None
+                time.sleep(0.002)
+                continue
+            except OSError:
+                return None
+            try:
+                if raw:
+                    s.sendall(raw)
+                if not expect_response:
+                    time.sleep(0.1 / self.args.speed)
+                    return b""
+                while True:
+                    chunk = s.recv(4096)
+                    if not chunk:
+                        break
+                    data += chunk
+                return data or None
+            except ConnectionResetError:
+                if data or time.monotonic() > deadline:
+                    return None
+                time.sleep(0.002)
+            except OSError:
+                return None
+            finally:
+                s.close()
+
+    def in_fault(self, t):
+        return any(a <= t <= b for a, b in self.faults) or self.fault_active is not None
+
+    def client(self, seed):
+        rng = random.Random(seed)
+        kinds = [k for w, k in MIX for _ in range(w)]
+        while not self.stop:
+            kind = rng.choice(kinds)
+            with self.lock:
+                if kind in ("pulse", "all") and self.pulse:
+                    kind = "api"
+                if kind == "pulse":
+                    self.pulse = (self.now(), None, None)
+            raw, expect = self.build(kind, rng)
+            t0 = self.now()
+            resp = self.request(raw, expect)
+            t1 = self.now()
+            self.account(kind, resp, t0, t1, expect)
+            self.clock.sleep_ms(rng.expovariate(self.args.rps / self.args.clients) * 1000)
+
+    def build(self, kind, rng):
+        if kind == "api":
+            return b"GET /api HTTP/1.1\r\nHost: board\r\n\r\n", True
+        if kind == "page":
+            return b"GET / HTTP/1.1\r\nHost: board\r\n\r\n", True
+        if kind == "relay":
+            n, v = rng.randint(1, PULSE_RELAY - 1), rng.randint(0, 1)
+            return f"GET /r?n={n}&s={v} HTTP/1.1\r\nHost: board\r\n\r\n".encode(), True
+        if kind == "all":
+            return f"GET /a?s={rng.randint(0, 1)} HTTP/1.1\r\nHost: board\r\n\r\n".encode(), True
+        if kind == "pulse":
+            return f"GET /p?n={PULSE_RELAY} HTTP/1.1\r\nHost: board\r\n\r\n".encode(), True
+        if kind == "log":
+            return b"GET /log HTTP/1.1\r\nHost: board\r\n\r\n", True
+        if kind == "junk":
+            return b"GET /favicon.ico HTTP/1.1\r\nHost: board\r\n\r\n", True
+        if kind == "silent":
+            return b"", False
+        return b"GET /api HTTP/1.1\r\nHost: bo", False
+
+    def account(self, kind, resp, t0, t1, expect):
+        with self.lock:
+            w = self.window()
+            w.requests += 1
+            if kind == "pulse":
+                if resp and resp.startswith(b"HTTP/1.1 302"):
+                    r = PULSE_RELAY - 1
+                    toggled = self.board.relays()[r]
+                    self.pulse = (t0, toggled, 1 - toggled, t1)
+                else:
+                    self.pulse = None
+            if not expect:
+                return
+            if not resp or not resp.startswith(b"HTTP/1.1 "):
+                if self.in_fault(t0) or self.in_fault(t1):
+                    w.fault_errors += 1
+                else:
+                    w.errors += 1
+                return
+            if self.fault_active is not None and t0 >= self.fault_active:
+                self.recoveries.append(t1 - self.fault_active)
+                if t1 - self.fault_active > self.args.recovery_max * 1000:
+                    self.failures.append(f"[{t1 / 60000:7.1f} min] serving again only "
+                                         f"{(t1 - self.fault_active) / 1000:.1f} s after a fault")
+                self.faults.append((self.fault_active, t1))
+                self.fault_active = None
+            w.latency.append(t1 - t0)
+            if kind == "api":
+                self.check_dht(resp, t0)
+
+    def check_dht(self, resp, t0):
+        body = resp.partition(b"\r\n\r\n")[2]
+        try:
+            t = float(body.split(b'"t":')[1].split(b",")[0])
+        except (IndexError, ValueError):
+            return
+        # Served value must be one set within the cache period before the request
+        for when, temp in reversed(self.climate_set):
+            if temp == t:
+                newer = [w for w, _ in self.climate_set if w > when]
+                if newer and t0 - newer[0] > DHT_CACHE_MS + PULSE_TOL_MS:
+                    self.failures.append(f"[{t0 / 60000:7.1f} min] DHT value {t} is "
+                                         f"{(t0 - newer[0]) / 1000:.0f} s stale")
+                self.dht_staleness.append(t0 - newer[0] if newer else 0)
+                return
+
+    # ---- harness side ----
+    def check_pulse(self):
+        with self.lock:
+            p = self.pulse
+            if not p or p[1] is None:
+                return
+            sent, toggled, restore, answered = p
+            now = self.now()
+            value = self.board.relays()[PULSE_RELAY - 1]
+            if value == restore:
+                took = now - sent
+                self.pulse = None
+                if took < PULSE_MS - PULSE_TOL_MS:
+                    self.failures.append(f"[{now / 60000:7.1f} min] pulse restored after "
+                                         f"{took:.0f} ms (ticks_ms {self.board.ticks_ms()})")
+                else:
+                    self.pulses_ok += 1
+            elif now - answered > PULSE_MS + PULSE_TOL_MS:
+                self.pulse = None
+                if self.in_fault(now) or any(a <= answered + PULSE_MS <= b for a, b in self.faults):
+                    self.notes.append(f"pulse held past 5 s during a link/power fault at "
+                                      f"{now / 60000:.1f} min (main loop waits for link)")
+                else:
+                    self.failures.append(f"[{now / 60000:7.1f} min] pulse not restored "
+                                         f"{(now - sent) / 1000:.1f} s after /p")
+
+    def sample(self):
+        w5 = self.board.w5500
+        w = self.window()
+        ns = self.board.ns
+        w.sample("w5500_sockets", w5.open_sockets() if w5 else 0)
+        w.sample("host_fds", len(os.listdir("/proc/self/fd")))
+        w.sample("threads", threading.active_count())
+        w.sample("retained_b", self.board.retained_bytes())
+        w.sample("stack_depth", self.board.stack_max)
+        w.sample("logs", len(ns.get("logs", ())))
+        w.sample("pulse_tasks", len(ns.get("pulse_tasks", ())))
+        if w5 and w5.open_sockets() > 2:
+            self.fail(f"{w5.open_sockets()} W5500 sockets open (chip has one for HTTP)")
+
+    def inject(self, kind):
+        with self.lock:
+            start = self.now()
+            if kind == "flap":
+                down = self.rng.uniform(2000, 30000)
+                self.board.link_flap(down)
+                self.fault_active = start + down
+                self.faults.append((start, start + down))
+            else:
+                # Keep the wrap where it was planned if it is still ahead
+                if self.wrapped_ms is None and self.wrap_ms > start:
+                    self.board.ticks_start = TICKS_PERIOD - int(self.wrap_ms - start)
+                else:
+                    self.board.ticks_start = 0
+                self.board.power_cycle()
+                self.fault_active = start
+                self.faults.append((start, start + 1000))
+                self.pulse = None           # RAM and relays reset with the board
+
+    def run(self):
+        a = self.args
+        print(f"Soak: {a.hours:g} virtual h at {a.speed:g}x (~{a.hours * 60 / a.speed:.1f} min), "
+              f"{a.clients} clients at {a.rps:g} req/s, ticks_ms wraps at "
+              f"{a.hours * a.wrap_at * 60:.0f} min")
+        self.board.start()
+        if not self.board.wait_ready():
+            print("Server did not start")
+            return 1
+        threads = [threading.Thread(target=self.client, args=(a.seed + i,), daemon=True)
+                   for i in range(a.clients)]
+        for t in threads:
+            t.start()
+
+        next_flap = a.flap_every * 60000 if a.flap_every else None
+        next_power = a.power_every * 60000 if a.power_every else None
+        next_climate = 0
+        next_sample = 0
+        window_ms = a.window * 60000
+        cpu0 = self.board.cpu_seconds()
+        last_ticks = self.board.ticks_ms()
+        last_boots = self.board.boots
+        rows = []
+
+        while self.now() < self.end_ms and not self.board.crash:
+            now = self.now()
+            ticks = self.board.ticks_ms()
+            if ticks < last_ticks and self.board.boots == last_boots and self.wrapped_ms is None:
+                self.wrapped_ms = now
+                print(f"  ticks_ms wrapped at {now / 60000:.1f} min")
+            last_ticks, last_boots = ticks, self.board.boots
+            if now >= next_climate:
+                temp = round(self.rng.uniform(15, 30), 1)
+                with self.lock:
+                    self.board.climate = (temp, 45.0)
+                    self.climate_set.append((now, temp))
+                    del self.climate_set[:-10]
+                next_climate = now + 60000
+            if next_flap is not None and now >= next_flap:
+                self.inject("flap")
+                next_flap += a.flap_every * 60000
+            if next_power is not None and now >= next_power:
+                self.inject("power")
+                next_power += a.power_every * 60000
+            if now >= next_sample:
+                self.sample()
+                next_sample = now + 1000
+            self.check_pulse()
+            if now >= (len(self.windows)) * window_ms:
+                with self.lock:
+                    cpu = self.board.cpu_seconds()
+                    rows.append(self.window().row(cpu - cpu0))
+                    cpu0 = cpu
+                    self.print_row(len(rows) - 1, rows[-1])
+                    self.windows.append(Window(len(self.windows)))
+                    self.board.stack_max = 0
+            time.sleep(0.002)
+
+        self.stop = True
+        for t in threads:
+            t.join(5)
+        with self.lock:
+            if self.window().requests:
+                rows.append(self.window().row(self.board.cpu_seconds() - cpu0))
+                self.print_row(len(rows) - 1, rows[-1])
+        self.board.stop()
+        return self.verdict(rows)
+
+    def print_row(self, i, r):
+        if i == 0:
+            print(f"\n{'window':>6s} {'req':>5s} {'err':>4s} {'p50':>7s} {'p99':>7s} {'cpu/req':>8s} "
+                  f"{'socks':>5s} {'fds':>4s} {'retained':>9s} {'stack':>5s} {'logs':>4s} {'pulses':>6s}")
+        print(f"{i * self.args.window:5g}m {r['requests']:5d} {r['errors']:4d} {r['p50_ms']:7.0f} "
+              f"{r['p99_ms']:7.0f} {r['cpu_ms_req']:7.2f}m {r.get('w5500_sockets', 0):5d} "
+              f"{r.get('host_fds', 0):4d} {r.get('retained_b', 0):9d} {r.get('stack_depth', 0):5d} "
+              f"{r.get('logs', 0):4d} {r.get('pulse_tasks', 0):6d}")
+
+    def verdict(self, rows):
+        a = self.args
+        if a.csv:
+            keys = list(rows[0].keys()) if rows else []
+            with open(a.csv, "w") as f:
+                f.write("window_min," + ",".join(keys) + "\n")
+                for i, r in enumerate(rows):
+                    f.write(f"{i * a.window:g}," + ",".join(str(r.get(k, "")) for k in keys) + "\n")
+
+        print()
+        if self.board.crash:
+            self.failures.append(f"server crashed: {self.board.crash}")
+        series = rows[1:] if len(rows) > 2 else []
+        for name, abs_tol, rel_tol in TRENDS:
+            values = [r.get(name, 0) for r in series if r["requests"]]
+            if len(values) < 3:
+                continue
+            g, tau = trend(values)
+            base = sorted(values)[len(values) // 2]
+            limit = abs_tol + rel_tol * abs(base)
+            rising = g > limit and tau >= TREND_TAU
+            print(f"trend {name:14s} growth {g:+10.2f} (limit {limit:.2f}) tau {tau:+.2f}  "
+                  f"{'FAIL' if rising else 'ok'}")
+            if rising:
+                self.failures.append(f"{name} trends upward: {values[0]} -> {values[-1]}")
+
+        requests = sum(r["requests"] for r in rows)
+        errors = sum(r["errors"] for r in rows)
+        if requests and errors / requests > a.max_errors / 100:
+            self.failures.append(f"{errors}/{requests} requests failed outside faults")
+        if self.wrapped_ms is None and a.wrap_at < 1:
+            self.notes.append("ticks_ms did not wrap during the run")
+
+        print(f"\nrequests {requests}, errors outside faults {errors}, "
+              f"during faults {sum(r['fault_errors'] for r in rows)}")
+        print(f"pulses checked {self.pulses_ok}, boots {self.board.boots}, "
+              f"recoveries {len(self.recoveries)}"
+              + (f" (max {max(self.recoveries) / 1000:.1f} s)" if self.recoveries else ""))
+        if self.dht_staleness:
+            print(f"DHT value age max {max(self.dht_staleness) / 1000:.1f} s")
+        for n in sorted(set(self.notes)):
+            print(f"note: {n}")
+        for f in self.failures:
+            print(f"FAIL {f}")
+        print("\nSOAK " + ("FAILED" if self.failures else "PASSED"))
+        return 1 if self.failures else 0
+
+def main():
+    ap = argparse.ArgumentParser(description="Accelerated soak test on the host emulator")
+    ap.add_argument("--hours", type=float, default=6, help="virtual duration")
+    ap.add_argument("--speed", type=float, default=30, help="virtual clock speed (x real time)")
+    ap.add_argument("--clients", type=int, default=2)
+    ap.add_argument("--rps", type=float, default=1.0, help="requests per virtual second, all clients")
+    ap.add_argument("--window", type=float, default=15, help="statistics window, virtual minutes")
+    ap.add_argument("--flap-every", type=float, default=20, help="link flap period, virtual min (0: off)")
+    ap.add_argument("--power-every", type=float, default=75, help="power cycle period, virtual min (0: off)")
+    ap.add_argument("--wrap-at", type=float, default=0.5, help="ticks_ms wrap as a fraction of the run")
+    ap.add_argument("--recovery-max", type=float, default=15, help="virtual s to serve again after a fault")
+    ap.add_argument("--max-errors", type=float, default=1.0, help="%% of requests allowed to fail outside faults")
+    ap.add_argument("--script", default=SERVER, help="server to soak (a modified copy, say)")
+    ap.add_argument("--port", type=int, default=18090)
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--csv", help="write per-window statistics")
+    args = ap.parse_args()
+    if args.hours * 3600 / args.speed < 10:
+        ap.error("run is shorter than 10 real seconds; lower --speed")
+    return Soak(args).run()
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,529 @@
+"""
+Request trace capture and time-accurate replay (C firmware or MicroPython server)
+Run: python trace_replay.py record --board 192.168.1.100 --seconds 30 -o trace.jsonl
+     python trace_replay.py record --pcap board.pcap -o trace.jsonl
+     python trace_replay.py record --proxy 8080 --target 192.168.1.100 -o trace.jsonl
+     python trace_replay.py replay trace.jsonl --target 192.168.1.100 [--speed 1|4|max]
+     python trace_replay.py replay trace.jsonl --emu --speed 10 -o emu.jsonl
+     python trace_replay.py replay trace.jsonl --target 192.168.1.100 --compare emu.jsonl
+
+A trace is JSON lines, one HTTP request each: arrival time t (s from the
+first request), client connection (conn, src), method, path, the raw
+request bytes and, when the response was seen, its status and body hash.
+
+Sources:
+- --board: starts the C firmware's capture ring (/debug/pcap, dir=rx,
+  CAPTURE_SLOTS records of up to CAPTURE_SNAPLEN_MAX bytes), waits and
+  downloads it. Short, but needs nothing between the clients and the board
+- --pcap: any pcap of HTTP to the board (LINKTYPE_RAW from /debug/pcap,
+  Ethernet or Linux cooked from tcpdump on a mirror port)
+- --proxy: recording proxy in front of the board. Point browsers and
+  scripts at it; full requests and responses, no length limit
+Requests cut by the snaplen are marked truncated and replayed as captured.
+
+Replay sends every request at its recorded time divided by --speed
+(max: back to back). Requests of one client connection stay in order and
+concurrency stays what the trace had: at max speed at most as many
+requests are in flight as overlapped in the trace. Both servers close
+the connection after each response and refuse connections while busy
+(the MicroPython server has one socket); refused connects, and resets
+before any data, are retried and counted. --emu replays against host_emu.py with its clock at --speed.
+
+Reported: latency per path (connect to last byte), how late requests
+were sent against the schedule, and responses that differ from the
+trace or from a --compare run (status, or body with digits masked since
+readings and uptimes change). -o saves this run for a later --compare.
+"""
+import argparse
+import asyncio
+import hashlib
+import json
+import re
+import struct
+import sys
+import time
+import urllib.request
+
+# ============= TRACE RECORDS =============
+
+def norm_path(path):
+    """Group key: query values dropped (/r?n=1&s=0 -> /r?n=&s=)"""
+    return re.sub(r"=[^&]*", "=", path)
+
+def body_digest(body):
+    return hashlib.sha1(re.sub(rb"\d+", b"0", body)).hexdigest()[:12]
+
+def parse_response(data):
+    """(status, body) of a raw response; status 0 if unparsable"""
+    head, sep, body = data.partition(b"\r\n\r\n")
+    m = re.match(rb"HTTP/1\.[01] (\d{3})", head)
+    return (int(m.group(1)) if m else 0), body
+
+def split_requests(data):
+    """Split a client byte stream into requests: [(offset, raw, complete)]"""
+    out = []
+    pos = 0
+    while pos < len(data):
+        end = data.find(b"\r\n\r\n", pos)
+        if end < 0:
+            out.append((pos, data[pos:], False))
+            break
+        head = data[pos:end]
+        m = re.search(rb"\r\ncontent-length:\s*(\d+)", head, re.I)
+        stop = end + 4 + (int(m.group(1)) if m else 0)
+        out.append((pos, data[pos:stop], stop <= len(data)))
+        pos = stop
+    return out
+
+def make_record(t, conn, src, raw, truncated):
+    line = raw.split(b"\r\n", 1)[0].decode("latin-1").split(" ")
+    return {
+        "t": round(t, 6),
+        "conn": conn,
+        "src": src,
+        "method": line[0],
+        "path": line[1] if len(line) > 1 else "",
+        "raw": raw.decode("latin-1"),
+        "truncated": truncated,
+    }
+
+def write_trace(path, records):
+    with open(path, "w") as f:
+        for r in records:
+            f.write(json.dumps(r) + "\n")
+    truncated = sum(r.get("truncated", False) for r in records)
+    print(f"Saved {len(records)} requests to {path}"
+          + (f" ({truncated} truncated)" if truncated else ""))
+
+def load_trace(path):
+    with open(path) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+# ============= PCAP =============
+
+LINKTYPE_ETHERNET = 1
+LINKTYPE_RAW = 101
+LINKTYPE_LINUX_SLL = 113
+
+def pcap_packets(data):
+    """Yield (t, linktype, packet bytes, original length)"""
+    magic = data[:4]
+    if magic in (b"\xd4\xc3\xb2\xa1", b"\x4d\x3c\xb2\xa1"):
+        end = "<"
+    elif magic in (b"\xa1\xb2\xc3\xd4", b"\xa1\xb2\x3c\x4d"):
+        end = ">"
+    else:
+        raise ValueError("not a pcap file (pcapng is not supported; save as pcap)")
+    nano = magic in (b"\x4d\x3c\xb2\xa1", b"\xa1\xb2\x3c\x4d")
+    linktype = struct.unpack(end + "I", data[20:24])[0]
+    rec = struct.Struct(end + "IIII")
+    pos = 24
+    while pos + rec.size <= len(data):
+        sec, frac, incl, orig = rec.unpack_from(data, pos)
+        pos += rec.size
+        yield sec + frac / (1e9 if nano else 1e6), linktype, data[pos:pos + incl], orig
+        pos += incl
+
+def ip_packet(linktype, pkt):
+    """IPv4 packet inside a link frame, None for anything else"""
+    if linktype == LINKTYPE_RAW:
+        return pkt
+    if linktype == LINKTYPE_ETHERNET:
+        off, etype = 14, pkt[12:14]
+        while etype == b"\x81\x00":         # 802.1Q tags
+            etype, off = pkt[off + 2:off + 4], off + 4
+        return pkt[off:] if etype == b"\x08\x00" else None
+    if linktype == LINKTYPE_LINUX_SLL:
+        return pkt[16:] if pkt[14:16] == b"\x08\x00" else None
+    raise ValueError(f"unsupported linktype {linktype}")
+
+def trace_from_pcap(data, port):
+    """Requests to TCP port (and the board's responses, if captured)"""
+    # stream key (client ip, client port, server ip) -> segments
+    streams = {}
+    order = []
+    for t, linktype, pkt, orig in pcap_packets(data):
+        ip = ip_packet(linktype, pkt)
+        if not ip or ip[0] >> 4 != 4 or ip[9] != 6:
+            continue
+        ihl = (ip[0] & 0x0F) * 4
+        total = struct.unpack(">H", ip[2:4])[0]
+        tcp = ip[ihl:]
+        if len(tcp) < 20:
+            continue
+        sport, dport, seq = struct.unpack(">HHI", tcp[:8])
+        doff = (tcp[12] >> 4) * 4
+        payload = tcp[doff:total - ihl]
+        missing = (total - ihl - doff) - len(payload)
+        src, dst = ".".join(map(str, ip[12:16])), ".".join(map(str, ip[16:20]))
+        if dport == port:
+            key, way = (src, sport, dst), "rx"
+        elif sport == port:
+            key, way = (dst, dport, src), "tx"
+        else:
+            continue
+        if key not in streams:
+            streams[key] = {"rx": {}, "tx": {}, "t": {}, "gaps": {"rx": set(), "tx": set()}}
+            order.append(key)
+        s = streams[key]
+        if payload and seq not in s[way]:          # Retransmissions keep the first copy
+            s[way][seq] = payload
+            if way == "rx":
+                s["t"][seq] = t
+            if missing > 0 or orig > len(pkt):
+                s["gaps"][way].add(seq)
+
+    records = []
+    t0 = None
+    for conn, key in enumerate(order):
+        s = streams[key]
+        for way in ("rx", "tx"):
+            # Reassemble; bytes lost to the snaplen become a gap marker
+            data_, cuts, times, expect = bytearray(), [], [], None
+            for seq in sorted(s[way]):
+                if expect is not None and seq != expect:
+                    cuts.append(len(data_))
+                if seq in s["gaps"][way]:
+                    cuts.append(len(data_) + len(s[way][seq]))
+                times.append((len(data_), s["t"].get(seq)))
+                data_ += s[way][seq]
+                expect = seq + len(s[way][seq])
+            s[way + "_data"], s[way + "_cuts"], s[way + "_times"] = bytes(data_), cuts, times
+
+        reqs = split_requests(s["rx_data"])
+        for i, (off, raw, complete) in enumerate(reqs):
+            t = [tt for o, tt in s["rx_times"] if o <= off][-1]
+            cut = any(off < c <= off + len(raw) for c in s["rx_cuts"])
+            rec = make_record(t, conn, f"{key[0]}:{key[1]}", raw, cut or not complete)
+            if s["tx_data"] and len(reqs) == 1:
+                status, body = parse_response(s["tx_data"])
+                rec["resp"] = {"status": status}
+                if not s["tx_cuts"]:
+                    rec["resp"].update(sha1=body_digest(body), len=len(body))
+            records.append(rec)
+    if records:
+        records.sort(key=lambda r: r["t"])
+        t0 = records[0]["t"]
+        for r in records:
+            r["t"] = round(r["t"] - t0, 6)
+    return records
+
+def record_board(args):
+    base = f"http://{args.board}"
+    query = f"action=start&port={args.port}&snaplen=256"
+    if not args.with_responses:
+        query += "&dir=rx"
+    urllib.request.urlopen(urllib.request.Request(f"{base}/debug/pcap?{query}", method="POST"),
+                           timeout=5).read()
+    print(f"Capturing on {args.board} for {args.seconds} s (ring keeps the newest records)...")
+    time.sleep(args.seconds)
+    data = urllib.request.urlopen(f"{base}/debug/pcap", timeout=10).read()
+    urllib.request.urlopen(urllib.request.Request(f"{base}/debug/pcap?action=stop", method="POST"),
+                           timeout=5).read()
+    if args.save_pcap:
+        open(args.save_pcap, "wb").write(data)
+    # Our own download shows up in the capture as well
+    return [r for r in trace_from_pcap(data, args.port) if not r["path"].startswith("/debug/pcap")]
+
+# ============= RECORDING PROXY =============
+
+async def read_request(reader):
+    head = await reader.readuntil(b"\r\n\r\n")
+    m = re.search(rb"\r\ncontent-length:\s*(\d+)", head, re.I)
+    body = await reader.readexactly(int(m.group(1))) if m else b""
+    return head + body
+
+async def record_proxy(args, records):
+    counter = [0]
+    t0 = [None]
+    host, _, tport = args.target.partition(":")
+    tport = int(tport or 80)
+
+    async def on_client(reader, writer):
+        conn = counter[0]
+        counter[0] += 1
+        peer = writer.get_extra_info("peername")
+        try:
+            raw = await read_request(reader)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            writer.close()
+            return
+        now = time.monotonic()
+        if t0[0] is None:
+            t0[0] = now
+        rec = make_record(now - t0[0], conn, f"{peer[0]}:{peer[1]}", raw, False)
+        records.append(rec)
+        print(f"{rec['t']:9.3f} {rec['method']} {rec['path']}")
+        resp = bytearray()
+        try:
+            up_r, up_w, rec["refused"] = await connect(host, tport, 5, 400)
+            up_w.write(raw)
+            await up_w.drain()
+            while True:                     # Stream through (server-sent events too)
+                chunk = await up_r.read(4096)
+                if not chunk:
+                    break
+                resp += chunk
+                writer.write(chunk)
+                await writer.drain()
+            up_w.close()
+        except (ConnectionError, OSError) as e:
+            rec["error"] = str(e)
+        status, body = parse_response(bytes(resp))
+        rec["resp"] = {"status": status, "sha1": body_digest(body), "len": len(body)}
+        rec["latency_ms"] = round((time.monotonic() - now) * 1000, 3)
+        writer.close()
+
+    server = await asyncio.start_server(on_client, "0.0.0.0", args.proxy)
+    print(f"Recording proxy on :{args.proxy} -> {host}:{tport}, Ctrl+C to save")
+    async with server:
+        await server.serve_forever()
+
+# ============= REPLAY =============
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+def report(name, rtts):
+    ms = [r * 1000 for r in rtts]
+    print(f"{name:24s} n={len(ms):<5d} min={min(ms):.2f} avg={sum(ms)/len(ms):.2f} "
+          f"p50={percentile(ms, 50):.2f} p95={percentile(ms, 95):.2f} "
+          f"p99={percentile(ms, 99):.2f} max={max(ms):.2f} ms")
+
+def peak_concurrency(records):
+    """Most requests in flight at once in the trace (recorded latency if known, else 1 ms)"""
+    events = []
+    for r in records:
+        events.append((r["t"], 1))
+        events.append((r["t"] + r.get("latency_ms", 1) / 1000, -1))
+    peak = cur = 0
+    for _, d in sorted(events):
+        cur += d
+        peak = max(peak, cur)
+    return max(1, peak)
+
+async def connect(host, port, timeout, retries):
+    """Open a connection, retrying refused connects 5 ms apart (busy server):
+    (reader, writer, refused attempts)"""
+    refused = 0
+    while True:
+        try:
+            reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+            return reader, writer, refused
+        except ConnectionRefusedError:
+            refused += 1
+            if refused > retries:
+                raise
+            await asyncio.sleep(0.005)
+
+async def send_one(host, port, raw, timeout, retries):
+    """One request on a fresh connection: (status, body, refused, error)"""
+    refused = 0
+    while True:
+        try:
+            reader, writer, n = await connect(host, port, timeout, retries - refused)
+            refused += n
+        except ConnectionRefusedError:
+            return 0, b"", retries + 1, "refused"
+        except (asyncio.TimeoutError, OSError) as e:
+            return 0, b"", refused, f"connect: {e!r}"
+        data = b""
+        try:
+            writer.write(raw)
+            await writer.drain()
+            stream = b"text/event-stream" in raw or b"/api/events" in raw
+            while True:
+                chunk = await asyncio.wait_for(reader.read(4096), timeout)
+                if not chunk:
+                    break
+                data += chunk
+                if stream and b"\r\n\r\n" in data:    # Headers of an event stream are enough
+                    break
+            writer.close()
+            if not data:
+                return 0, b"", refused, "closed without response"
+            status, body = parse_response(data)
+            return status, body, refused, None
+        except asyncio.TimeoutError:
+            writer.close()
+            return 0, b"", refused, "timeout"
+        except ConnectionError as e:
+            # Reset before any data: the handshake was queued by the host
+            # listener while the one socket was busy, same as a refusal
+            if data or refused >= retries:
+                return 0, b"", refused, repr(e)
+            refused += 1
+            await asyncio.sleep(0.005)
+
+async def replay(records, host, port, speed, timeout, retries):
+    by_conn = {}
+    for i, r in enumerate(records):
+        by_conn.setdefault(r["conn"], []).append(i)
+    results = [None] * len(records)
+    limit = asyncio.Semaphore(peak_concurrency(records) if speed is None else len(by_conn))
+    start = time.monotonic() + 0.05
+
+    async def client(indices):
+        for i in indices:
+            r = records[i]
+            due = start + (r["t"] / speed if speed else 0)
+            delay = due - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            async with limit:
+                t_send = time.monotonic()
+                status, body, refused, error = await send_one(
+                    host, port, r["raw"].encode("latin-1"), timeout, retries)
+                t_done = time.monotonic()
+            results[i] = {
+                "i": i,
+                "t": r["t"],
+                "path": r["path"],
+                "slip_ms": round((t_send - due) * 1000, 3) if speed else 0.0,
+                "latency_ms": round((t_done - t_send) * 1000, 3),
+                "status": status,
+                "sha1": body_digest(body) if status else None,
+                "len": len(body),
+                "refused": refused,
+                "error": error,
+            }
+
+    t_begin = time.monotonic()
+    await asyncio.gather(*(client(ix) for ix in by_conn.values()))
+    return results, time.monotonic() - t_begin
+
+def compare(records, results, reference):
+    """Divergent responses: [(i, path, what, expected, got)]"""
+    out = []
+    for i, (rec, res) in enumerate(zip(records, results)):
+        ref = reference[i] if reference is not None else rec.get("resp")
+        if reference is not None and ref is not None:
+            ref = ref.get("resp", ref)
+        if not ref:
+            continue
+        if ref.get("status") != res["status"]:
+            out.append((i, rec["path"], "status", ref.get("status"), res["status"] or res["error"]))
+        elif ref.get("sha1") and res["sha1"] and ref["sha1"] != res["sha1"]:
+            out.append((i, rec["path"], "body", f"{ref['sha1']}/{ref.get('len')}B",
+                        f"{res['sha1']}/{res['len']}B"))
+    return out
+
+def run_replay(args):
+    records = load_trace(args.trace)
+    if not records:
+        print("Empty trace")
+        return 1
+    speed = None if args.speed == "max" else float(args.speed)
+    board = None
+    if args.emu:
+        from host_emu import Board, Clock
+        board = Board(args.emu_port, clock=Clock(speed or args.emu_max_speed)).start()
+        if not board.wait_ready():
+            print("Emulator did not start")
+            return 1
+        host, port = "127.0.0.1", args.emu_port
+        target = f"emulator (clock x{board.clock.speed:g})"
+    else:
+        host, _, port = args.target.partition(":")
+        port = int(port or 80)
+        target = args.target
+
+    truncated = sum(r.get("truncated", False) for r in records)
+    print(f"Replaying {len(records)} requests ({truncated} truncated) over "
+          f"{records[-1]['t']:.2f} s of trace to {target} at "
+          f"{'max speed' if speed is None else f'{speed:g}x'}")
+    results, elapsed = asyncio.run(replay(records, host, port, speed, args.timeout, args.retries))
+    if board:
+        board.stop()
+
+    ok = [r for r in results if r["status"]]
+    print(f"\n{len(ok)}/{len(results)} answered in {elapsed:.2f} s "
+          f"({len(results) / elapsed:.1f} req/s), refused connects retried: "
+          f"{sum(r['refused'] for r in results)}")
+    by_path = {}
+    for r in ok:
+        by_path.setdefault(norm_path(r["path"]), []).append(r["latency_ms"] / 1000)
+    print("\nLatency (connect to last byte):")
+    report("all", [r["latency_ms"] / 1000 for r in ok] or [0])
+    for path, rtts in sorted(by_path.items()):
+        report(path[:24], rtts)
+    if speed is not None:
+        print("\nSend slip against the trace schedule:")
+        report("slip", [max(0, r["slip_ms"]) / 1000 for r in results])
+
+    errors = {}
+    for r in results:
+        if r["error"]:
+            errors[r["error"]] = errors.get(r["error"], 0) + 1
+    for e, n in sorted(errors.items(), key=lambda x: -x[1]):
+        print(f"  error x{n}: {e}")
+
+    reference = load_trace(args.compare) if args.compare else None
+    if reference is not None and len(reference) != len(records):
+        print(f"\n--compare has {len(reference)} entries, trace {len(records)}: not the same trace")
+        reference = None
+    diffs = compare(records, results, reference)
+    source = args.compare or "recorded responses"
+    print(f"\nDivergent responses vs {source}: {len(diffs)}")
+    for i, path, what, want, got in diffs[:args.show]:
+        print(f"  #{i} {path}: {what} {want} -> {got}")
+
+    if args.output:
+        write_trace(args.output, results)
+    return 1 if diffs or errors else 0
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    rec = sub.add_parser("record", help="capture a trace")
+    src = rec.add_mutually_exclusive_group(required=True)
+    src.add_argument("--board", help="C firmware address: capture with /debug/pcap")
+    src.add_argument("--pcap", help="read a pcap file")
+    src.add_argument("--proxy", type=int, help="run a recording proxy on this port")
+    rec.add_argument("--target", help="board address for --proxy (host[:port])")
+    rec.add_argument("--seconds", type=float, default=30, help="--board capture time")
+    rec.add_argument("--with-responses", action="store_true",
+                     help="--board: capture responses too (fewer requests fit the ring)")
+    rec.add_argument("--save-pcap", help="--board: keep the downloaded pcap")
+    rec.add_argument("--port", type=int, default=80, help="server TCP port in the capture")
+    rec.add_argument("-o", "--output", required=True)
+
+    rep = sub.add_parser("replay", help="replay a trace")
+    rep.add_argument("trace")
+    dst = rep.add_mutually_exclusive_group(required=True)
+    dst.add_argument("--target", help="host[:port] of a board (C or MicroPython)")
+    dst.add_argument("--emu", action="store_true", help="run the MicroPython server in host_emu.py")
+    rep.add_argument("--speed", default="1", help="time scale: 1, N or max")
+    rep.add_argument("--emu-port", type=int, default=18080)
+    rep.add_argument("--emu-max-speed", type=float, default=10,
+                     help="emulator clock speed for --speed max (the server waits only 50 ms "
+                          "for a request after accept, so very fast clocks drop requests)")
+    rep.add_argument("--timeout", type=float, default=5)
+    rep.add_argument("--retries", type=int, default=400, help="refused connects retried (5 ms apart)")
+    rep.add_argument("--compare", help="earlier replay output (-o) to diff responses against")
+    rep.add_argument("--show", type=int, default=10, help="divergences to list")
+    rep.add_argument("-o", "--output", help="save results (for --compare)")
+    args = ap.parse_args()
+
+    if args.cmd == "record":
+        if args.board:
+            records = record_board(args)
+        elif args.pcap:
+            records = trace_from_pcap(open(args.pcap, "rb").read(), args.port)
+        else:
+            if not args.target:
+                ap.error("--proxy needs --target")
+            records = []
+            try:
+                asyncio.run(record_proxy(args, records))
+            except KeyboardInterrupt:
+                pass
+            records.sort(key=lambda r: r["t"])
+        write_trace(args.output, records)
+        return 0
+    return run_replay(args)
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,212 @@
+"""
+Stand-in hub for the board tunnel (C firmware, TUNNEL_ENABLE 1)
+Run: python tunnel_hub.py [--port 7000] [--http 8080] [--token change-me]
+     python tunnel_hub.py --bench 200 [--direct 192.168.1.100]
+     python tunnel_hub.py --cert hub.crt --key hub.key   (TLS, TUNNEL_TLS 1)
+
+Accepts the board's outbound connection and exposes it as a local HTTP
+proxy: curl http://localhost:8080/api/relays goes through the tunnel.
+Events pushed by the board are printed; telemetry points replayed from
+the board's flash backlog are acknowledged so the board can release
+them. --bench measures request round
+trip through the tunnel (and directly to the board with --direct).
+"""
+import argparse
+import asyncio
+import json
+import ssl
+import struct
+import sys
+import time
+
+HELLO, REQ, RESP, END, EVENT, PING, PONG, ACK, TIME = range(1, 10)
+HDR = struct.Struct(">BBHH")    # type, flags, id, len
+U32 = struct.Struct(">I")       # ACK seq, TIME unix seconds
+
+class Board:
+    """One tunnel connection from a board"""
+
+    def __init__(self, reader, writer, token, on_hello):
+        self.reader = reader
+        self.writer = writer
+        self.token = token
+        self.on_hello = on_hello    # called once the HELLO token checks out
+        self.info = None            # HELLO of an authenticated board
+        self.next_id = 1
+        self.pending = {}           # id -> (future, [chunks])
+        self.lock = asyncio.Lock()  # board serves one request at a time anyway
+
+    def send(self, ftype, fid, payload=b""):
+        self.writer.write(HDR.pack(ftype, 0, fid, len(payload)) + payload)
+
+    async def run(self):
+        while True:
+            hdr = await self.reader.readexactly(HDR.size)
+            ftype, _, fid, length = HDR.unpack(hdr)
+            payload = await self.reader.readexactly(length) if length else b""
+
+            if ftype == HELLO:
+                info = json.loads(payload)
+                if info.get("token") != self.token:
+                    print(f"Rejected board {info.get('mac')}: bad token")
+                    self.writer.close()
+                    return
+                self.info = info
+                print(f"Board connected: {info}")
+                self.send(TIME, 0, U32.pack(int(time.time())))
+                self.on_hello(self)
+            elif self.info is None:
+                continue            # nothing but HELLO until authenticated
+            elif ftype == RESP and fid in self.pending:
+                self.pending[fid][1].append(payload)
+            elif ftype == END and fid in self.pending:
+                fut, chunks = self.pending.pop(fid)
+                fut.set_result(b"".join(chunks))
+            elif ftype == EVENT:
+                print(f"Event: {payload.decode(errors='replace')}")
+                self.ack(payload)
+            elif ftype == PING:
+                self.send(PONG, fid, payload)
+
+    def ack(self, payload):
+        """Acknowledge backlog telemetry points (live points are not kept on the board)"""
+        try:
+            event = json.loads(payload)
+        except ValueError:
+            return
+        if event.get("type") == "point" and event.get("backlog"):
+            self.send(ACK, 0, U32.pack(event["seq"]))
+
+    async def request(self, raw):
+        """Send raw HTTP request, return raw HTTP response"""
+        async with self.lock:
+            fid = self.next_id
+            self.next_id = (self.next_id % 0xFFFF) + 1
+            fut = asyncio.get_running_loop().create_future()
+            self.pending[fid] = (fut, [])
+            try:
+                self.send(REQ, fid, raw)
+                await self.writer.drain()
+                return await asyncio.wait_for(fut, 10)
+            finally:
+                # Late RESP frames for a timed-out request find nothing
+                self.pending.pop(fid, None)
+
+class Hub:
+    def __init__(self, args):
+        self.args = args
+        self.board = None
+        self.connected = asyncio.Event()
+
+    async def on_board(self, reader, writer):
+        board = Board(reader, writer, self.args.token, self.on_hello)
+        peer = writer.get_extra_info("peername")
+        print(f"Connection from {peer[0]}:{peer[1]}")
+        try:
+            await board.run()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        except asyncio.CancelledError:
+            return          # hub shutting down
+        print("Board disconnected")
+        if self.board is board:
+            self.board = None
+            self.connected.clear()
+
+    def on_hello(self, board):
+        """Route requests to a board only after its HELLO token was accepted"""
+        self.board = board
+        self.connected.set()
+
+    async def on_http(self, reader, writer):
+        """Local HTTP client -> tunnel -> board"""
+        try:
+            raw = await reader.readuntil(b"\r\n\r\n")
+            for line in raw.split(b"\r\n"):
+                if line.lower().startswith(b"content-length:"):
+                    raw += await reader.readexactly(int(line.split(b":")[1]))
+            if not self.board:
+                writer.write(b"HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n")
+            else:
+                writer.write(await self.board.request(raw))
+            await writer.drain()
+        except Exception as e:
+            print(f"Proxy error: {e}")
+        writer.close()
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+def report(name, rtts):
+    ms = [r * 1000 for r in rtts]
+    print(f"{name:8s} n={len(ms)} min={min(ms):.2f} avg={sum(ms)/len(ms):.2f} "
+          f"p50={percentile(ms, 50):.2f} p95={percentile(ms, 95):.2f} "
+          f"p99={percentile(ms, 99):.2f} max={max(ms):.2f} ms")
+
+REQUESTS = [
+    b"GET /api/relays HTTP/1.1\r\nHost: board\r\n\r\n",
+    b"POST /api/relay/1 HTTP/1.1\r\nHost: board\r\nContent-Length: 11\r\n\r\n{\"state\":1}",
+    b"POST /api/relay/1 HTTP/1.1\r\nHost: board\r\nContent-Length: 11\r\n\r\n{\"state\":0}",
+]
+
+async def direct_request(host, raw):
+    reader, writer = await asyncio.open_connection(host, 80)
+    writer.write(raw)
+    await writer.drain()
+    resp = await reader.read()
+    writer.close()
+    return resp
+
+async def bench(hub):
+    args = hub.args
+    print("Waiting for board...")
+    await hub.connected.wait()
+    await asyncio.sleep(0.5)
+
+    tunnel = []
+    for i in range(args.bench):
+        t = time.perf_counter()
+        await hub.board.request(REQUESTS[i % len(REQUESTS)])
+        tunnel.append(time.perf_counter() - t)
+    report("tunnel", tunnel)
+
+    if args.direct:
+        direct = []
+        for i in range(args.bench):
+            t = time.perf_counter()
+            await direct_request(args.direct, REQUESTS[i % len(REQUESTS)])
+            direct.append(time.perf_counter() - t)
+        report("direct", direct)
+
+async def main():
+    ap = argparse.ArgumentParser(description="Board tunnel stand-in hub")
+    ap.add_argument("--port", type=int, default=7000, help="board tunnel port")
+    ap.add_argument("--http", type=int, default=8080, help="local HTTP proxy port")
+    ap.add_argument("--token", default="change-me")
+    ap.add_argument("--cert", help="TLS certificate (enables TLS)")
+    ap.add_argument("--key", help="TLS private key")
+    ap.add_argument("--bench", type=int, default=0, help="run N requests and report RTT")
+    ap.add_argument("--direct", help="board IP for a direct HTTP baseline")
+    args = ap.parse_args()
+
+    ctx = None
+    if args.cert:
+        ctx = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+        ctx.load_cert_chain(args.cert, args.key)
+
+    hub = Hub(args)
+    await asyncio.start_server(hub.on_board, "0.0.0.0", args.port, ssl=ctx)
+    await asyncio.start_server(hub.on_http, "127.0.0.1", args.http)
+    print(f"Hub on :{args.port}{' (TLS)' if ctx else ''}, HTTP proxy on http://127.0.0.1:{args.http}")
+
+    if args.bench:
+        await bench(hub)
+    else:
+        await asyncio.Event().wait()
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        sys.exit(0)
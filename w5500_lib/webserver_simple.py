@@ -6,6 +6,7 @@ from machine import Pin, SoftSPI, UART
 from w5500_simple import W5500
 import dht
 import time
+import gc
 
 # ============= CONFIGURATION =============
 # W5500 SPI pins
@@ -353,6 +354,9 @@ def handle_request(req):
 # Main loop
 SOCK = 0
 print(f"\nStarting server on http://{ip[0]}.{ip[1]}.{ip[2]}.{ip[3]}:80")
+# Boot-to-serving time (ticks_ms counts from reset) and heap left for requests
+gc.collect()
+log(f"Boot->serving: {time.ticks_ms()} ms, free heap: {gc.mem_free()} B")
 print("=" * 40)
 
 idle_count = 0